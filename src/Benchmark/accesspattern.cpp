@@ -0,0 +1,244 @@
+#include <accesspattern.hpp>
+
+#include <fstream>
+
+using namespace std;
+
+/*!
+    * \brief Constructor, draws the buffer sizes and the popularity of the working set
+    * \param config The pattern
+    */
+AccessPatternGenerator::AccessPatternGenerator(const PatternConfig &config)
+    : generator(config.seed)
+{
+    this->config = config;
+    this->config.workingSet = max(max(1u, config.workingSet), config.loopLength);
+
+    const unsigned int scanPool = config.scanLength * PATTERN_SCAN_POOL;
+    std::uniform_real_distribution<double> logSize(log((double) max((size_t) 1, config.minSize)),
+                                                   log((double) max(config.minSize, config.maxSize)));
+    for (unsigned int i = 0; i < this->config.workingSet + scanPool; ++i)
+    {
+        // Whole pages, a line never ends halfway a page
+        const size_t size = (size_t) exp(logSize(this->generator));
+        this->sizes.push_back(max((size_t) 4096, (size + 4095) & ~(size_t) 4095));
+    }
+
+    double total = 0;
+    for (unsigned int rank = 0; rank < this->config.workingSet; ++rank)
+    {
+        total += 1.0 / pow(rank + 1.0, this->config.zipf);
+        this->popularity.push_back(total);
+        this->ranks.push_back(rank);
+    }
+    for (auto& p : this->popularity) p /= total;
+    std::shuffle(this->ranks.begin(), this->ranks.end(), this->generator);
+}
+
+/*!
+    * \brief Generate the stream of uses
+    * \return config.uses uses, the buffers index getSizes
+    */
+std::vector<BufferUse> AccessPatternGenerator::generate()
+{
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const unsigned int scanPool = this->config.scanLength * PATTERN_SCAN_POOL;
+    unsigned int scanPosition = 0;
+    unsigned int loopPosition = 0;
+
+    std::vector<BufferUse> uses;
+    while (uses.size() < this->config.uses)
+    {
+        if (this->config.scanLength > 0 && uniform(this->generator) < this->config.scanProbability)
+        {
+            for (unsigned int s = 0; s < this->config.scanLength; ++s)
+            {
+                BufferUse use = {this->config.workingSet + scanPosition++ % scanPool, false, false};
+                uses.push_back(use);
+            }
+            continue;
+        }
+
+        BufferUse use;
+        use.buffer = (this->config.loopLength > 0) ? loopPosition++ % this->config.loopLength : nextPopular();
+        use.write = uniform(this->generator) < this->config.writeFraction;
+        use.read = uniform(this->generator) < this->config.readFraction;
+        uses.push_back(use);
+    }
+    uses.resize(this->config.uses);
+    return uses;
+}
+
+const std::vector<size_t>& AccessPatternGenerator::getSizes()
+{
+    return this->sizes;
+}
+
+unsigned int AccessPatternGenerator::nextPopular()
+{
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const size_t rank = std::lower_bound(this->popularity.begin(), this->popularity.end(), uniform(this->generator)) - this->popularity.begin();
+    return this->ranks[min(rank, this->ranks.size() - 1)];
+}
+
+/* ===================== PATTERN SUITE ===================== */
+
+/*!
+    * \brief Constructor
+    * \param context The OpenCL context, of a CPU device or any other
+    * \param queue The command queue the uploads are enqueued on
+    */
+PatternSuite::PatternSuite(cl_context context, cl_command_queue queue)
+{
+    this->context = context;
+    this->queue = queue;
+}
+
+void PatternSuite::addPattern(const std::string &name, const PatternConfig &config)
+{
+    this->patterns.push_back(std::make_pair(name, config));
+}
+
+void PatternSuite::addConfiguration(const CacheConfiguration &configuration)
+{
+    this->configurations.push_back(configuration);
+}
+
+/*!
+    * \brief Generate every pattern once and replay it on every configuration, so every policy sees the same stream
+    */
+void PatternSuite::run()
+{
+    for (auto& pattern : this->patterns)
+    {
+        AccessPatternGenerator generator(pattern.second);
+        const std::vector<BufferUse> uses = generator.generate();
+
+        std::vector<std::vector<unsigned char>> data;
+        for (auto& size : generator.getSizes()) data.push_back(std::vector<unsigned char>(size, 0));
+
+        for (auto& configuration : this->configurations)
+        {
+            printf("%-30s %s on %s %s\n", "Pattern:", pattern.first.c_str(),
+                   getOrganisationName(configuration.organisation),
+                   getReplacementPolicyName(configuration.replacementPolicy));
+            this->results.push_back(replay(pattern.first, configuration, uses, data));
+        }
+    }
+}
+
+void PatternSuite::printResults()
+{
+    printf("==============================================================================================================\n");
+    printf("%-12s %-18s %-9s %8s %8s %8s %10s %10s %14s\n",
+           "Pattern", "Organisation", "Policy", "Hits", "Misses", "Hit %", "Byte hit %", "Read (MB)", "Modelled (ms)");
+    printf("--------------------------------------------------------------------------------------------------------------\n");
+    for (auto& result : this->results)
+    {
+        printf("%-12s %-18s %-9s %8u %8u %7.2f%% %9.2f%% %10.1f %14.2f\n",
+               result.pattern.c_str(),
+               getOrganisationName(result.configuration.organisation),
+               getReplacementPolicyName(result.configuration.replacementPolicy),
+               result.hits, result.misses, result.hitRatio * 100, result.byteHitRatio * 100, result.bytesRead / 1e6, result.modelledTime / 1000);
+    }
+    printf("==============================================================================================================\n");
+}
+
+void PatternSuite::writeCSV(const std::string &path)
+{
+    ofstream file(path);
+    if (!file.is_open())
+    {
+        printf("Error: Unable to open '%s'\n", path.c_str());
+        return;
+    }
+
+    file << "pattern,organisation,policy,lines,lines_per_set,uses,hits,misses,hit_ratio,byte_hit_ratio,bytes_moved,reads,read_hits,bytes_read,modelled_us" << endl;
+    for (auto& result : this->results)
+    {
+        file << result.pattern << ","
+             << getOrganisationName(result.configuration.organisation) << ","
+             << getReplacementPolicyName(result.configuration.replacementPolicy) << ","
+             << result.configuration.cacheSize << "," << result.configuration.linesPerSet << ","
+             << result.uses << "," << result.hits << "," << result.misses << ","
+             << result.hitRatio << "," << result.byteHitRatio << "," << result.bytesMoved << ","
+             << result.reads << "," << result.readHits << "," << result.bytesRead << "," << result.modelledTime << endl;
+    }
+}
+
+/* ===================== PRIVATE METHODS ===================== */
+
+/*!
+    * \brief Replay a stream on a fresh cache
+    * \param data The host buffers, a write use changes its buffer and a read use overwrites it with the device copy
+    */
+PatternResult PatternSuite::replay(const std::string &name, const CacheConfiguration &configuration,
+                                   const std::vector<BufferUse> &uses, std::vector<std::vector<unsigned char>> &data)
+{
+    Cache *cache = new Cache(configuration.organisation, configuration.replacementPolicy,
+                             configuration.cacheSize, configuration.linesPerSet, configuration.writeBack);
+    cache->resetTimers();
+
+    cl_int err = CL_SUCCESS;
+    for (auto& use : uses)
+    {
+        std::vector<unsigned char> &host = data[use.buffer];
+        if (use.write)
+        {
+            host[0] += 1;
+            cache->setDirtyFlag(host.data(), CPU);
+        }
+
+        cl_mem buffer = cache->createBuffer(this->context, CL_MEM_READ_ONLY, host.size(), NULL, &err);
+        err |= cache->enqueueWriteBuffer(this->queue, buffer, CL_FALSE, 0, host.size(), host.data(), 0, NULL, NULL);
+        if (use.read)
+        {
+            // A kernel produced the data, the host copy is stale until it is read back
+            cache->setDirtyFlag(host.data(), GPU);
+            err |= cache->enqueueReadBuffer(this->queue, buffer, CL_TRUE, 0, host.size(), host.data(), 0, NULL, NULL);
+        }
+        err |= cache->releaseMemObject(buffer);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to replay a use of buffer %u! %s\n", use.buffer, getErrorString(err).c_str());
+            exit(1);
+        }
+    }
+    // With write back the reads that are still deferred arrive now
+    if (configuration.writeBack) err = cache->writeBack();
+    clFinish(this->queue);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to write back the replay! %s\n", getErrorString(err).c_str());
+        exit(1);
+    }
+
+    const durations_t durations = cache->getDurations();
+    delete cache;
+
+    PatternResult result;
+    result.pattern = name;
+    result.configuration = configuration;
+    result.uses = uses.size();
+    result.hits = durations.cacheHit;
+    result.misses = durations.cacheMiss;
+    result.hitRatio = (result.hits + result.misses) > 0 ? (double) result.hits / (result.hits + result.misses) : 0;
+    result.byteHitRatio = durations.bytesh2d_total > 0 ? (double) durations.bytesh2d_saved / durations.bytesh2d_total : 0;
+    result.bytesMoved = durations.bytesh2d_total - durations.bytesh2d_saved;
+    result.reads = 0;
+    for (auto& use : uses) result.reads += use.read;
+    result.readHits = durations.d2hHit;
+    result.bytesRead = durations.bytesd2h_total - durations.bytesd2h_saved;
+
+    // Every miss and every read that was not served from the host is a transfer. With write back the reads are
+    // deferred and the cache does not count its write backs, they are estimated from the bytes and the mean read size.
+    double readTransfers = result.reads - result.readHits;
+    if (configuration.writeBack && durations.bytesd2h_total > 0)
+    {
+        readTransfers = (double) result.bytesRead * result.reads / durations.bytesd2h_total;
+    }
+    // bytes / (GB/s * 1e3) is microseconds
+    result.modelledTime = (result.misses + readTransfers) * PATTERN_LATENCY_US
+                        + (result.bytesMoved + result.bytesRead) / (PATTERN_BANDWIDTH_GBPS * 1e3);
+    return result;
+}
@@ -0,0 +1,106 @@
+#ifndef ACCESSPATTERN_H
+#define ACCESSPATTERN_H
+
+#include <CL/cl.h>
+
+#include <softcache.hpp>
+#include <benchmark.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+
+// Settings
+#define PATTERN_BANDWIDTH_GBPS  12.0    // Modelled host to device bandwidth, PCIe 3.0 x16
+#define PATTERN_LATENCY_US      10.0    // Modelled fixed cost of a transfer
+#define PATTERN_SCAN_POOL       4       // Scans cycle through this many times scanLength cold buffers
+
+struct PatternConfig {
+    unsigned int uses;              // Length of the stream
+    unsigned int workingSet;        // Buffers the popular uses are drawn from
+    double zipf;                    // Exponent of the popularity, 0 is uniform
+    size_t minSize;                 // Buffer sizes are log-uniform in [minSize, maxSize]
+    size_t maxSize;
+    double scanProbability;         // Chance per use to start a scan burst
+    unsigned int scanLength;        // Cold buffers per scan burst, each used once
+    unsigned int loopLength;        // When set, the uses cycle through this many buffers instead of following the popularity
+    double writeFraction;           // Uses that modify the host data before the upload
+    double readFraction;            // Uses that read the result of the device back after the upload
+    unsigned int seed;
+};
+
+struct BufferUse {
+    unsigned int buffer;
+    bool write;
+    bool read;
+};
+
+struct PatternResult {
+    std::string pattern;
+    CacheConfiguration configuration;
+    unsigned int uses;
+    unsigned int hits;
+    unsigned int misses;
+    double hitRatio;
+    double byteHitRatio;
+    size_t bytesMoved;              // Bytes that were uploaded
+    unsigned int reads;
+    unsigned int readHits;          // Reads served from the host copy
+    size_t bytesRead;               // Bytes that were read back, with write back when their lines were written back
+    double modelledTime;            // Of the transfers on the modelled link, in microseconds
+};
+
+/*!
+    * \brief Generates a stream of buffer uses. Popular uses follow a Zipf distribution over the working set,
+    * the ranks are shuffled so popularity does not follow the buffer size. Scan bursts touch cold buffers
+    * once, and a loop longer than the cache defeats recency based replacement.
+    */
+class AccessPatternGenerator
+{
+    private:
+        PatternConfig config;
+        std::mt19937 generator;
+        std::vector<size_t> sizes;              // < per buffer, the working set first and the scan pool after it >
+        std::vector<double> popularity;         // < cumulative probability per rank >
+        std::vector<unsigned int> ranks;        // < rank, buffer >
+
+        unsigned int nextPopular();
+
+    public:
+        AccessPatternGenerator(const PatternConfig &config);
+
+        std::vector<BufferUse> generate();
+        const std::vector<size_t>& getSizes();
+};
+
+/*!
+    * \brief Replays generated streams through the cache, every use creates a buffer, uploads the host data and
+    * releases the buffer again. A write use changes the host data and marks its line dirty first. A read use
+    * stands for a kernel that produced the buffer, it marks the line as written by the device and reads
+    * it back before the release. The device only has to hold the buffers, so a CPU device will do; the
+    * transfer time is modelled from the bytes and the number of transfers the cache could not avoid.
+    */
+class PatternSuite
+{
+    private:
+        cl_context context;
+        cl_command_queue queue;
+        std::vector<std::pair<std::string, PatternConfig>> patterns;
+        std::vector<CacheConfiguration> configurations;
+        std::vector<PatternResult> results;
+
+        PatternResult replay(const std::string &name, const CacheConfiguration &configuration,
+                             const std::vector<BufferUse> &uses, std::vector<std::vector<unsigned char>> &data);
+
+    public:
+        PatternSuite(cl_context context, cl_command_queue queue);
+
+        void addPattern(const std::string &name, const PatternConfig &config);
+        void addConfiguration(const CacheConfiguration &configuration);
+        void run();
+
+        void printResults();
+        void writeCSV(const std::string &path);
+};
+
+#endif // ACCESSPATTERN_H
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include <utils.hpp>
+#include <softcache.hpp>
+#include <programcache.hpp>
+#include <benchmark.hpp>
+#include <workloads.hpp>
+#include <accesspattern.hpp>
+
+using namespace std;
+
+/*!
+    * \brief Replay the synthetic access patterns on every configuration. The patterns share one base,
+    * which the options tune, and each stresses another weakness of the replacement policies.
+    */
+void runPatterns(const InputParser &input, cl_context ctx, cl_command_queue queue, const std::vector<CacheConfiguration> &configurations, int cacheSize)
+{
+    const std::string &usesString = input.getCmdOption("-uses");
+    const std::string &workingSetString = input.getCmdOption("-ws");
+    const std::string &zipfString = input.getCmdOption("-zipf");
+    const std::string &writesString = input.getCmdOption("-writes");
+    const std::string &readsString = input.getCmdOption("-reads");
+    const std::string &minSizeString = input.getCmdOption("-minsize");
+    const std::string &maxSizeString = input.getCmdOption("-maxsize");
+    const std::string &csvString = input.getCmdOption("-csv");
+
+    PatternConfig base;
+    base.uses = usesString.empty() ? 5000 : atoi(usesString.c_str());
+    base.workingSet = workingSetString.empty() ? 4 * cacheSize : atoi(workingSetString.c_str());
+    base.zipf = zipfString.empty() ? 0.99 : atof(zipfString.c_str());
+    base.minSize = (minSizeString.empty() ? 64 : atoi(minSizeString.c_str())) * 1024;
+    base.maxSize = (maxSizeString.empty() ? 1024 : atoi(maxSizeString.c_str())) * 1024;
+    base.scanProbability = 0;
+    base.scanLength = 0;
+    base.loopLength = 0;
+    base.writeFraction = writesString.empty() ? 0 : atof(writesString.c_str());
+    base.readFraction = readsString.empty() ? 0 : atof(readsString.c_str());
+    base.seed = 42;
+
+    PatternSuite suite(ctx, queue);
+    PatternConfig pattern = base;
+    suite.addPattern("zipf", pattern);
+
+    pattern = base;
+    pattern.zipf = 0;
+    suite.addPattern("uniform", pattern);
+
+    // A fifth of the uses write, the delta uploads of the dirty lines still count as misses
+    pattern = base;
+    pattern.writeFraction = max(base.writeFraction, 0.2);
+    suite.addPattern("zipf-writes", pattern);
+
+    // A fifth of the uses read a device result back, write back defers them until eviction
+    pattern = base;
+    pattern.readFraction = max(base.readFraction, 0.2);
+    suite.addPattern("zipf-reads", pattern);
+
+    // Bursts of cold buffers that push the popular ones out of a recency based cache
+    pattern = base;
+    pattern.scanProbability = 0.005;
+    pattern.scanLength = 2 * cacheSize;
+    suite.addPattern("scan", pattern);
+
+    // A loop half again as long as the cache, LRU and FIFO evict every buffer just before its reuse
+    pattern = base;
+    pattern.loopLength = cacheSize + cacheSize / 2;
+    suite.addPattern("loop", pattern);
+
+    for (auto& configuration : configurations) suite.addConfiguration(configuration);
+    suite.run();
+    suite.printResults();
+    if (!csvString.empty()) suite.writeCSV(csvString);
+}
+
+/*
+ * Usage: ./softcache_bench [-n size] [-warmup runs] [-trials runs] [-c lines] [-l lines per set] [-w 01]
+ *                          [-o d,s,f] [-r lru,fifo,random,smallest] [-workloads jacobi,image,mlp,gemm]
+ *                          [-csv file] [-json file]
+ *        ./softcache_bench -patterns [-uses n] [-ws buffers] [-zipf exponent] [-writes fraction]
+ *                          [-reads fraction] [-minsize KiB] [-maxsize KiB] [-c lines] [-l lines per set] [-o ...] [-r ...] [-csv file]
+ */
+int main(int argc, char** argv)
+{
+    InputParser input(argc, argv);
+    const std::string &sizeString = input.getCmdOption("-n");
+    const std::string &warmupString = input.getCmdOption("-warmup");
+    const std::string &trialsString = input.getCmdOption("-trials");
+    const std::string &cacheSizeString = input.getCmdOption("-c");
+    const std::string &linesPerSetString = input.getCmdOption("-l");
+    const std::string &writeBackString = input.getCmdOption("-w");
+    const std::string &orgString = input.getCmdOption("-o");
+    const std::string &rpString = input.getCmdOption("-r");
+    const std::string &workloadString = input.getCmdOption("-workloads");
+    const std::string &csvString = input.getCmdOption("-csv");
+    const std::string &jsonString = input.getCmdOption("-json");
+
+    const unsigned int size = sizeString.empty() ? 1024 : atoi(sizeString.c_str());
+    const unsigned int warmup = warmupString.empty() ? BENCHMARK_WARMUP : atoi(warmupString.c_str());
+    const unsigned int trials = trialsString.empty() ? BENCHMARK_TRIALS : atoi(trialsString.c_str());
+    const int cacheSize = cacheSizeString.empty() ? 16 : atoi(cacheSizeString.c_str());
+    const int linesPerSet = linesPerSetString.empty() ? 4 : atoi(linesPerSetString.c_str());
+    const bool writeBack = (writeBackString == "01");
+    const bool patterns = input.cmdOptionExists("-patterns");
+
+    /* Setup OpenCL environment. */
+    cl_int err;
+    cl_platform_id platform;
+    cl_device_id device;
+    err = clGetPlatformIDs(1, &platform, NULL);
+    // The patterns only need a device to hold the buffers, a CPU device will do
+    if (patterns && clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &device, NULL) != CL_SUCCESS)
+    {
+        err |= clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 1, &device, NULL);
+    }
+    else if (!patterns)
+    {
+        err |= clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
+    }
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: No OpenCL device found! %s\n", getErrorString(err).c_str());
+        exit(1);
+    }
+
+    cl_context_properties props[3] = { CL_CONTEXT_PLATFORM, (cl_context_properties) platform, 0 };
+    cl_context ctx = clCreateContext(props, 1, &device, NULL, NULL, &err);
+    // The cache profiles the commands of the queue
+    cl_command_queue queue = clCreateCommandQueue(ctx, device, CL_QUEUE_PROFILING_ENABLE, &err);
+
+    // Direct mapping has no replacement policy, it runs once
+    std::vector<CacheConfiguration> configurations;
+    const char *policyNames[4] = {"lru", "fifo", "random", "smallest"};
+    const ReplacementPolicy policies[4] = {LRU, FIFO, RANDOM, SMALLEST};
+    if (isSelected(orgString, "d"))
+    {
+        configurations.push_back({DIRECT_MAPPING, LRU, cacheSize, 1, writeBack});
+    }
+    for (int p = 0; p < 4; ++p)
+    {
+        if (!isSelected(rpString, policyNames[p])) continue;
+        if (isSelected(orgString, "s")) configurations.push_back({SET_ASSOCIATIVE, policies[p], cacheSize, linesPerSet, writeBack});
+        if (isSelected(orgString, "f")) configurations.push_back({FULLY_ASSOCIATIVE, policies[p], cacheSize, 1, writeBack});
+    }
+
+    if (patterns)
+    {
+        runPatterns(input, ctx, queue, configurations, cacheSize);
+        clReleaseCommandQueue(queue);
+        clReleaseContext(ctx);
+        return 0;
+    }
+
+    ProgramCache *programCache = new ProgramCache(ctx);
+    cl_program program = programCache->getProgram(ProgramCache::loadSource("./kernel.cl"), "-cl-kernel-arg-info", device);
+
+    // The workloads release their kernels when the suite is destroyed, before the program and the context
+    {
+        BenchmarkSuite suite(queue, size, warmup, trials);
+        if (isSelected(workloadString, "jacobi")) suite.addWorkload(new JacobiWorkload(ctx, queue, program, size));
+        if (isSelected(workloadString, "image")) suite.addWorkload(new ImagePipelineWorkload(ctx, queue, program, size));
+        if (isSelected(workloadString, "mlp")) suite.addWorkload(new MLPWorkload(ctx, queue, program, size));
+        if (isSelected(workloadString, "gemm")) suite.addWorkload(new SharedGemmWorkload(ctx, queue, program, size));
+        for (auto& configuration : configurations) suite.addConfiguration(configuration);
+
+        suite.run();
+        suite.printResults();
+        if (!csvString.empty()) suite.writeCSV(csvString);
+        if (!jsonString.empty()) suite.writeJSON(jsonString);
+    }
+
+    delete programCache;
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include <benchmark.hpp>
+
+#include <chrono>
+#include <fstream>
+
+using namespace std;
+
+/*!
+    * \brief Constructor
+    * \param queue The command queue of the workloads, drained after every trial
+    * \param size The edge of the grids, images and matrices of the workloads, only reported
+    * \param warmup Untimed runs before the trials
+    * \param trials Timed runs per workload and configuration
+    */
+BenchmarkSuite::BenchmarkSuite(cl_command_queue queue, unsigned int size, unsigned int warmup, unsigned int trials)
+{
+    this->queue = queue;
+    this->size = size;
+    this->warmup = warmup;
+    this->trials = max(1u, trials);
+}
+
+BenchmarkSuite::~BenchmarkSuite()
+{
+    for (auto& workload : this->workloads) delete workload;
+}
+
+/*!
+    * \brief Add a workload, the suite deletes it
+    */
+void BenchmarkSuite::addWorkload(Workload *workload)
+{
+    this->workloads.push_back(workload);
+}
+
+void BenchmarkSuite::addConfiguration(const CacheConfiguration &configuration)
+{
+    this->configurations.push_back(configuration);
+}
+
+void BenchmarkSuite::run()
+{
+    for (auto& configuration : this->configurations)
+    {
+        for (auto& workload : this->workloads)
+        {
+            printf("%-30s %s on %s %s\n", "Benchmark:", workload->getName(),
+                   getOrganisationName(configuration.organisation), getReplacementPolicyName(configuration.replacementPolicy));
+
+            Cache *cache = new Cache(configuration.organisation, configuration.replacementPolicy,
+                                     configuration.cacheSize, configuration.linesPerSet, configuration.writeBack);
+            workload->reset();
+            for (unsigned int run = 0; run < this->warmup; ++run) runTrial(workload, cache);
+
+            std::vector<TrialResult> trials;
+            for (unsigned int run = 0; run < this->trials; ++run) trials.push_back(runTrial(workload, cache));
+            this->results.push_back(summarise(workload, configuration, trials));
+            delete cache;
+        }
+    }
+}
+
+/*!
+    * \brief Print a line per workload and configuration, the times are medians in milliseconds
+    */
+void BenchmarkSuite::printResults()
+{
+    printf("===================================================================================================\n");
+    printf("%-8s %-18s %-9s %10s %10s %10s %10s %10s %8s\n",
+           "Workload", "Organisation", "Policy", "Transfer", "Kernel", "Wall", "GFLOP/s", "GB/s", "Hits");
+    printf("---------------------------------------------------------------------------------------------------\n");
+    for (auto& result : this->results)
+    {
+        printf("%-8s %-18s %-9s %10.2f %10.2f %10.2f %10.2f %10.2f %7.2f%%\n",
+               result.workload.c_str(),
+               getOrganisationName(result.configuration.organisation),
+               getReplacementPolicyName(result.configuration.replacementPolicy),
+               result.transfer.median / 1000, result.kernel.median / 1000, result.wall.median / 1000,
+               result.gflops, result.effectiveGBps, result.hitRatio * 100);
+    }
+    printf("===================================================================================================\n");
+}
+
+void BenchmarkSuite::writeCSV(const std::string &path)
+{
+    ofstream file(path);
+    if (!file.is_open())
+    {
+        printf("Error: Unable to open '%s'\n", path.c_str());
+        return;
+    }
+
+    file << "workload,organisation,policy,lines,lines_per_set,write_back,size,trials,"
+         << "transfer_mean_us,transfer_median_us,transfer_p99_us,"
+         << "kernel_mean_us,kernel_median_us,kernel_p99_us,"
+         << "wall_mean_us,wall_median_us,wall_p99_us,"
+         << "gflops,effective_gbps,hit_ratio,byte_hit_ratio" << endl;
+    for (auto& result : this->results)
+    {
+        const CacheConfiguration &configuration = result.configuration;
+        file << result.workload << ","
+             << getOrganisationName(configuration.organisation) << ","
+             << getReplacementPolicyName(configuration.replacementPolicy) << ","
+             << configuration.cacheSize << "," << configuration.linesPerSet << "," << configuration.writeBack << ","
+             << result.size << "," << result.trials << ","
+             << result.transfer.mean << "," << result.transfer.median << "," << result.transfer.p99 << ","
+             << result.kernel.mean << "," << result.kernel.median << "," << result.kernel.p99 << ","
+             << result.wall.mean << "," << result.wall.median << "," << result.wall.p99 << ","
+             << result.gflops << "," << result.effectiveGBps << "," << result.hitRatio << "," << result.byteHitRatio << endl;
+    }
+}
+
+void BenchmarkSuite::writeJSON(const std::string &path)
+{
+    ofstream file(path);
+    if (!file.is_open())
+    {
+        printf("Error: Unable to open '%s'\n", path.c_str());
+        return;
+    }
+
+    auto writeStatistic = [&file](const char *name, const Statistic &statistic)
+    {
+        file << "\"" << name << "\": {\"mean\": " << statistic.mean << ", \"median\": " << statistic.median
+             << ", \"p99\": " << statistic.p99 << "}, ";
+    };
+
+    file << "[" << endl;
+    for (size_t i = 0; i < this->results.size(); ++i)
+    {
+        const BenchmarkResult &result = this->results[i];
+        const CacheConfiguration &configuration = result.configuration;
+        file << "  {\"workload\": \"" << result.workload << "\", "
+             << "\"organisation\": \"" << getOrganisationName(configuration.organisation) << "\", "
+             << "\"policy\": \"" << getReplacementPolicyName(configuration.replacementPolicy) << "\", "
+             << "\"lines\": " << configuration.cacheSize << ", "
+             << "\"lines_per_set\": " << configuration.linesPerSet << ", "
+             << "\"write_back\": " << (configuration.writeBack ? "true" : "false") << ", "
+             << "\"size\": " << result.size << ", "
+             << "\"trials\": " << result.trials << ", ";
+        writeStatistic("transfer_us", result.transfer);
+        writeStatistic("kernel_us", result.kernel);
+        writeStatistic("wall_us", result.wall);
+        file << "\"gflops\": " << result.gflops << ", "
+             << "\"effective_gbps\": " << result.effectiveGBps << ", "
+             << "\"hit_ratio\": " << result.hitRatio << ", "
+             << "\"byte_hit_ratio\": " << result.byteHitRatio << "}"
+             << (i + 1 < this->results.size() ? "," : "") << endl;
+    }
+    file << "]" << endl;
+}
+
+/* ===================== PRIVATE METHODS ===================== */
+
+/*!
+    * \brief Run a workload once and measure it. With write back the results are written back
+    * within the trial, so every trial ends with the outputs on the host.
+    */
+TrialResult BenchmarkSuite::runTrial(Workload *workload, Cache *cache)
+{
+    cache->resetTimers();
+    const auto start = std::chrono::steady_clock::now();
+    workload->run(cache);
+    if (cache->getWriteBack()) cache->writeBack();
+    clFinish(this->queue);
+    const auto end = std::chrono::steady_clock::now();
+
+    const durations_t durations = cache->getDurations();
+    TrialResult trial;
+    trial.transfer = (double) (durations.hostToDevice + durations.deviceToHost);
+    trial.kernel = (double) durations.kernel;
+    trial.wall = std::chrono::duration<double, std::micro>(end - start).count();
+    trial.hits = durations.cacheHit;
+    trial.misses = durations.cacheMiss;
+    trial.bytesSaved = durations.bytesSaved;
+    trial.bytesTotal = durations.bytesTotal;
+    return trial;
+}
+
+BenchmarkResult BenchmarkSuite::summarise(Workload *workload, const CacheConfiguration &configuration, const std::vector<TrialResult> &trials)
+{
+    std::vector<double> transfer, kernel, wall;
+    unsigned long long hits = 0, misses = 0;
+    size_t bytesSaved = 0, bytesTotal = 0;
+    for (auto& trial : trials)
+    {
+        transfer.push_back(trial.transfer);
+        kernel.push_back(trial.kernel);
+        wall.push_back(trial.wall);
+        hits += trial.hits;
+        misses += trial.misses;
+        bytesSaved += trial.bytesSaved;
+        bytesTotal += trial.bytesTotal;
+    }
+
+    BenchmarkResult result;
+    result.workload = workload->getName();
+    result.configuration = configuration;
+    result.size = this->size;
+    result.trials = trials.size();
+    result.transfer = getStatistic(transfer);
+    result.kernel = getStatistic(kernel);
+    result.wall = getStatistic(wall);
+
+    // Microseconds, so flops / us / 1e3 is GFLOP/s and bytes / us / 1e3 is GB/s
+    result.gflops = result.kernel.median > 0 ? workload->getFlops() / result.kernel.median / 1e3 : 0;
+    result.effectiveGBps = result.wall.median > 0 ? (double) bytesTotal / trials.size() / result.wall.median / 1e3 : 0;
+    result.hitRatio = (hits + misses) > 0 ? (double) hits / (hits + misses) : 0;
+    result.byteHitRatio = bytesTotal > 0 ? (double) bytesSaved / bytesTotal : 0;
+    return result;
+}
+
+/*!
+    * \brief Mean, median and 99th percentile (nearest rank) of a set of values
+    */
+Statistic BenchmarkSuite::getStatistic(std::vector<double> values)
+{
+    Statistic statistic = {0, 0, 0};
+    if (values.empty()) return statistic;
+
+    std::sort(values.begin(), values.end());
+    for (auto& value : values) statistic.mean += value;
+    statistic.mean /= values.size();
+
+    const size_t n = values.size();
+    statistic.median = (n % 2 == 1) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+    statistic.p99 = values[(size_t) ceil(0.99 * n) - 1];
+    return statistic;
+}
@@ -0,0 +1,87 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <CL/cl.h>
+
+#include <softcache.hpp>
+#include <workloads.hpp>
+
+#include <string>
+#include <vector>
+
+// Settings
+#define BENCHMARK_WARMUP    2       // Untimed runs before the trials, they fill the cache
+#define BENCHMARK_TRIALS    10      // Timed runs per workload and configuration
+
+struct CacheConfiguration {
+    Organisation organisation;
+    ReplacementPolicy replacementPolicy;
+    int cacheSize;          // Lines
+    int linesPerSet;        // Only used for set associative caches
+    bool writeBack;
+};
+
+struct TrialResult {
+    double transfer;        // Host to device and device to host, in microseconds
+    double kernel;          // In microseconds
+    double wall;            // The whole trial on the host clock, in microseconds
+    unsigned int hits;
+    unsigned int misses;
+    size_t bytesSaved;
+    size_t bytesTotal;
+};
+
+struct Statistic {
+    double mean;
+    double median;
+    double p99;
+};
+
+struct BenchmarkResult {
+    std::string workload;
+    CacheConfiguration configuration;
+    unsigned int size;
+    unsigned int trials;
+    Statistic transfer;
+    Statistic kernel;
+    Statistic wall;
+    double gflops;          // Over the median kernel time
+    double effectiveGBps;   // Bytes the workload asked to move over the median wall time
+    double hitRatio;
+    double byteHitRatio;
+};
+
+/*!
+    * \brief Runs every workload on every cache configuration. For each pair a fresh cache is created,
+    * the inputs of the workload are reset, BENCHMARK_WARMUP runs fill the cache and then every trial
+    * is timed on its own, so the statistics describe a warm cache.
+    */
+class BenchmarkSuite
+{
+    private:
+        cl_command_queue queue;
+        unsigned int size;
+        unsigned int warmup;
+        unsigned int trials;
+        std::vector<Workload*> workloads;
+        std::vector<CacheConfiguration> configurations;
+        std::vector<BenchmarkResult> results;
+
+        TrialResult runTrial(Workload *workload, Cache *cache);
+        BenchmarkResult summarise(Workload *workload, const CacheConfiguration &configuration, const std::vector<TrialResult> &trials);
+        static Statistic getStatistic(std::vector<double> values);
+
+    public:
+        BenchmarkSuite(cl_command_queue queue, unsigned int size, unsigned int warmup = BENCHMARK_WARMUP, unsigned int trials = BENCHMARK_TRIALS);
+        ~BenchmarkSuite();
+
+        void addWorkload(Workload *workload);
+        void addConfiguration(const CacheConfiguration &configuration);
+        void run();
+
+        void printResults();
+        void writeCSV(const std::string &path);
+        void writeJSON(const std::string &path);
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,371 @@
+#include <workloads.hpp>
+
+#include <random>
+
+using namespace std;
+
+/*!
+    * \brief Constructor
+    * \param context The OpenCL context
+    * \param queue The command queue, created with profiling enabled
+    * \param program A built program of kernel.cl
+    * \param size The edge of the grids, images and matrices
+    */
+Workload::Workload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size)
+{
+    this->context = context;
+    this->queue = queue;
+    this->program = program;
+    this->size = size;
+    this->cache = nullptr;
+}
+
+cl_kernel Workload::createKernel(const char *name)
+{
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(this->program, name, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create kernel %s! %s\n", name, getErrorString(err).c_str());
+        exit(1);
+    }
+    return kernel;
+}
+
+/*!
+    * \brief Create a buffer and write a host array to it through the cache
+    * \return The buffer, released with releaseMemObject of the cache
+    */
+cl_mem Workload::upload(const void *ptr, size_t bytes)
+{
+    cl_int err;
+    cl_mem buffer = this->cache->createBuffer(this->context, CL_MEM_READ_ONLY, bytes, NULL, &err);
+    err |= this->cache->enqueueWriteBuffer(this->queue, buffer, CL_FALSE, 0, bytes, ptr, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to upload %zu bytes! %s\n", bytes, getErrorString(err).c_str());
+        exit(1);
+    }
+    return buffer;
+}
+
+cl_mem Workload::allocate(size_t bytes)
+{
+    cl_int err;
+    cl_mem buffer = this->cache->createBuffer(this->context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to allocate %zu bytes! %s\n", bytes, getErrorString(err).c_str());
+        exit(1);
+    }
+    return buffer;
+}
+
+void Workload::download(cl_mem buffer, void *ptr, size_t bytes)
+{
+    cl_int err = this->cache->enqueueReadBuffer(this->queue, buffer, CL_TRUE, 0, bytes, ptr, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to download %zu bytes! %s\n", bytes, getErrorString(err).c_str());
+        exit(1);
+    }
+}
+
+/*!
+    * \brief Launch a kernel whose arguments are set, the work-group size is left to the driver
+    */
+void Workload::launch(cl_kernel kernel, cl_uint work_dim, size_t width, size_t height)
+{
+    const size_t global_work_size[2] = {width, height};
+    cl_int err = this->cache->enqueueNDRangeKernel(this->queue, kernel, work_dim, NULL, global_work_size, NULL, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to execute a kernel of %s! %s\n", getName(), getErrorString(err).c_str());
+        exit(1);
+    }
+}
+
+/*!
+    * \brief Fill an array with values in [0, 1), the same values for the same seed
+    */
+void Workload::fillRandom(std::vector<float> &data, unsigned int seed)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    for (auto& value : data) value = distribution(generator);
+}
+
+/* ===================== JACOBI ===================== */
+
+JacobiWorkload::JacobiWorkload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size)
+    : Workload(context, queue, program, size)
+{
+    this->kernel = createKernel("jacobi");
+    this->grids[0].resize((size_t) size * size);
+    this->grids[1].resize((size_t) size * size);
+}
+
+JacobiWorkload::~JacobiWorkload()
+{
+    clReleaseKernel(this->kernel);
+}
+
+void JacobiWorkload::reset()
+{
+    fillRandom(this->grids[0], 1);
+    this->grids[1] = this->grids[0];
+}
+
+void JacobiWorkload::run(Cache *cache)
+{
+    this->cache = cache;
+    const size_t bytes = this->grids[0].size() * sizeof(float);
+    const int width = this->size, height = this->size;
+
+    for (int sweep = 0; sweep < JACOBI_SWEEPS; ++sweep)
+    {
+        std::vector<float> &src = this->grids[sweep % 2];
+        std::vector<float> &dst = this->grids[(sweep + 1) % 2];
+
+        cl_mem src_buffer = upload(src.data(), bytes);
+        cl_mem dst_buffer = allocate(bytes);
+        cl_int err  = cache->setKernelArg(this->kernel, 0, sizeof(cl_mem), &src_buffer);
+        err |= cache->setKernelArg(this->kernel, 1, sizeof(cl_mem), &dst_buffer);
+        err |= cache->setKernelArg(this->kernel, 2, sizeof(int), &width);
+        err |= cache->setKernelArg(this->kernel, 3, sizeof(int), &height);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to set the arguments of sweep %d! %s\n", sweep, getErrorString(err).c_str());
+            exit(1);
+        }
+        launch(this->kernel, 2, width, height);
+        download(dst_buffer, dst.data(), bytes);
+        cache->releaseMemObject(src_buffer);
+        cache->releaseMemObject(dst_buffer);
+    }
+}
+
+double JacobiWorkload::getFlops()
+{
+    // Three additions and a multiplication per point
+    return 4.0 * this->size * this->size * JACOBI_SWEEPS;
+}
+
+/* ===================== IMAGE PIPELINE ===================== */
+
+ImagePipelineWorkload::ImagePipelineWorkload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size)
+    : Workload(context, queue, program, size)
+{
+    this->blurKernel = createKernel("blur");
+    this->sobelKernel = createKernel("sobel");
+    this->thresholdKernel = createKernel("threshold");
+
+    const size_t pixels = (size_t) size * size;
+    for (int f = 0; f < IMAGE_FRAMES; ++f)
+    {
+        this->frames[f].resize(pixels);
+        this->masks[f].resize(pixels);
+    }
+    this->blurred.resize(pixels);
+    this->edges.resize(pixels);
+}
+
+ImagePipelineWorkload::~ImagePipelineWorkload()
+{
+    clReleaseKernel(this->blurKernel);
+    clReleaseKernel(this->sobelKernel);
+    clReleaseKernel(this->thresholdKernel);
+}
+
+void ImagePipelineWorkload::reset()
+{
+    for (int f = 0; f < IMAGE_FRAMES; ++f) fillRandom(this->frames[f], 100 + f);
+}
+
+void ImagePipelineWorkload::run(Cache *cache)
+{
+    this->cache = cache;
+    const size_t bytes = (size_t) this->size * this->size * sizeof(float);
+    const int width = this->size, height = this->size;
+    const float level = 0.5f;
+
+    for (int f = 0; f < IMAGE_FRAMES; ++f)
+    {
+        // Blur
+        cl_mem src_buffer = upload(this->frames[f].data(), bytes);
+        cl_mem dst_buffer = allocate(bytes);
+        cl_int err  = cache->setKernelArg(this->blurKernel, 0, sizeof(cl_mem), &src_buffer);
+        err |= cache->setKernelArg(this->blurKernel, 1, sizeof(cl_mem), &dst_buffer);
+        err |= cache->setKernelArg(this->blurKernel, 2, sizeof(int), &width);
+        err |= cache->setKernelArg(this->blurKernel, 3, sizeof(int), &height);
+        launch(this->blurKernel, 2, width, height);
+        download(dst_buffer, this->blurred.data(), bytes);
+        cache->releaseMemObject(src_buffer);
+        cache->releaseMemObject(dst_buffer);
+
+        // Sobel
+        src_buffer = upload(this->blurred.data(), bytes);
+        dst_buffer = allocate(bytes);
+        err |= cache->setKernelArg(this->sobelKernel, 0, sizeof(cl_mem), &src_buffer);
+        err |= cache->setKernelArg(this->sobelKernel, 1, sizeof(cl_mem), &dst_buffer);
+        err |= cache->setKernelArg(this->sobelKernel, 2, sizeof(int), &width);
+        err |= cache->setKernelArg(this->sobelKernel, 3, sizeof(int), &height);
+        launch(this->sobelKernel, 2, width, height);
+        download(dst_buffer, this->edges.data(), bytes);
+        cache->releaseMemObject(src_buffer);
+        cache->releaseMemObject(dst_buffer);
+
+        // Threshold
+        src_buffer = upload(this->edges.data(), bytes);
+        dst_buffer = allocate(bytes);
+        err |= cache->setKernelArg(this->thresholdKernel, 0, sizeof(cl_mem), &src_buffer);
+        err |= cache->setKernelArg(this->thresholdKernel, 1, sizeof(cl_mem), &dst_buffer);
+        err |= cache->setKernelArg(this->thresholdKernel, 2, sizeof(float), &level);
+        launch(this->thresholdKernel, 1, (size_t) width * height);
+        download(dst_buffer, this->masks[f].data(), bytes);
+        cache->releaseMemObject(src_buffer);
+        cache->releaseMemObject(dst_buffer);
+
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to set the arguments of the image pipeline! %s\n", getErrorString(err).c_str());
+            exit(1);
+        }
+    }
+}
+
+double ImagePipelineWorkload::getFlops()
+{
+    // Blur 9 additions and a division, Sobel 19 operations and a square root, threshold a comparison
+    return 31.0 * this->size * this->size * IMAGE_FRAMES;
+}
+
+/* ===================== MLP ===================== */
+
+MLPWorkload::MLPWorkload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size)
+    : Workload(context, queue, program, size)
+{
+    this->kernel = createKernel("denseRelu");
+    for (int l = 0; l < MLP_LAYERS; ++l)
+    {
+        this->weights[l].resize((size_t) size * size);
+        this->biases[l].resize(size);
+    }
+    for (int l = 0; l <= MLP_LAYERS; ++l) this->activations[l].resize((size_t) MLP_BATCH * size);
+}
+
+MLPWorkload::~MLPWorkload()
+{
+    clReleaseKernel(this->kernel);
+}
+
+void MLPWorkload::reset()
+{
+    for (int l = 0; l < MLP_LAYERS; ++l)
+    {
+        fillRandom(this->weights[l], 200 + l);
+        fillRandom(this->biases[l], 300 + l);
+        // Centre the weights, so the activations neither vanish nor grow from layer to layer
+        const float scale = 2.0f / sqrtf((float) this->size);
+        for (auto& w : this->weights[l]) w = (w - 0.5f) * scale;
+    }
+    fillRandom(this->activations[0], 400);
+}
+
+void MLPWorkload::run(Cache *cache)
+{
+    this->cache = cache;
+    const size_t weightBytes = (size_t) this->size * this->size * sizeof(float);
+    const size_t biasBytes = (size_t) this->size * sizeof(float);
+    const size_t activationBytes = (size_t) MLP_BATCH * this->size * sizeof(float);
+    const int width = this->size;
+
+    for (int l = 0; l < MLP_LAYERS; ++l)
+    {
+        cl_mem X_buffer = upload(this->activations[l].data(), activationBytes);
+        cl_mem W_buffer = upload(this->weights[l].data(), weightBytes);
+        cl_mem b_buffer = upload(this->biases[l].data(), biasBytes);
+        cl_mem Y_buffer = allocate(activationBytes);
+        cl_int err  = cache->setKernelArg(this->kernel, 0, sizeof(cl_mem), &X_buffer);
+        err |= cache->setKernelArg(this->kernel, 1, sizeof(cl_mem), &W_buffer);
+        err |= cache->setKernelArg(this->kernel, 2, sizeof(cl_mem), &b_buffer);
+        err |= cache->setKernelArg(this->kernel, 3, sizeof(cl_mem), &Y_buffer);
+        err |= cache->setKernelArg(this->kernel, 4, sizeof(int), &width);
+        err |= cache->setKernelArg(this->kernel, 5, sizeof(int), &width);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to set the arguments of layer %d! %s\n", l, getErrorString(err).c_str());
+            exit(1);
+        }
+        launch(this->kernel, 2, width, MLP_BATCH);
+        download(Y_buffer, this->activations[l + 1].data(), activationBytes);
+        cache->releaseMemObject(X_buffer);
+        cache->releaseMemObject(W_buffer);
+        cache->releaseMemObject(b_buffer);
+        cache->releaseMemObject(Y_buffer);
+    }
+}
+
+double MLPWorkload::getFlops()
+{
+    return 2.0 * MLP_BATCH * this->size * this->size * MLP_LAYERS;
+}
+
+/* ===================== GEMM WITH A SHARED OPERAND ===================== */
+
+SharedGemmWorkload::SharedGemmWorkload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size)
+    : Workload(context, queue, program, size)
+{
+    this->kernel = createKernel("matrixMul");
+    this->A.resize((size_t) size * size);
+    for (int i = 0; i < GEMM_PRODUCTS; ++i)
+    {
+        this->B[i].resize((size_t) size * size);
+        this->C[i].resize((size_t) size * size);
+    }
+}
+
+SharedGemmWorkload::~SharedGemmWorkload()
+{
+    clReleaseKernel(this->kernel);
+}
+
+void SharedGemmWorkload::reset()
+{
+    fillRandom(this->A, 500);
+    for (int i = 0; i < GEMM_PRODUCTS; ++i) fillRandom(this->B[i], 600 + i);
+}
+
+void SharedGemmWorkload::run(Cache *cache)
+{
+    this->cache = cache;
+    const size_t bytes = (size_t) this->size * this->size * sizeof(float);
+    const int width = this->size;
+
+    for (int i = 0; i < GEMM_PRODUCTS; ++i)
+    {
+        cl_mem A_buffer = upload(this->A.data(), bytes);
+        cl_mem B_buffer = upload(this->B[i].data(), bytes);
+        cl_mem C_buffer = allocate(bytes);
+        cl_int err  = cache->setKernelArg(this->kernel, 0, sizeof(cl_mem), &A_buffer);
+        err |= cache->setKernelArg(this->kernel, 1, sizeof(cl_mem), &B_buffer);
+        err |= cache->setKernelArg(this->kernel, 2, sizeof(cl_mem), &C_buffer);
+        err |= cache->setKernelArg(this->kernel, 3, sizeof(int), &width);
+        err |= cache->setKernelArg(this->kernel, 4, sizeof(int), &width);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to set the arguments of product %d! %s\n", i, getErrorString(err).c_str());
+            exit(1);
+        }
+        launch(this->kernel, 2, width, width);
+        download(C_buffer, this->C[i].data(), bytes);
+        cache->releaseMemObject(A_buffer);
+        cache->releaseMemObject(B_buffer);
+        cache->releaseMemObject(C_buffer);
+    }
+}
+
+double SharedGemmWorkload::getFlops()
+{
+    return 2.0 * this->size * this->size * this->size * GEMM_PRODUCTS;
+}
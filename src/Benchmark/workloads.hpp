@@ -0,0 +1,138 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include <CL/cl.h>
+
+#include <softcache.hpp>
+
+#include <string>
+#include <vector>
+
+// Settings
+#define JACOBI_SWEEPS   10      // Sweeps of the Jacobi workload per trial
+#define IMAGE_FRAMES    4       // Frames of the image pipeline per trial
+#define MLP_LAYERS      4       // Layers of the MLP workload
+#define MLP_BATCH       64      // Samples per forward pass
+#define GEMM_PRODUCTS   4       // Products of the shared operand workload, C_i = A * B_i
+
+/*!
+    * \brief A workload of the benchmark suite. The host data lives as long as the workload,
+    * so the host pointers, and with them the tags of the cache lines, are the same in every trial.
+    * Every kernel call goes through the cache the way an application would call OpenCL:
+    * create the buffers, write the inputs, launch, read the outputs and release the buffers.
+    */
+class Workload
+{
+    protected:
+        cl_context context;
+        cl_command_queue queue;
+        cl_program program;
+        unsigned int size;
+        Cache *cache;
+
+        cl_kernel createKernel(const char *name);
+        cl_mem upload(const void *ptr, size_t bytes);
+        cl_mem allocate(size_t bytes);
+        void download(cl_mem buffer, void *ptr, size_t bytes);
+        void launch(cl_kernel kernel, cl_uint work_dim, size_t width, size_t height = 1);
+        static void fillRandom(std::vector<float> &data, unsigned int seed);
+
+    public:
+        Workload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size);
+        virtual ~Workload() {}
+
+        virtual const char* getName() = 0;
+        virtual void reset() = 0;               // Restore the inputs, so every configuration starts from the same data
+        virtual void run(Cache *cache) = 0;     // One trial
+        virtual double getFlops() = 0;          // Floating point operations per trial
+};
+
+/*!
+    * \brief Jacobi sweeps on a size x size grid. The output of a sweep is the input of the next,
+    * so every upload after the first can be served from the line the previous read created.
+    */
+class JacobiWorkload : public Workload
+{
+    private:
+        cl_kernel kernel;
+        std::vector<float> grids[2];
+
+    public:
+        JacobiWorkload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size);
+        ~JacobiWorkload();
+
+        const char* getName() { return "jacobi"; }
+        void reset();
+        void run(Cache *cache);
+        double getFlops();
+};
+
+/*!
+    * \brief Blur, Sobel and threshold over IMAGE_FRAMES frames of size x size. The stages are separate
+    * calls, the intermediate images are read back to the host and uploaded again by the next stage.
+    */
+class ImagePipelineWorkload : public Workload
+{
+    private:
+        cl_kernel blurKernel;
+        cl_kernel sobelKernel;
+        cl_kernel thresholdKernel;
+        std::vector<float> frames[IMAGE_FRAMES];
+        std::vector<float> blurred;
+        std::vector<float> edges;
+        std::vector<float> masks[IMAGE_FRAMES];
+
+    public:
+        ImagePipelineWorkload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size);
+        ~ImagePipelineWorkload();
+
+        const char* getName() { return "image"; }
+        void reset();
+        void run(Cache *cache);
+        double getFlops();
+};
+
+/*!
+    * \brief Forward pass of an MLP of MLP_LAYERS dense layers of size x size. The weights are uploaded
+    * in every trial, the activations flow from one layer to the next through the host.
+    */
+class MLPWorkload : public Workload
+{
+    private:
+        cl_kernel kernel;
+        std::vector<float> weights[MLP_LAYERS];
+        std::vector<float> biases[MLP_LAYERS];
+        std::vector<float> activations[MLP_LAYERS + 1];
+
+    public:
+        MLPWorkload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size);
+        ~MLPWorkload();
+
+        const char* getName() { return "mlp"; }
+        void reset();
+        void run(Cache *cache);
+        double getFlops();
+};
+
+/*!
+    * \brief GEMM_PRODUCTS independent products C_i = A * B_i of size x size, A is uploaded for every product
+    */
+class SharedGemmWorkload : public Workload
+{
+    private:
+        cl_kernel kernel;
+        std::vector<float> A;
+        std::vector<float> B[GEMM_PRODUCTS];
+        std::vector<float> C[GEMM_PRODUCTS];
+
+    public:
+        SharedGemmWorkload(cl_context context, cl_command_queue queue, cl_program program, unsigned int size);
+        ~SharedGemmWorkload();
+
+        const char* getName() { return "gemm"; }
+        void reset();
+        void run(Cache *cache);
+        double getFlops();
+};
+
+#endif // WORKLOADS_H
@@ -0,0 +1,261 @@
+#include <autotune.hpp>
+
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+/*!
+    * \brief Constructor
+    * \param context The OpenCL context
+    * \param device The device to tune for
+    * \param source The source of kernel.cl
+    * \param tuningFile The file the best variants are saved in
+    */
+Autotuner::Autotuner(cl_context context, cl_device_id device, const std::string &source, const std::string &tuningFile)
+{
+    this->context = context;
+    this->device = device;
+    this->source = source;
+    this->tuningFile = tuningFile;
+
+    char name[256] = "";
+    char driver[256] = "";
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+    this->deviceKey = std::string(name) + "_" + driver;
+    std::replace_if(this->deviceKey.begin(), this->deviceKey.end(), ::isspace, '_');
+}
+
+/*!
+    * \brief Get the fastest variant for a problem size, from the tuning file or by sweeping the variants
+    * \param M The number of rows of A and C
+    * \param N The number of columns of B and C
+    * \param K The number of columns of A and rows of B
+    * \return The best variant, with a tile size of 0 if no variant fits the problem or the device
+    */
+TuningConfig Autotuner::tune(unsigned int M, unsigned int N, unsigned int K)
+{
+    TuningConfig best = {0, 0, 0};
+    if (loadConfig(M, N, K, best))
+    {
+        printf("%-30s TS %u, WPT %u (%s)\n", "Tuned matrixMulTiled:", best.tileSize, best.workPerThread, this->tuningFile.c_str());
+        return best;
+    }
+
+    cl_ulong localMemory = 0;
+    clGetDeviceInfo(this->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMemory), &localMemory, NULL);
+
+    cl_int err;
+    cl_command_queue queue = clCreateCommandQueue(this->context, this->device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create the tuning queue! %s\n", getErrorString(err).c_str());
+        exit(1);
+    }
+
+    std::vector<float> A((size_t) M * K);
+    std::vector<float> B((size_t) K * N);
+    std::vector<float> C((size_t) M * N);
+    for (auto& a : A) a = rand() % 10 / 100.0;
+    for (auto& b : B) b = rand() % 10 / 100.0;
+
+    cl_mem A_buffer = clCreateBuffer(this->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, A.size() * sizeof(float), A.data(), &err);
+    cl_mem B_buffer = clCreateBuffer(this->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, B.size() * sizeof(float), B.data(), &err);
+    cl_mem C_buffer = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, C.size() * sizeof(float), NULL, &err);
+
+    // A few elements of the product on the host, to reject variants that compute garbage
+    const unsigned int nrOfSamples = 16;
+    std::vector<size_t> samples(nrOfSamples);
+    std::vector<float> expected(nrOfSamples);
+    for (unsigned int s = 0; s < nrOfSamples; ++s)
+    {
+        const unsigned int row = rand() % M;
+        const unsigned int col = rand() % N;
+        float value = 0;
+        for (unsigned int k = 0; k < K; ++k) value += A[(size_t) row * K + k] * B[(size_t) k * N + col];
+        samples[s] = (size_t) row * N + col;
+        expected[s] = value;
+    }
+
+    const unsigned int tileSizes[] = {16, 32, 64};
+    const unsigned int workPerThreads[] = {1, 2, 4, 8};
+    const int m = M, n = N, k = K;
+    for (unsigned int tileSize : tileSizes)
+    {
+        if (2 * tileSize * tileSize * sizeof(float) > localMemory) continue;
+
+        for (unsigned int workPerThread : workPerThreads)
+        {
+            TuningConfig config = {tileSize, workPerThread, 0};
+            if (tileSize % workPerThread != 0 || !fits(config, M, N, K)) continue;
+
+            cl_program program = buildVariant(config);
+            if (program == NULL) continue;
+            cl_kernel kernel = clCreateKernel(program, "matrixMulTiled", &err);
+
+            size_t global_work_size[2], local_work_size[2];
+            getWorkSizes(config, M, N, global_work_size, local_work_size);
+            size_t workGroupSize = 0;
+            clGetKernelWorkGroupInfo(kernel, this->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(workGroupSize), &workGroupSize, NULL);
+
+            if (local_work_size[0] * local_work_size[1] <= workGroupSize)
+            {
+                err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &A_buffer);
+                err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &B_buffer);
+                err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &C_buffer);
+                err |= clSetKernelArg(kernel, 3, sizeof(int), &m);
+                err |= clSetKernelArg(kernel, 4, sizeof(int), &n);
+                err |= clSetKernelArg(kernel, 5, sizeof(int), &k);
+
+                // The first run is a warm up
+                for (int run = 0; run <= TUNING_RUNS && err == CL_SUCCESS; ++run)
+                {
+                    cl_event event;
+                    err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, &event);
+                    if (err != CL_SUCCESS) break;
+
+                    const long long time = probe_event_time(event, queue);
+                    clReleaseEvent(event);
+                    if (run > 0 && (config.time == 0 || time < config.time)) config.time = max(time, 1LL);
+                }
+
+                bool correct = err == CL_SUCCESS;
+                if (correct) err = clEnqueueReadBuffer(queue, C_buffer, CL_TRUE, 0, C.size() * sizeof(float), C.data(), 0, NULL, NULL);
+                for (unsigned int s = 0; s < nrOfSamples && correct; ++s)
+                {
+                    correct = fabs(C[samples[s]] - expected[s]) <= 1e-3 * max(1.0f, fabs(expected[s]));
+                }
+
+                if (!correct)
+                {
+                    printf("Warning: Variant TS %u, WPT %u failed, skipping it\n", tileSize, workPerThread);
+                }
+                else
+                {
+                    printf("%-30s TS %2u, WPT %u: %lld us\n", "Tuning matrixMulTiled:", tileSize, workPerThread, config.time);
+                    if (best.tileSize == 0 || config.time < best.time) best = config;
+                }
+            }
+            clReleaseKernel(kernel);
+            clReleaseProgram(program);
+        }
+    }
+
+    clReleaseMemObject(A_buffer);
+    clReleaseMemObject(B_buffer);
+    clReleaseMemObject(C_buffer);
+    clReleaseCommandQueue(queue);
+
+    if (best.tileSize == 0)
+    {
+        printf("Warning: No variant of matrixMulTiled fits %u x %u x %u on this device\n", M, N, K);
+        return best;
+    }
+
+    printf("%-30s TS %u, WPT %u\n", "Tuned matrixMulTiled:", best.tileSize, best.workPerThread);
+    saveConfig(M, N, K, best);
+    return best;
+}
+
+/*!
+    * \brief Build the program of a variant and create its kernel, the caller releases the kernel
+    * \param config The variant
+    * \return The kernel
+    */
+cl_kernel Autotuner::createKernel(const TuningConfig &config)
+{
+    cl_program program = buildVariant(config);
+    if (program == NULL) exit(1);
+
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(program, "matrixMulTiled", &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create the matrixMulTiled kernel! %s\n", getErrorString(err).c_str());
+        exit(1);
+    }
+    clReleaseProgram(program);     // The kernel keeps the program alive
+    return kernel;
+}
+
+/*!
+    * \brief Check whether a variant can compute a problem, the sizes have to be multiples of the tile size
+    */
+bool Autotuner::fits(const TuningConfig &config, unsigned int M, unsigned int N, unsigned int K)
+{
+    return config.tileSize > 0 && M % config.tileSize == 0 && N % config.tileSize == 0 && K % config.tileSize == 0;
+}
+
+/*!
+    * \brief The NDRange of a variant, a work-item computes a float4 in WPT rows
+    */
+void Autotuner::getWorkSizes(const TuningConfig &config, unsigned int M, unsigned int N, size_t global_work_size[2], size_t local_work_size[2])
+{
+    global_work_size[0] = N / 4;
+    global_work_size[1] = M / config.workPerThread;
+    local_work_size[0] = config.tileSize / 4;
+    local_work_size[1] = config.tileSize / config.workPerThread;
+}
+
+/* ===================== PRIVATE METHODS ===================== */
+
+/*!
+    * \brief Build kernel.cl with the TS and WPT of a variant
+    * \return The program, NULL if the build failed
+    */
+cl_program Autotuner::buildVariant(const TuningConfig &config)
+{
+    cl_int err;
+    const char *source = this->source.c_str();
+    cl_program program = clCreateProgramWithSource(this->context, 1, &source, NULL, &err);
+    if (err != CL_SUCCESS) return NULL;
+
+    std::ostringstream options;
+    options << "-cl-kernel-arg-info -D TS=" << config.tileSize << " -D WPT=" << config.workPerThread;
+    err = clBuildProgram(program, 1, &this->device, options.str().c_str(), NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to build matrixMulTiled with TS %u, WPT %u! %s\n", config.tileSize, config.workPerThread, getErrorString(err).c_str());
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+/*!
+    * \brief Look up the variant of a device and problem size in the tuning file
+    * \return True when found
+    */
+bool Autotuner::loadConfig(unsigned int M, unsigned int N, unsigned int K, TuningConfig &config)
+{
+    ifstream file(this->tuningFile);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream entry(line);
+        std::string key;
+        unsigned int m, n, k;
+        TuningConfig found;
+        if (!(entry >> key >> m >> n >> k >> found.tileSize >> found.workPerThread >> found.time)) continue;
+
+        if (key == this->deviceKey && m == M && n == N && k == K && fits(found, M, N, K))
+        {
+            config = found;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Autotuner::saveConfig(unsigned int M, unsigned int N, unsigned int K, const TuningConfig &config)
+{
+    ofstream file(this->tuningFile, fstream::app);
+    if (!file.is_open())
+    {
+        printf("Warning: Failed to save the tuning in %s\n", this->tuningFile.c_str());
+        return;
+    }
+    file << this->deviceKey << " " << M << " " << N << " " << K << " "
+         << config.tileSize << " " << config.workPerThread << " " << config.time << endl;
+}
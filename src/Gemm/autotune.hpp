@@ -0,0 +1,51 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <CL/cl.h>
+
+#include <utils.hpp>
+
+#include <string>
+#include <vector>
+
+// Settings
+#define TUNING_FILE     "tuning.txt"    // One line per device and problem size: <device> <M> <N> <K> <TS> <WPT> <us>
+#define TUNING_RUNS     3               // Timed runs per variant, the fastest counts
+
+struct TuningConfig {
+    unsigned int tileSize;          // TS, the tile of C a work-group computes is TS x TS
+    unsigned int workPerThread;     // WPT, the rows of the tile a work-item computes
+    long long time;                 // The kernel time in microseconds, 0 if not measured
+};
+
+/*!
+    * \brief Finds the fastest variant of the matrixMulTiled kernel for a device and problem size.
+    * The variants differ in TS and WPT, which are set with -D when the program is built.
+    * Variants are bounded by the work-group size the kernel supports and the local memory of the device,
+    * and only count when their result matches a host reference. The best variant is saved in a tuning file,
+    * later runs on the same device and driver load it instead of sweeping again.
+    */
+class Autotuner
+{
+    private:
+        cl_context context;
+        cl_device_id device;
+        std::string source;
+        std::string tuningFile;
+        std::string deviceKey;  // < device name and driver version, without spaces >
+
+        bool loadConfig(unsigned int M, unsigned int N, unsigned int K, TuningConfig &config);
+        void saveConfig(unsigned int M, unsigned int N, unsigned int K, const TuningConfig &config);
+        cl_program buildVariant(const TuningConfig &config);
+
+    public:
+        Autotuner(cl_context context, cl_device_id device, const std::string &source, const std::string &tuningFile = TUNING_FILE);
+
+        TuningConfig tune(unsigned int M, unsigned int N, unsigned int K);
+        cl_kernel createKernel(const TuningConfig &config);
+
+        static bool fits(const TuningConfig &config, unsigned int M, unsigned int N, unsigned int K);
+        static void getWorkSizes(const TuningConfig &config, unsigned int M, unsigned int N, size_t global_work_size[2], size_t local_work_size[2]);
+};
+
+#endif // AUTOTUNE_H
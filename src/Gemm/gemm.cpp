@@ -0,0 +1,246 @@
+#include <gemm.hpp>
+
+using namespace std;
+
+/*!
+    * \brief Constructor
+    * \param cache The cache that manages the tiles
+    * \param context The OpenCL context
+    * \param queue The command queue the tile products are enqueued on
+    * \param program A built program that contains the matrixMulTile kernel
+    * \param deviceBudget The bytes of device memory the tiles may use, 0 uses half of the global memory
+    */
+TiledGemm::TiledGemm(Cache *cache, cl_context context, cl_command_queue queue, cl_program program, size_t deviceBudget)
+{
+    this->cache = cache;
+    this->context = context;
+    this->queue = queue;
+
+    cl_int err;
+    this->kernel = clCreateKernel(program, "matrixMulTile", &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create the matrixMulTile kernel! %s\n", getErrorString(err).c_str());
+        exit(1);
+    }
+
+    cl_device_id device;
+    clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+    if (deviceBudget == 0)
+    {
+        cl_ulong globalMemory = 0;
+        clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMemory), &globalMemory, NULL);
+        deviceBudget = globalMemory / 2;
+    }
+    this->deviceBudget = deviceBudget;
+
+    size_t workGroupSize = 0;
+    clGetKernelWorkGroupInfo(this->kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(workGroupSize), &workGroupSize, NULL);
+    this->localSize = (workGroupSize >= GEMM_TILE_ALIGN * GEMM_TILE_ALIGN) ? GEMM_TILE_ALIGN : GEMM_TILE_ALIGN / 2;
+}
+
+TiledGemm::~TiledGemm()
+{
+    clReleaseKernel(this->kernel);
+}
+
+/*!
+    * \brief Multiply C = A * B, all matrices are row major
+    * \param A Matrix of M x K
+    * \param B Matrix of K x N
+    * \param C Result matrix of M x N
+    * \param M The number of rows of A and C
+    * \param N The number of columns of B and C
+    * \param K The number of columns of A and rows of B
+    * \param tileSize The size of a tile, 0 picks the largest tile that fits the cache and the device budget
+    */
+void TiledGemm::multiply(const float *A, const float *B, float *C, unsigned int M, unsigned int N, unsigned int K, unsigned int tileSize)
+{
+    if (tileSize == 0) tileSize = chooseTileSize(M, N, K);
+    tileSize += (GEMM_TILE_ALIGN - tileSize % GEMM_TILE_ALIGN) % GEMM_TILE_ALIGN;
+
+    const unsigned int Mt = (M + tileSize - 1) / tileSize;
+    const unsigned int Nt = (N + tileSize - 1) / tileSize;
+    const unsigned int Kt = (K + tileSize - 1) / tileSize;
+    const size_t tileElements = (size_t) tileSize * tileSize;
+    const size_t tileBytes = tileElements * sizeof(float);
+
+    printf("%-30s %u\n", "GEMM tile size:", tileSize);
+    printf("%-30s %u x %u x %u\n", "GEMM tiles (M x N x K):", Mt, Nt, Kt);
+
+    // Every tile is its own host buffer, so every tile gets its own cache line
+    std::vector<float> tilesA((size_t) Mt * Kt * tileElements);
+    std::vector<float> tilesB((size_t) Kt * Nt * tileElements);
+    std::vector<float> tilesC((size_t) Mt * Nt * tileElements);
+    packTiles(A, tilesA.data(), M, K, tileSize);
+    packTiles(B, tilesB.data(), K, N, tileSize);
+
+    // The cache knows the tiles only by their address, lines left by earlier data at these addresses are stale
+    this->cache->setDirtyRange(tilesA.data(), tilesA.size() * sizeof(float), CPU);
+    this->cache->setDirtyRange(tilesB.data(), tilesB.size() * sizeof(float), CPU);
+    this->cache->setDirtyRange(tilesC.data(), tilesC.size() * sizeof(float), CPU);
+
+    // Uploads of the next tiles can run while the current tile product is executing
+    const bool overlap = this->cache->getTransferOverlap();
+    this->cache->setTransferOverlap(true);
+    // The tiles only pass through the cache, so a hit can bind their proxies to the cached buffers
+    const bool virtualBuffers = this->cache->getVirtualBuffers();
+    this->cache->setVirtualBuffers(true);
+
+    const int tileWidth = tileSize;
+    const size_t global_work_size[2] = {tileSize, tileSize};
+    const size_t local_work_size[2] = {this->localSize, this->localSize};
+    cl_int err = CL_SUCCESS;
+
+    for (unsigned int i = 0; i < Mt; ++i)
+    {
+        for (unsigned int j = 0; j < Nt; ++j)
+        {
+            float *tileC = &tilesC[((size_t) i * Nt + j) * tileElements];
+            cl_mem C_buffer = this->cache->createBuffer(this->context, CL_MEM_READ_WRITE, tileBytes, NULL, &err);
+
+            for (unsigned int k = 0; k < Kt; ++k)
+            {
+                // The tiles of the row panel of A are reused for every j, the tiles of B are streamed
+                cl_mem A_buffer = uploadTile(&tilesA[((size_t) i * Kt + k) * tileElements], tileBytes);
+                cl_mem B_buffer = uploadTile(&tilesB[((size_t) k * Nt + j) * tileElements], tileBytes);
+                const int accumulate = (k > 0);
+
+                err  = this->cache->setKernelArg(this->kernel, 0, sizeof(cl_mem), &A_buffer);
+                err |= this->cache->setKernelArg(this->kernel, 1, sizeof(cl_mem), &B_buffer);
+                err |= this->cache->setKernelArg(this->kernel, 2, sizeof(cl_mem), &C_buffer);
+                err |= this->cache->setKernelArg(this->kernel, 3, sizeof(int), &tileWidth);
+                err |= this->cache->setKernelArg(this->kernel, 4, sizeof(int), &accumulate);
+                err |= this->cache->enqueueNDRangeKernel(this->queue, this->kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
+                if (err != CL_SUCCESS)
+                {
+                    printf("Error: Failed to execute tile (%u, %u, %u)! %s\n", i, j, k, getErrorString(err).c_str());
+                    exit(1);
+                }
+                this->cache->releaseMemObject(A_buffer);
+                this->cache->releaseMemObject(B_buffer);
+            }
+
+            // The tile of C becomes a line of its own, with write back it stays on the device until evicted
+            err = this->cache->enqueueReadBuffer(this->queue, C_buffer, CL_FALSE, 0, tileBytes, tileC, 0, NULL, NULL);
+            if (err != CL_SUCCESS)
+            {
+                printf("Error: Failed to read tile (%u, %u)! %s\n", i, j, getErrorString(err).c_str());
+                exit(1);
+            }
+            this->cache->releaseMemObject(C_buffer);
+        }
+    }
+
+    if (this->cache->getWriteBack()) this->cache->writeBack();
+    clFinish(this->queue);
+    unpackTiles(tilesC.data(), C, M, N, tileSize);
+
+    // The tiles are freed on return, so later data at their addresses must not hit their lines
+    this->cache->setDirtyRange(tilesA.data(), tilesA.size() * sizeof(float), CPU);
+    this->cache->setDirtyRange(tilesB.data(), tilesB.size() * sizeof(float), CPU);
+    this->cache->setDirtyRange(tilesC.data(), tilesC.size() * sizeof(float), CPU);
+    this->cache->setTransferOverlap(overlap);
+    this->cache->setVirtualBuffers(virtualBuffers);
+}
+
+/*!
+    * \brief Pick the largest tile size for which a row panel of A, a tile of B and a tile of C
+    * fit both in the lines of the cache and in the device budget. Falls back to the largest tile
+    * size of which three tiles fit the budget, the panel of A is then reloaded for every j.
+    * Assumes a fully associative cache.
+    * \return The tile size
+    */
+unsigned int TiledGemm::chooseTileSize(unsigned int M, unsigned int N, unsigned int K)
+{
+    const unsigned int largest = max(M, max(N, K));
+    const size_t lines = this->cache->getNrOfLines();
+    unsigned int fallback = GEMM_TILE_ALIGN;
+
+    for (unsigned int tileSize = largest + (GEMM_TILE_ALIGN - largest % GEMM_TILE_ALIGN) % GEMM_TILE_ALIGN;
+         tileSize >= GEMM_TILE_ALIGN;
+         tileSize -= GEMM_TILE_ALIGN)
+    {
+        const size_t tileBytes = (size_t) tileSize * tileSize * sizeof(float);
+        const size_t workingSet = (K + tileSize - 1) / tileSize + 2;
+        if (workingSet <= lines && workingSet * tileBytes <= this->deviceBudget) return tileSize;
+        if (fallback == GEMM_TILE_ALIGN && 3 * tileBytes <= this->deviceBudget) fallback = tileSize;
+    }
+
+    printf("Warning: A row panel of A does not fit in the cache, it will be reloaded for every tile of C\n");
+    return fallback;
+}
+
+/*!
+    * \brief Upload a tile through the cache without blocking
+    * \param tile The host tile
+    * \param tileBytes The size of the tile in bytes
+    * \return The proxy of the buffer that holds the tile
+    */
+cl_mem TiledGemm::uploadTile(const float *tile, size_t tileBytes)
+{
+    cl_int err;
+    cl_mem buffer = this->cache->createBuffer(this->context, CL_MEM_READ_ONLY, tileBytes, NULL, &err);
+    // Device memory is only allocated on a miss, on a hit the proxy is bound to the cached tile
+    err |= this->cache->enqueueWriteBuffer(this->queue, buffer, CL_FALSE, 0, tileBytes, tile, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to upload tile! %s\n", getErrorString(err).c_str());
+        exit(1);
+    }
+    return buffer;
+}
+
+/*!
+    * \brief Copy a row major matrix into consecutive square tiles, padded with zeros
+    * \param matrix The row major matrix
+    * \param tiles Returns the tiles, ordered by tile row and then tile column
+    * \param rows The number of rows of the matrix
+    * \param cols The number of columns of the matrix
+    * \param tileSize The size of a tile
+    */
+void TiledGemm::packTiles(const float *matrix, float *tiles, unsigned int rows, unsigned int cols, unsigned int tileSize)
+{
+    const unsigned int tileRows = (rows + tileSize - 1) / tileSize;
+    const unsigned int tileCols = (cols + tileSize - 1) / tileSize;
+
+    for (unsigned int ti = 0; ti < tileRows; ++ti)
+    {
+        for (unsigned int tj = 0; tj < tileCols; ++tj)
+        {
+            float *tile = tiles + ((size_t) ti * tileCols + tj) * tileSize * tileSize;
+            for (unsigned int r = 0; r < tileSize; ++r)
+            {
+                const unsigned int row = ti * tileSize + r;
+                const unsigned int col = tj * tileSize;
+                const unsigned int width = (row < rows && col < cols) ? min(tileSize, cols - col) : 0;
+
+                if (width > 0) memcpy(tile + (size_t) r * tileSize, matrix + (size_t) row * cols + col, width * sizeof(float));
+                memset(tile + (size_t) r * tileSize + width, 0, (tileSize - width) * sizeof(float));
+            }
+        }
+    }
+}
+
+/*!
+    * \brief Copy consecutive square tiles back into a row major matrix, dropping the padding
+    * \param tiles The tiles, ordered by tile row and then tile column
+    * \param matrix Returns the row major matrix
+    * \param rows The number of rows of the matrix
+    * \param cols The number of columns of the matrix
+    * \param tileSize The size of a tile
+    */
+void TiledGemm::unpackTiles(const float *tiles, float *matrix, unsigned int rows, unsigned int cols, unsigned int tileSize)
+{
+    const unsigned int tileCols = (cols + tileSize - 1) / tileSize;
+
+    for (unsigned int row = 0; row < rows; ++row)
+    {
+        for (unsigned int tj = 0; tj < tileCols; ++tj)
+        {
+            const unsigned int col = tj * tileSize;
+            const float *tile = tiles + ((size_t) (row / tileSize) * tileCols + tj) * tileSize * tileSize;
+            memcpy(matrix + (size_t) row * cols + col, tile + (size_t) (row % tileSize) * tileSize, min(tileSize, cols - col) * sizeof(float));
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <CL/cl.h>
+
+#include <softcache.hpp>
+
+#include <vector>
+
+// Settings
+#define GEMM_TILE_ALIGN     16      // Tile sizes are a multiple of the work-group size
+
+/*!
+    * \brief Out-of-core matrix multiplication C = A * B for matrices that do not fit on the device.
+    * The matrices are packed into square tiles, every tile is a separate host buffer so the cache
+    * can keep it as a line. For every row panel of A the driver walks all columns of B,
+    * so the tiles of the panel hit while the tiles of B are streamed through the remaining lines.
+    * Tiles are uploaded without blocking, with transfer overlap enabled the uploads for the next
+    * step of the k loop run while the current tile product is executing.
+    */
+class TiledGemm
+{
+    private:
+        Cache *cache;
+        cl_context context;
+        cl_command_queue queue;
+        cl_kernel kernel;
+        size_t deviceBudget;    // < bytes of device memory the tiles may use >
+        size_t localSize;
+
+        unsigned int chooseTileSize(unsigned int M, unsigned int N, unsigned int K);
+        cl_mem uploadTile(const float *tile, size_t tileBytes);
+        void packTiles(const float *matrix, float *tiles, unsigned int rows, unsigned int cols, unsigned int tileSize);
+        void unpackTiles(const float *tiles, float *matrix, unsigned int rows, unsigned int cols, unsigned int tileSize);
+
+    public:
+        TiledGemm(Cache *cache, cl_context context, cl_command_queue queue, cl_program program, size_t deviceBudget = 0);
+        ~TiledGemm();
+
+        void multiply(const float *A, const float *B, float *C, unsigned int M, unsigned int N, unsigned int K, unsigned int tileSize = 0);
+};
+
+#endif // GEMM_H
@@ -0,0 +1,452 @@
+#include <metadata.hpp>
+#include <softcache.hpp>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <map>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace std;
+
+/* ===================== PERF COUNTER ===================== */
+
+PerfCounter::PerfCounter()
+{
+    this->fd = -1;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    this->fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+PerfCounter::~PerfCounter()
+{
+#ifdef __linux__
+    if (this->fd >= 0) close(this->fd);
+#endif
+}
+
+bool PerfCounter::available()
+{
+    return this->fd >= 0;
+}
+
+void PerfCounter::start()
+{
+#ifdef __linux__
+    if (this->fd < 0) return;
+    ioctl(this->fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(this->fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+/*!
+    * \brief Stop counting
+    * \return The count since start, -1 when the counter is not available
+    */
+long long PerfCounter::stop()
+{
+    long long count = -1;
+#ifdef __linux__
+    if (this->fd < 0) return count;
+    ioctl(this->fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(this->fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+    return count;
+}
+
+/* ===================== METADATA BENCHMARK ===================== */
+
+// Tags are never dereferenced, a multiplicative hash of a counter spreads them over the sets
+static void* hashTag(unsigned long long counter)
+{
+    return (void *) (uintptr_t) ((counter * 0x9E3779B97F4A7C15ULL) | 1);
+}
+
+// The directory hashes a tag to tag % nrOfSets, move a tag into a set
+static void* moveToSet(void *tag, int set, int nrOfSets)
+{
+    const uintptr_t hashed = (uintptr_t) tag;
+    return (void *) (hashed - hashed % nrOfSets + set);
+}
+
+static uint64_t xorshift(uint64_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/*!
+    * \brief Run every scenario on every configuration
+    * \param lineCounts The numbers of lines
+    * \param linesPerSet The lines per set of set associative caches
+    * \param paths The paths, the directory alone and the whole cache
+    * \param organisations The organisations, direct mapping has no replacement policy and runs once, with LRU
+    * \param policies The replacement policies
+    */
+void MetadataBenchmark::run(const std::vector<int> &lineCounts, int linesPerSet, const std::vector<MetadataPath> &paths,
+                            const std::vector<Organisation> &organisations, const std::vector<ReplacementPolicy> &policies)
+{
+    const std::vector<MetadataScenario> scenarios = {LOOKUP_HIT, LOOKUP_MISS, MIX_90, MIX_50, SET_DIRTY};
+    for (Organisation organisation : organisations)
+    {
+        const std::vector<ReplacementPolicy> organisationPolicies = (organisation == DIRECT_MAPPING) ? std::vector<ReplacementPolicy>(1, LRU) : policies;
+        for (ReplacementPolicy policy : organisationPolicies)
+        {
+            for (int lines : lineCounts)
+            {
+                for (MetadataPath path : paths)
+                {
+                    if (path == CACHE_PATH)
+                    {
+                        measureCache(organisation, policy, lines, linesPerSet, scenarios);
+                        continue;
+                    }
+                    for (MetadataScenario scenario : scenarios)
+                    {
+                        this->results.push_back(measureDirectory(organisation, policy, lines, linesPerSet, scenario));
+                    }
+                }
+            }
+        }
+    }
+}
+
+void MetadataBenchmark::printResults()
+{
+    printf("======================================================================================================\n");
+    printf("%-10s %-18s %-9s %8s %-12s %12s %12s %14s\n", "Path", "Organisation", "Policy", "Lines", "Scenario", "Ops", "ns/op", "LLC miss/op");
+    printf("------------------------------------------------------------------------------------------------------\n");
+    for (auto& result : this->results)
+    {
+        printf("%-10s %-18s %-9s %8d %-12s %12llu %12.1f ",
+               getPathName(result.path), getOrganisationName(result.organisation), getPolicyLabel(result),
+               result.lines, getScenarioName(result.scenario), result.operations, result.nsPerOp);
+        if (result.cacheMissesPerOp < 0) printf("%14s\n", "n/a");
+        else printf("%14.2f\n", result.cacheMissesPerOp);
+    }
+    printf("======================================================================================================\n");
+}
+
+/*!
+    * \brief Write the results, the file can be used as the baseline of a later run
+    */
+void MetadataBenchmark::writeCSV(const std::string &path)
+{
+    ofstream file(path);
+    if (!file.is_open())
+    {
+        printf("Error: Unable to open '%s'\n", path.c_str());
+        return;
+    }
+
+    file << "path,organisation,policy,lines,scenario,ops,ns_per_op,llc_misses_per_op" << endl;
+    for (auto& result : this->results)
+    {
+        file << getKey(result) << "," << result.operations << ","
+             << result.nsPerOp << "," << result.cacheMissesPerOp << endl;
+    }
+}
+
+/*!
+    * \brief Compare the results with a baseline written by writeCSV. A scenario regresses when it is
+    * more than threshold times and METADATA_REGRESSION_SLACK_NS slower than in the baseline.
+    * \return The number of regressions, scenarios that are not in the baseline are skipped
+    */
+int MetadataBenchmark::compareWithBaseline(const std::string &path, double threshold)
+{
+    ifstream file(path);
+    if (!file.is_open())
+    {
+        printf("Error: Unable to open baseline '%s'\n", path.c_str());
+        exit(1);
+    }
+
+    std::map<std::string, double> baseline;    // < path, configuration and scenario, ns/op >
+    std::string line;
+    std::getline(file, line);   // Header
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string key, field, operations, nsPerOp;
+        for (int i = 0; i < 5; ++i)
+        {
+            std::getline(fields, field, ',');
+            key += (i == 0 ? "" : ",") + field;
+        }
+        std::getline(fields, operations, ',');
+        std::getline(fields, nsPerOp, ',');
+        if (nsPerOp.empty()) continue;
+        baseline[key] = atof(nsPerOp.c_str());
+    }
+
+    int regressions = 0;
+    for (auto& result : this->results)
+    {
+        auto found = baseline.find(getKey(result));
+        if (found == baseline.end()) continue;
+
+        if (result.nsPerOp > found->second * threshold && result.nsPerOp - found->second > METADATA_REGRESSION_SLACK_NS)
+        {
+            printf("Regression: %s %s %s %d lines %s %.1f ns/op, baseline %.1f ns/op\n",
+                   getPathName(result.path), getOrganisationName(result.organisation), getPolicyLabel(result),
+                   result.lines, getScenarioName(result.scenario), result.nsPerOp, found->second);
+            regressions += 1;
+        }
+    }
+    printf("%-30s %d (threshold %.2fx)\n", "Regressions:", regressions, threshold);
+    return regressions;
+}
+
+const char* MetadataBenchmark::getPathName(MetadataPath path)
+{
+    const char *names[2] = {"directory", "cache"};
+    return names[path];
+}
+
+const char* MetadataBenchmark::getScenarioName(MetadataScenario scenario)
+{
+    const char *names[5] = {"hit", "miss", "mix90", "mix50", "dirty"};
+    return names[scenario];
+}
+
+int MetadataBenchmark::getHitPercentage(MetadataScenario scenario)
+{
+    const int percentages[5] = {100, 0, 90, 50, 100};
+    return percentages[scenario];
+}
+
+/* ===================== PRIVATE METHODS ===================== */
+
+/*!
+    * \brief Direct mapping has no replacement policy
+    */
+const char* MetadataBenchmark::getPolicyLabel(const MetadataResult &result)
+{
+    return (result.organisation == DIRECT_MAPPING) ? "-" : getReplacementPolicyName(result.replacementPolicy);
+}
+
+/*!
+    * \brief The columns of the CSV that identify a result, as written by writeCSV
+    */
+std::string MetadataBenchmark::getKey(const MetadataResult &result)
+{
+    std::ostringstream key;
+    key << getPathName(result.path) << "," << getOrganisationName(result.organisation) << "," << getPolicyLabel(result) << ","
+        << result.lines << "," << getScenarioName(result.scenario);
+    return key.str();
+}
+
+/*!
+    * \brief Time an operation on random draws, the fastest of METADATA_REPETITIONS runs counts,
+    * a slower one was interrupted by something else on the machine
+    * \param operation Called with a draw, returns a value that keeps the compiler from dropping the work
+    * \param result Returns the operations, the time per operation and the cache misses per operation
+    */
+template <typename Operation>
+void MetadataBenchmark::time(Operation &operation, MetadataResult &result)
+{
+    uint64_t random = 0x2545F4914F6CDD1DULL;
+    std::vector<uint64_t> draws(METADATA_BATCH);
+    int batch = 1;          // Grows to METADATA_BATCH, a fully associative million lines takes milliseconds per operation
+    volatile int sink = 0;
+    unsigned long long totalOperations = 0;
+    double nsPerOp = 0;
+    long long cacheMisses = 0;
+
+    for (int repetition = 0; repetition < METADATA_REPETITIONS; ++repetition)
+    {
+        double elapsed = 0;     // Nanoseconds
+        unsigned long long operations = 0;
+        while (elapsed < METADATA_MIN_TIME_MS * 1e6)
+        {
+            for (int op = 0; op < batch; ++op) draws[op] = xorshift(random);
+
+            this->counter.start();
+            const auto start = std::chrono::steady_clock::now();
+            for (int op = 0; op < batch; ++op) sink += operation(draws[op]);
+            const auto end = std::chrono::steady_clock::now();
+            const long long misses = this->counter.stop();
+            cacheMisses = (misses < 0 || cacheMisses < 0) ? -1 : cacheMisses + misses;
+
+            const double batchTime = std::chrono::duration<double, std::nano>(end - start).count();
+            elapsed += batchTime;
+            operations += batch;
+            if (batchTime < 1e6) batch = min(2 * batch, METADATA_BATCH);
+        }
+        totalOperations += operations;
+        if (repetition == 0 || elapsed / operations < nsPerOp) nsPerOp = elapsed / operations;
+    }
+
+    result.operations = totalOperations;
+    result.nsPerOp = nsPerOp;
+    result.cacheMissesPerOp = (cacheMisses < 0) ? -1 : (double) cacheMisses / totalOperations;
+}
+
+/*!
+    * \brief Measure one scenario on the directory of a full cache
+    * \return The result, the time per operation includes picking the tag
+    */
+MetadataResult MetadataBenchmark::measureDirectory(Organisation organisation, ReplacementPolicy replacementPolicy, int lines, int linesPerSet, MetadataScenario scenario)
+{
+    // The same geometry as Cache::initialise, set associative caches ask for lines / linesPerSet sets
+    int nrOfSets, nrOfLinesPerSet;
+    if (organisation == DIRECT_MAPPING)
+    {
+        nrOfSets = Cache::getTableSize(lines);
+        nrOfLinesPerSet = 1;
+    }
+    else if (organisation == FULLY_ASSOCIATIVE)
+    {
+        nrOfSets = 1;
+        nrOfLinesPerSet = lines;
+    }
+    else
+    {
+        nrOfSets = Cache::getTableSize(max(1, lines / linesPerSet));
+        nrOfLinesPerSet = max(1, lines / nrOfSets);
+    }
+    const int nrOfLines = nrOfSets * nrOfLinesPerSet;
+
+    std::vector<CacheLine> cacheLines(nrOfLines);
+    memset(cacheLines.data(), 0, nrOfLines * sizeof(CacheLine));
+    CacheDirectory *directory = createCacheDirectory(organisation, replacementPolicy, cacheLines.data(), nrOfSets, nrOfLinesPerSet, false);
+    const std::vector<unsigned int> lockedLines;
+    unsigned long long nextTag = 1;
+    uint64_t random = 0x9E3779B97F4A7C15ULL;
+
+    // Fill every line, the set of a tag decides which lines it can take
+    for (int set = 0; set < nrOfSets; ++set)
+    {
+        for (int way = 0; way < nrOfLinesPerSet; ++way)
+        {
+            CacheLine &line = cacheLines[set * nrOfLinesPerSet + way];
+            line.tag = moveToSet(hashTag(nextTag++), set, nrOfSets);
+            line.flag = BOTH;
+            line.size = 4096 * (1 + xorshift(random) % 256);
+        }
+    }
+
+    const uint64_t hitPercentage = getHitPercentage(scenario);
+    auto operation = [&](uint64_t draw) -> int
+    {
+        if (draw % 100 < hitPercentage)
+        {
+            // getCacheLine, and setLineFlag for setDirtyFlag
+            const int idx = visitCacheDirectory(directory, organisation, replacementPolicy, false, FindVisitor{cacheLines[(draw >> 8) % nrOfLines].tag});
+            if (scenario == SET_DIRTY && idx != -1) cacheLines[idx].flag = CPU;
+            return idx;
+        }
+
+        // getCacheLine misses, addToCache picks a victim and replaces it
+        void *tag = hashTag(nextTag++);
+        int idx = visitCacheDirectory(directory, organisation, replacementPolicy, false, FindVisitor{tag});
+        if (idx == -1) idx = visitCacheDirectory(directory, organisation, replacementPolicy, false, VictimVisitor{tag, lockedLines});
+        if (idx == -1) return idx;
+        CacheLine &line = cacheLines[idx];
+        line.tag = tag;
+        line.flag = BOTH;
+        line.age = 0;
+        line.size = 4096 * (1 + (draw >> 8) % 256);
+        return idx + visitCacheDirectory(directory, organisation, replacementPolicy, false, WriteBackVisitor{idx});
+    };
+
+    MetadataResult result;
+    result.path = DIRECTORY_PATH;
+    result.organisation = organisation;
+    result.replacementPolicy = replacementPolicy;
+    result.lines = nrOfLines;
+    result.scenario = scenario;
+    time(operation, result);
+    delete directory;
+    return result;
+}
+
+/*!
+    * \brief Measure the scenarios, in order, on one full shadow cache. An upload goes through 
+    * Cache::simulateTransfer and a dirty flag through setDirtyFlag, the public paths of shadow mode.
+    * The lines stand for shadow buffers, their handles are never dereferenced.
+    */
+void MetadataBenchmark::measureCache(Organisation organisation, ReplacementPolicy replacementPolicy, int lines, int linesPerSet, const std::vector<MetadataScenario> &scenarios)
+{
+    // Every upload of the fill scans the lines of a set, a large fully associative cache would take hours
+    const int ways = (organisation == FULLY_ASSOCIATIVE) ? lines : (organisation == SET_ASSOCIATIVE) ? linesPerSet : 1;
+    if ((double) lines * ways > METADATA_FILL_BUDGET)
+    {
+        printf("Skipping the cache path of %s %s with %d lines, it takes too long to fill\n",
+               getOrganisationName(organisation), (organisation == DIRECT_MAPPING) ? "-" : getReplacementPolicyName(replacementPolicy), lines);
+        return;
+    }
+
+    // Cache::initialise asks set associative caches for the sets, the same geometry as measureDirectory
+    Cache cache(organisation, replacementPolicy, lines, (organisation == SET_ASSOCIATIVE) ? max(1, lines / linesPerSet) : 1, false);
+    cache.setMode(SHADOW);
+    const int nrOfLines = cache.getNrOfLines();
+    unsigned long long nextTag = 1;
+    uint64_t random = 0x9E3779B97F4A7C15ULL;
+
+    // Upload new buffers until every line holds one, a tag whose set is full replaces a line of it
+    std::vector<bool> filled(nrOfLines, false);
+    int nrOfFilled = 0;
+    for (int attempt = 0; nrOfFilled < nrOfLines && attempt < METADATA_FILL_ATTEMPTS * nrOfLines; ++attempt)
+    {
+        void *tag = hashTag(nextTag++);
+        const int idx = cache.simulateTransfer(tag, 4096 * (1 + xorshift(random) % 256), (cl_mem) tag, true);
+        if (idx != -1 && !filled[idx])
+        {
+            filled[idx] = true;
+            nrOfFilled += 1;
+        }
+    }
+
+    for (MetadataScenario scenario : scenarios)
+    {
+        const uint64_t hitPercentage = getHitPercentage(scenario);
+        auto operation = [&](uint64_t draw) -> int
+        {
+            if (draw % 100 < hitPercentage)
+            {
+                const int idx = (draw >> 8) % nrOfLines;
+                const CacheLine &line = cache.getLine(idx);
+                if (scenario == SET_DIRTY)
+                {
+                    cache.setDirtyFlag(line.tag, CPU);
+                    return idx;
+                }
+                return cache.simulateTransfer(line.tag, line.size, (cl_mem) line.tag, true);
+            }
+
+            // A new buffer, its handle is the tag
+            void *tag = hashTag(nextTag++);
+            return cache.simulateTransfer(tag, 4096 * (1 + (draw >> 8) % 256), (cl_mem) tag, true);
+        };
+
+        MetadataResult result;
+        result.path = CACHE_PATH;
+        result.organisation = organisation;
+        result.replacementPolicy = replacementPolicy;
+        result.lines = nrOfLines;
+        result.scenario = scenario;
+        time(operation, result);
+        this->results.push_back(result);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef METADATA_H
+#define METADATA_H
+
+#include <cachecore.hpp>
+
+#include <string>
+#include <vector>
+
+// Settings
+#define METADATA_MIN_TIME_MS            20      // Every scenario runs at least this long
+#define METADATA_BATCH                  256     // At most this many operations between two reads of the clock
+#define METADATA_REPETITIONS            3       // Fastest of this many timed runs per scenario
+#define METADATA_REGRESSION_THRESHOLD   1.25    // A scenario regresses when it is this much slower than the baseline
+#define METADATA_REGRESSION_SLACK_NS    2.0     // and at least this many nanoseconds, so timer noise on tiny numbers does not count
+#define METADATA_FILL_ATTEMPTS          64      // The cache path uploads at most this many buffers per line to fill the cache
+#define METADATA_FILL_BUDGET            1e9     // and skips a configuration whose fill scans more lines than this
+
+enum MetadataPath {
+    DIRECTORY_PATH,     // The CacheDirectory alone, on lines that only hold metadata
+    CACHE_PATH          // Cache in shadow mode: getCacheLine, addToCache, stampLine, the deviceLines of the shadow buffers and setDirtyFlag
+};
+
+enum MetadataScenario {
+    LOOKUP_HIT,         // getCacheLine of a cached tag
+    LOOKUP_MISS,        // getCacheLine of a new tag, then the victim is evicted and the tag inserted as addToCache does
+    MIX_90,             // 90% hits
+    MIX_50,             // 50% hits
+    SET_DIRTY           // setDirtyFlag of a cached tag
+};
+
+struct MetadataResult {
+    MetadataPath path;
+    Organisation organisation;
+    ReplacementPolicy replacementPolicy;
+    int lines;
+    MetadataScenario scenario;
+    unsigned long long operations;
+    double nsPerOp;
+    double cacheMissesPerOp;    // Last level cache misses of the CPU, -1 when the counter is not available
+};
+
+/*!
+    * \brief Reads a hardware counter of the CPU through perf_event_open, only on linux.
+    * In containers and with a high perf_event_paranoid the counter is usually not available.
+    */
+class PerfCounter
+{
+    private:
+        int fd;
+
+    public:
+        PerfCounter();
+        ~PerfCounter();
+
+        bool available();
+        void start();
+        long long stop();
+};
+
+/*!
+    * \brief Measures the CPU cost of the metadata of the cache, without device traffic. The directory path drives
+    * the CacheDirectory that Cache uses for getCacheLine and addToCache, with the same static dispatch, on cache
+    * lines that only hold metadata. The cache path drives a Cache in shadow mode the way a shadowed transfer does,
+    * so it also pays for the bookkeeping around the directory. The lines are full before a scenario starts,
+    * so every miss evicts.
+    */
+class MetadataBenchmark
+{
+    private:
+        std::vector<MetadataResult> results;
+        PerfCounter counter;
+
+        MetadataResult measureDirectory(Organisation organisation, ReplacementPolicy replacementPolicy, int lines, int linesPerSet, MetadataScenario scenario);
+        void measureCache(Organisation organisation, ReplacementPolicy replacementPolicy, int lines, int linesPerSet, const std::vector<MetadataScenario> &scenarios);
+        template <typename Operation>
+        void time(Operation &operation, MetadataResult &result);
+
+        static const char* getPolicyLabel(const MetadataResult &result);
+        static std::string getKey(const MetadataResult &result);
+
+    public:
+        void run(const std::vector<int> &lineCounts, int linesPerSet, const std::vector<MetadataPath> &paths,
+                 const std::vector<Organisation> &organisations, const std::vector<ReplacementPolicy> &policies);
+
+        void printResults();
+        void writeCSV(const std::string &path);
+        int compareWithBaseline(const std::string &path, double threshold = METADATA_REGRESSION_THRESHOLD);
+
+        static const char* getPathName(MetadataPath path);
+        static const char* getScenarioName(MetadataScenario scenario);
+        static int getHitPercentage(MetadataScenario scenario);
+};
+
+#endif // METADATA_H
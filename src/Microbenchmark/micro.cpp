@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <utils.hpp>
+#include <metadata.hpp>
+
+using namespace std;
+
+/*
+ * Usage: ./softcache_micro [-lines 10,100,1000,10000,100000,1000000] [-l lines per set] [-p directory,cache]
+ *                          [-o d,s,f] [-r lru,fifo,random,smallest] [-csv file] [-baseline file] [-threshold ratio]
+ * Exits with 1 when a scenario regressed against the baseline.
+ */
+int main(int argc, char** argv)
+{
+    InputParser input(argc, argv);
+    const std::string &linesString = input.getCmdOption("-lines");
+    const std::string &linesPerSetString = input.getCmdOption("-l");
+    const std::string &pathString = input.getCmdOption("-p");
+    const std::string &orgString = input.getCmdOption("-o");
+    const std::string &rpString = input.getCmdOption("-r");
+    const std::string &csvString = input.getCmdOption("-csv");
+    const std::string &baselineString = input.getCmdOption("-baseline");
+    const std::string &thresholdString = input.getCmdOption("-threshold");
+
+    const int linesPerSet = linesPerSetString.empty() ? 8 : max(1, atoi(linesPerSetString.c_str()));
+    const double threshold = thresholdString.empty() ? METADATA_REGRESSION_THRESHOLD : atof(thresholdString.c_str());
+
+    std::vector<int> lineCounts;
+    std::istringstream lines(linesString.empty() ? "10,100,1000,10000,100000,1000000" : linesString);
+    std::string count;
+    while (std::getline(lines, count, ',')) lineCounts.push_back(atoi(count.c_str()));
+
+    std::vector<MetadataPath> paths;
+    if (isSelected(pathString, "directory")) paths.push_back(DIRECTORY_PATH);
+    if (isSelected(pathString, "cache")) paths.push_back(CACHE_PATH);
+
+    std::vector<Organisation> organisations;
+    if (isSelected(orgString, "d")) organisations.push_back(DIRECT_MAPPING);
+    if (isSelected(orgString, "s")) organisations.push_back(SET_ASSOCIATIVE);
+    if (isSelected(orgString, "f")) organisations.push_back(FULLY_ASSOCIATIVE);
+
+    std::vector<ReplacementPolicy> policies;
+    const char *policyNames[4] = {"lru", "fifo", "random", "smallest"};
+    const ReplacementPolicy allPolicies[4] = {LRU, FIFO, RANDOM, SMALLEST};
+    for (int p = 0; p < 4; ++p)
+    {
+        if (isSelected(rpString, policyNames[p])) policies.push_back(allPolicies[p]);
+    }
+    if (policies.empty()) policies.push_back(LRU);
+
+    MetadataBenchmark benchmark;
+    benchmark.run(lineCounts, linesPerSet, paths, organisations, policies);
+    benchmark.printResults();
+    if (!csvString.empty()) benchmark.writeCSV(csvString);
+
+    if (!baselineString.empty() && benchmark.compareWithBaseline(baselineString, threshold) > 0)
+    {
+        return 1;
+    }
+    return 0;
+}
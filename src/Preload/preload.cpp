@@ -0,0 +1,306 @@
+/*
+ * LD_PRELOAD interposer, caches the transfers of unmodified OpenCL applications:
+ *
+ *     LD_PRELOAD=./libsoftcache_preload.so SOFTCACHE_OPTIONS="-o f -r lru -c 12" ./application
+ *
+ * SOFTCACHE_OPTIONS    The command line options of Cache(argc, argv), e.g. "-o f -r fifo -c 12 -w 01 -m shadow"
+ * SOFTCACHE_PROFILE    When set, the cache and time profile are printed when the application exits
+ *
+ * The cache calls the OpenCL functions it interposes itself, those calls are recognised
+ * by a thread local flag and forwarded to the real functions.
+ * Unix only.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // RTLD_NEXT
+#endif
+#include <dlfcn.h>
+
+#include <softcache.hpp>
+
+#include <mutex>
+#include <string>
+#include <sstream>
+
+using namespace std;
+
+#define REAL(name) static decltype(&name) real_##name = (decltype(&name)) dlsym(RTLD_NEXT, #name)
+
+static Cache *globalCache = nullptr;
+static std::mutex cacheMutex;
+static thread_local bool insideCache = false;
+
+// < handle of the application, buffer of the cache it stands for >
+// The cache replaces the buffer of a write on a hit, but the application keeps using its own handle.
+// Every alias holds one reference on the buffer of the cache.
+static std::unordered_map<cl_mem, cl_mem> aliases;
+
+// < buffer created by the application, references the application holds on it >
+// The cache retains these buffers too, so the reference count of OpenCL does not tell when the application is done.
+static std::unordered_map<cl_mem, cl_uint> references;
+
+/*!
+    * \brief A buffer argument as the application set it. The alias of the handle can change
+    * between clSetKernelArg and the launch, so it is resolved when the kernel is enqueued.
+    */
+struct BoundHandle
+{
+    cl_mem handle;      // The handle of the application, nullptr for other arguments
+    cl_mem bound;       // The buffer the cache last bound to the argument
+};
+
+// < kernel, its arguments by index >
+static std::unordered_map<cl_kernel, std::vector<BoundHandle>> kernelHandles;
+
+/*!
+    * \brief Marks the calls made while the cache is working, so they go to the real functions
+    */
+struct CacheScope
+{
+    CacheScope() { insideCache = true; }
+    ~CacheScope() { insideCache = false; }
+};
+
+static void printProfile()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    CacheScope scope;
+    globalCache->printCache();
+    globalCache->printTimeProfile();
+}
+
+/*!
+    * \brief Get the cache, created on first use from SOFTCACHE_OPTIONS.
+    * The cache is not destroyed at exit, the OpenCL runtime might already be gone by then.
+    * Should be called with the mutex locked.
+    */
+static Cache* getCache()
+{
+    if (globalCache != nullptr) return globalCache;
+
+    CacheScope scope;
+    const char *options = getenv("SOFTCACHE_OPTIONS");
+    std::vector<std::string> tokens(1, "softcache");
+    std::istringstream stream(options != nullptr ? options : "");
+    for (std::string token; stream >> token; ) tokens.push_back(token);
+
+    if (tokens.size() > 1)
+    {
+        std::vector<char*> argv;
+        for (auto& token : tokens) argv.push_back(&token[0]);
+        int argc = argv.size();
+        globalCache = new Cache(argc, argv.data());
+    }
+    else
+    {
+        globalCache = new Cache(FULLY_ASSOCIATIVE, FIFO, 12, 1, false);
+    }
+
+    // The application passes its handles to functions that are not interposed, so they have to be real buffers
+    globalCache->setVirtualBuffers(false);
+
+    if (getenv("SOFTCACHE_PROFILE") != nullptr) atexit(printProfile);
+    return globalCache;
+}
+
+/*!
+    * \brief The buffer of the cache a handle of the application stands for
+    */
+static cl_mem resolve(cl_mem buffer)
+{
+    auto alias = aliases.find(buffer);
+    return (alias == aliases.end()) ? buffer : alias->second;
+}
+
+/*!
+    * \brief Bind the current aliases of the handles the application set on a kernel, before it is enqueued.
+    * Should be called with the mutex locked, from inside the cache.
+    */
+static cl_int bindAliases(Cache *cache, cl_kernel kernel)
+{
+    auto handles = kernelHandles.find(kernel);
+    if (handles == kernelHandles.end()) return CL_SUCCESS;
+
+    cl_int err = CL_SUCCESS;
+    for (cl_uint index = 0; index < handles->second.size(); ++index)
+    {
+        BoundHandle &argument = handles->second[index];
+        if (argument.handle == nullptr) continue;
+
+        cl_mem buffer = resolve(argument.handle);
+        if (buffer == argument.bound) continue;
+
+        err |= cache->setKernelArg(kernel, index, sizeof(cl_mem), &buffer);
+        argument.bound = buffer;
+    }
+    return err;
+}
+
+extern "C" {
+
+cl_int clBuildProgram(
+    cl_program program,
+    cl_uint num_devices,
+    const cl_device_id *device_list,
+    const char *options,
+    void (CL_CALLBACK *pfn_notify)(cl_program, void *),
+    void *user_data)
+{
+    REAL(clBuildProgram);
+    if (insideCache) return real_clBuildProgram(program, num_devices, device_list, options, pfn_notify, user_data);
+
+    // The argument qualifiers tell the cache which buffers a kernel can write
+    std::string buildOptions = (options != nullptr) ? options : "";
+    if (buildOptions.find("-cl-kernel-arg-info") == std::string::npos) buildOptions += " -cl-kernel-arg-info";
+    return real_clBuildProgram(program, num_devices, device_list, buildOptions.c_str(), pfn_notify, user_data);
+}
+
+cl_mem clCreateBuffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *errcode_ret)
+{
+    REAL(clCreateBuffer);
+    if (insideCache) return real_clCreateBuffer(context, flags, size, host_ptr, errcode_ret);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    Cache *cache = getCache();
+    CacheScope scope;
+    cl_int err;
+    cl_mem buffer = cache->createBuffer(context, flags, size, host_ptr, &err);
+    if (errcode_ret != NULL) *errcode_ret = err;
+    if (buffer != NULL) references[buffer] = 1;
+    return buffer;
+}
+
+cl_int clEnqueueWriteBuffer(
+    cl_command_queue command_queue,
+    cl_mem buffer, cl_bool blocking_write,
+    size_t offset,
+    size_t cb,
+    const void *ptr,
+    cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list,
+    cl_event *event)
+{
+    REAL(clEnqueueWriteBuffer);
+    if (insideCache) return real_clEnqueueWriteBuffer(command_queue, buffer, blocking_write, offset, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    Cache *cache = getCache();
+    CacheScope scope;
+
+    // On a hit the cache releases the buffer it is given, the extra reference keeps the handle of the application alive
+    cl_mem current = resolve(buffer);
+    cl_mem target = current;
+    clRetainMemObject(current);
+    cl_int err = cache->enqueueWriteBuffer(command_queue, &target, blocking_write, offset, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+
+    if (target == current)
+    {
+        clReleaseMemObject(current);
+    }
+    else
+    {
+        // The cache retained target for us
+        if (current != buffer) clReleaseMemObject(current);
+        aliases[buffer] = target;
+    }
+    return err;
+}
+
+cl_int clEnqueueReadBuffer(
+    cl_command_queue command_queue,
+    cl_mem buffer, cl_bool blocking_read,
+    size_t offset,
+    size_t cb,
+    void *ptr,
+    cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list,
+    cl_event *event)
+{
+    REAL(clEnqueueReadBuffer);
+    if (insideCache) return real_clEnqueueReadBuffer(command_queue, buffer, blocking_read, offset, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    Cache *cache = getCache();
+    CacheScope scope;
+    cl_int err = cache->enqueueReadBuffer(command_queue, resolve(buffer), blocking_read, offset, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+
+    // The application expects the data on return, so write back does not defer reads
+    if (cache->getWriteBack()) err |= cache->writeBack(ptr);
+    return err;
+}
+
+cl_int clSetKernelArg(cl_kernel kernel, cl_uint arg_index, size_t arg_size, const void *arg_value)
+{
+    REAL(clSetKernelArg);
+    if (insideCache) return real_clSetKernelArg(kernel, arg_index, arg_size, arg_value);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    Cache *cache = getCache();
+    CacheScope scope;
+
+    // The handle is bound as it is, bindAliases swaps in its alias at the launch
+    std::vector<BoundHandle> &handles = kernelHandles[kernel];
+    if (handles.size() <= arg_index) handles.resize(arg_index + 1, BoundHandle{nullptr, nullptr});
+
+    const bool isBuffer = arg_size == sizeof(cl_mem) && arg_value != nullptr && references.count(*(const cl_mem *) arg_value) > 0;
+    cl_int err = cache->setKernelArg(kernel, arg_index, arg_size, arg_value);
+    handles[arg_index].handle = (isBuffer && err == CL_SUCCESS) ? *(const cl_mem *) arg_value : nullptr;
+    handles[arg_index].bound = handles[arg_index].handle;
+    return err;
+}
+
+cl_int clEnqueueNDRangeKernel(
+    cl_command_queue command_queue,
+    cl_kernel kernel,
+    cl_uint work_dim,
+    const size_t *global_work_offset,
+    const size_t *global_work_size,
+    const size_t *local_work_size,
+    cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list,
+    cl_event *event)
+{
+    REAL(clEnqueueNDRangeKernel);
+    if (insideCache) return real_clEnqueueNDRangeKernel(command_queue, kernel, work_dim, global_work_offset, global_work_size, local_work_size, num_events_in_wait_list, event_wait_list, event);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    Cache *cache = getCache();
+    CacheScope scope;
+    cl_int err = bindAliases(cache, kernel);
+    if (err != CL_SUCCESS) return err;
+    return cache->enqueueNDRangeKernel(command_queue, kernel, work_dim, global_work_offset, global_work_size, local_work_size, num_events_in_wait_list, event_wait_list, event);
+}
+
+cl_int clRetainMemObject(cl_mem memobj)
+{
+    REAL(clRetainMemObject);
+    if (insideCache) return real_clRetainMemObject(memobj);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cl_int err = real_clRetainMemObject(memobj);
+    auto count = references.find(memobj);
+    if (err == CL_SUCCESS && count != references.end()) count->second++;
+    return err;
+}
+
+cl_int clReleaseMemObject(cl_mem memobj)
+{
+    REAL(clReleaseMemObject);
+    if (insideCache) return real_clReleaseMemObject(memobj);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cl_int err = real_clReleaseMemObject(memobj);
+    auto count = references.find(memobj);
+    if (err != CL_SUCCESS || count == references.end() || --count->second > 0) return err;
+
+    // With the last reference of the application the alias goes as well
+    references.erase(count);
+    auto alias = aliases.find(memobj);
+    if (alias != aliases.end())
+    {
+        real_clReleaseMemObject(alias->second);
+        aliases.erase(alias);
+    }
+    return err;
+}
+
+}
@@ -0,0 +1,364 @@
+#ifndef CACHECORE_H
+#define CACHECORE_H
+
+#include <CL/cl.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <vector>
+#include <algorithm>
+
+enum Flag {
+    CPU,
+    GPU,
+    BOTH
+};
+
+struct CacheLine {
+    Flag flag;
+    int age;
+    size_t size;
+    void *tag;
+    cl_mem deviceAddress;
+    bool fenced;        // The host pages are protected until the data is read back (lazy coherence)
+    cl_event lastWriter;    // The last command that wrote the device data, only tracked when transfers overlap
+    cl_mem parent;      // The assembled buffer this block is a sub-buffer of, NULL for whole buffers
+    unsigned long long version;     // Stamped whenever the device data changes, unique over all lines
+};
+
+enum Organisation {
+    DIRECT_MAPPING,
+    SET_ASSOCIATIVE,
+    FULLY_ASSOCIATIVE
+};
+
+enum ReplacementPolicy {
+    LRU,
+    FIFO,
+    RANDOM,
+    SMALLEST
+};
+
+inline const char* getOrganisationName(Organisation organisation)
+{
+    const char *names[3] = {"DIRECT_MAPPING", "SET_ASSOCIATIVE", "FULLY_ASSOCIATIVE"};
+    return names[organisation];
+}
+
+inline const char* getReplacementPolicyName(ReplacementPolicy replacementPolicy)
+{
+    const char *names[4] = {"LRU", "FIFO", "RANDOM", "SMALLEST"};
+    return names[replacementPolicy];
+}
+
+/*!
+    * \brief Lookup and replacement on the cache lines, without knowing the configuration.
+    * The runtime configurable Cache uses this interface, CacheCore implements it.
+    */
+class CacheDirectory
+{
+    public:
+        virtual ~CacheDirectory() {}
+
+        virtual int find(const void *tag) = 0;
+        virtual int victim(const void *tag, const std::vector<unsigned int> &lockedLines) = 0;
+        virtual bool needsWriteBack(int idx) const = 0;
+};
+
+/*!
+    * \brief Lookup and replacement with the configuration known at compile time.
+    * Called through the concrete type, the branches on the organisation and replacement policy
+    * fold away and find and victim can be inlined.
+    * \tparam Org The organisation
+    * \tparam Policy The replacement policy, ignored for DIRECT_MAPPING
+    * \tparam LinesPerSet The number of lines per set, 0 if it is only known at runtime
+    * \tparam WriteBack Evicted lines that hold the most recent data have to be written back
+    */
+template <Organisation Org, ReplacementPolicy Policy, int LinesPerSet = 0, bool WriteBack = false>
+class CacheCore final : public CacheDirectory
+{
+    private:
+        CacheLine *lines;
+        int nrOfSets;
+        int nrOfLinesPerSet;
+        std::vector<unsigned int> FIFO_index;
+
+        inline int linesPerSet() const
+        {
+            return (LinesPerSet > 0) ? LinesPerSet : this->nrOfLinesPerSet;
+        }
+
+        inline static bool isLocked(const std::vector<unsigned int> &lockedLines, int idx)
+        {
+            return std::find(lockedLines.begin(), lockedLines.end(), (unsigned int) idx) != lockedLines.end();
+        }
+
+        /*!
+            * \brief Get the first line that is not locked, scanning a range from a start line and wrapping around
+            * \param offset The first line of the range
+            * \param count The number of lines in the range
+            * \param start The line the scan starts at, within the range
+            * \return The index of the line, -1 if every line of the range is locked
+            */
+        inline int getUnlockedIndex(int offset, int count, int start, const std::vector<unsigned int> &lockedLines)
+        {
+            int idx = start;
+            for (int i = 0; i < count; ++i)
+            {
+                if (!isLocked(lockedLines, idx)) return idx;
+                idx = (idx + 1 == offset + count) ? offset : idx + 1;
+            }
+            return -1;
+        }
+
+        /*!
+            * \brief Get a random line of a set that is not locked
+            * \return The index of the line, -1 if every line of the set is locked
+            */
+        inline int getRandomIndex(int offset, int count, const std::vector<unsigned int> &lockedLines)
+        {
+            return getUnlockedIndex(offset, count, offset + rand() % count, lockedLines);
+        }
+
+        inline int getOldestIndex(int setIndex, const std::vector<unsigned int> &lockedLines)
+        {
+            int oldestLineIndex = -1;
+            int oldestLineAge = -1;
+
+            const int offset = setIndex * linesPerSet();
+            const int end = offset + linesPerSet();
+            for (int idx = offset; idx < end; ++idx)
+            {
+                if (this->lines[idx].age > oldestLineAge && !isLocked(lockedLines, idx))
+                {
+                    oldestLineAge = this->lines[idx].age;
+                    oldestLineIndex = idx;
+                }
+            }
+
+            return oldestLineIndex;
+        }
+
+        inline int getSmallestDataLine(int setIndex, const std::vector<unsigned int> &lockedLines)
+        {
+            int smallestLineIndex = -1;
+
+            const int offset = setIndex * linesPerSet();
+            const int end = offset + linesPerSet();
+            for (int idx = offset; idx < end; ++idx)
+            {
+                if ((smallestLineIndex == -1 || this->lines[idx].size < this->lines[smallestLineIndex].size)
+                    && !isLocked(lockedLines, idx))
+                {
+                    smallestLineIndex = idx;
+                }
+            }
+
+            return smallestLineIndex;
+        }
+
+        inline int getFIFOIndex(int setIndex, const std::vector<unsigned int> &lockedLines)
+        {
+            // Every line of the set is tried once, in the order they were filled
+            for (int i = 0; i < linesPerSet(); ++i)
+            {
+                this->FIFO_index[setIndex] = (this->FIFO_index[setIndex] + 1) % linesPerSet();
+                const int idx = this->FIFO_index[setIndex] + setIndex * linesPerSet();
+                if (!isLocked(lockedLines, idx)) return idx;
+            }
+            return -1;
+        }
+
+    public:
+        /*!
+            * \brief Constructor
+            * \param lines The cache lines, owned by the caller
+            * \param nrOfSets The number of sets
+            * \param nrOfLinesPerSet The number of lines per set, must equal LinesPerSet when that is not 0
+            */
+        CacheCore(CacheLine *lines, int nrOfSets, int nrOfLinesPerSet)
+        {
+            this->lines = lines;
+            this->nrOfSets = (Org == FULLY_ASSOCIATIVE) ? 1 : nrOfSets;
+            this->nrOfLinesPerSet = nrOfLinesPerSet;
+            this->FIFO_index.assign(this->nrOfSets, 0);
+        }
+
+        inline int getSetIndex(const void *tag) const
+        {
+            if (Org == FULLY_ASSOCIATIVE) return 0;
+            return ((uintptr_t) tag) % this->nrOfSets;
+        }
+
+        /*!
+            * \brief Look up the line of a tag, with LRU this ages the lines of the set
+            * \param tag The tag
+            * \return The index of the line, -1 if the tag is not cached
+            */
+        inline int find(const void *tag) override
+        {
+            int found = -1;
+            if (tag == nullptr) return found;
+
+            const int offset = getSetIndex(tag) * linesPerSet();
+            const int end = offset + linesPerSet();
+            for (int idx = offset; idx < end; ++idx)
+            {
+                if (this->lines[idx].tag == tag)
+                {
+                    found = idx;
+
+                    if (Policy == LRU)
+                        this->lines[idx].age = 0;
+                    else
+                        break;
+                }
+
+                if (Policy == LRU) this->lines[idx].age += 1;
+            }
+            return found;
+        }
+
+        /*!
+            * \brief Pick the line a new tag replaces, locked lines are never picked
+            * \param tag The new tag
+            * \param lockedLines The lines in use by the current command
+            * \return The index of the line, -1 if every candidate is locked
+            */
+        inline int victim(const void *tag, const std::vector<unsigned int> &lockedLines) override
+        {
+            const int setIndex = getSetIndex(tag);
+            if (Org == DIRECT_MAPPING)
+            {
+                // A tag can only live on its own line, find would never look for it anywhere else
+                return isLocked(lockedLines, setIndex) ? -1 : setIndex;
+            }
+
+            switch (Policy)
+            {
+                case LRU:       return getOldestIndex(setIndex, lockedLines);
+                case FIFO:      return getFIFOIndex(setIndex, lockedLines);
+                case RANDOM:    return getRandomIndex(setIndex * linesPerSet(), linesPerSet(), lockedLines);
+                case SMALLEST:  return getSmallestDataLine(setIndex, lockedLines);
+            }
+            return -1;
+        }
+
+        inline bool needsWriteBack(int idx) const override
+        {
+            return WriteBack && this->lines[idx].flag == GPU;
+        }
+};
+
+/*!
+    * \brief The CacheCore that createCacheDirectory instantiates for a configuration
+    */
+template <Organisation Org, ReplacementPolicy Policy, bool WriteBack>
+struct CacheCoreType
+{
+    typedef CacheCore<Org, Policy, (Org == DIRECT_MAPPING) ? 1 : 0, WriteBack> type;
+};
+
+/*!
+    * \brief Create the directory for a configuration that is only known at runtime
+    */
+template <Organisation Org, ReplacementPolicy Policy>
+inline CacheDirectory* createCacheDirectory(CacheLine *lines, int nrOfSets, int nrOfLinesPerSet, bool writeBack)
+{
+    if (writeBack) return new typename CacheCoreType<Org, Policy, true>::type(lines, nrOfSets, nrOfLinesPerSet);
+    return new typename CacheCoreType<Org, Policy, false>::type(lines, nrOfSets, nrOfLinesPerSet);
+}
+
+template <Organisation Org>
+inline CacheDirectory* createCacheDirectory(ReplacementPolicy policy, CacheLine *lines, int nrOfSets, int nrOfLinesPerSet, bool writeBack)
+{
+    switch (policy)
+    {
+        case LRU:       return createCacheDirectory<Org, LRU>(lines, nrOfSets, nrOfLinesPerSet, writeBack);
+        case FIFO:      return createCacheDirectory<Org, FIFO>(lines, nrOfSets, nrOfLinesPerSet, writeBack);
+        case RANDOM:    return createCacheDirectory<Org, RANDOM>(lines, nrOfSets, nrOfLinesPerSet, writeBack);
+        case SMALLEST:  return createCacheDirectory<Org, SMALLEST>(lines, nrOfSets, nrOfLinesPerSet, writeBack);
+    }
+    return nullptr;
+}
+
+inline CacheDirectory* createCacheDirectory(Organisation organisation, ReplacementPolicy policy, CacheLine *lines, int nrOfSets, int nrOfLinesPerSet, bool writeBack)
+{
+    switch (organisation)
+    {
+        case DIRECT_MAPPING:    return createCacheDirectory<DIRECT_MAPPING>(policy, lines, nrOfSets, nrOfLinesPerSet, writeBack);
+        case SET_ASSOCIATIVE:   return createCacheDirectory<SET_ASSOCIATIVE>(policy, lines, nrOfSets, nrOfLinesPerSet, writeBack);
+        case FULLY_ASSOCIATIVE: return createCacheDirectory<FULLY_ASSOCIATIVE>(policy, lines, nrOfSets, nrOfLinesPerSet, writeBack);
+    }
+    return nullptr;
+}
+
+/*!
+    * \brief Call a visitor with the concrete CacheCore of a directory made by createCacheDirectory, with the same configuration.
+    * The visitor calls find, victim and needsWriteBack on the final type, so they are inlined instead of going through the vtable.
+    * \param visitor Has a result_type and a templated operator() that takes the directory
+    * \return The result of the visitor
+    */
+template <Organisation Org, ReplacementPolicy Policy, class Visitor>
+inline typename Visitor::result_type visitCacheDirectory(CacheDirectory *directory, bool writeBack, const Visitor &visitor)
+{
+    if (writeBack) return visitor(*static_cast<typename CacheCoreType<Org, Policy, true>::type*>(directory));
+    return visitor(*static_cast<typename CacheCoreType<Org, Policy, false>::type*>(directory));
+}
+
+template <Organisation Org, class Visitor>
+inline typename Visitor::result_type visitCacheDirectory(CacheDirectory *directory, ReplacementPolicy policy, bool writeBack, const Visitor &visitor)
+{
+    switch (policy)
+    {
+        case LRU:       return visitCacheDirectory<Org, LRU>(directory, writeBack, visitor);
+        case FIFO:      return visitCacheDirectory<Org, FIFO>(directory, writeBack, visitor);
+        case RANDOM:    return visitCacheDirectory<Org, RANDOM>(directory, writeBack, visitor);
+        case SMALLEST:  return visitCacheDirectory<Org, SMALLEST>(directory, writeBack, visitor);
+    }
+    return visitor(*directory);
+}
+
+template <class Visitor>
+inline typename Visitor::result_type visitCacheDirectory(CacheDirectory *directory, Organisation organisation, ReplacementPolicy policy, bool writeBack, const Visitor &visitor)
+{
+    switch (organisation)
+    {
+        case DIRECT_MAPPING:    return visitCacheDirectory<DIRECT_MAPPING>(directory, policy, writeBack, visitor);
+        case SET_ASSOCIATIVE:   return visitCacheDirectory<SET_ASSOCIATIVE>(directory, policy, writeBack, visitor);
+        case FULLY_ASSOCIATIVE: return visitCacheDirectory<FULLY_ASSOCIATIVE>(directory, policy, writeBack, visitor);
+    }
+    return visitor(*directory);
+}
+
+// Visitors for visitCacheDirectory, they work on CacheDirectory too, through the virtual interface
+struct FindVisitor
+{
+    typedef int result_type;
+    const void *tag;
+
+    template <class Directory>
+    inline int operator()(Directory &directory) const { return directory.find(this->tag); }
+};
+
+struct VictimVisitor
+{
+    typedef int result_type;
+    const void *tag;
+    const std::vector<unsigned int> &lockedLines;
+
+    template <class Directory>
+    inline int operator()(Directory &directory) const { return directory.victim(this->tag, this->lockedLines); }
+};
+
+struct WriteBackVisitor
+{
+    typedef bool result_type;
+    int idx;
+
+    template <class Directory>
+    inline bool operator()(Directory &directory) const { return directory.needsWriteBack(this->idx); }
+};
+
+#endif // CACHECORE_H
@@ -0,0 +1,182 @@
+#include <derivedcache.hpp>
+
+using namespace std;
+
+/*!
+    * \brief Constructor
+    * \param cache The cache that holds the sources
+    * \param context The OpenCL context
+    * \param budget The bytes of device memory the outputs may use, 0 uses a quarter of the global memory
+    */
+DerivedCache::DerivedCache(Cache *cache, cl_context context, size_t budget)
+{
+    this->cache = cache;
+    this->context = context;
+    this->used = 0;
+    this->useClock = 0;
+    this->hits = 0;
+    this->misses = 0;
+
+    if (budget == 0)
+    {
+        cl_device_id device;
+        cl_ulong globalMemory = 0;
+        clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(device), &device, NULL);
+        clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMemory), &globalMemory, NULL);
+        budget = globalMemory / 4;
+    }
+    this->budget = budget;
+}
+
+DerivedCache::~DerivedCache()
+{
+    while (!this->entries.empty()) dropEntry(this->entries.size() - 1);
+}
+
+/*!
+    * \brief Register a transform
+    * \param kernel The kernel, called as kernel(src, dst, rows, cols) on a 2D range of cols x rows
+    * \param sizeRatio The size of the output relative to the size of the source, e.g. 0.5 for float to half
+    * \param priority Outputs of a higher priority are evicted last
+    * \return The id of the transform
+    */
+int DerivedCache::registerTransform(cl_kernel kernel, double sizeRatio, int priority)
+{
+    DerivedTransform transform = {kernel, sizeRatio, priority};
+    this->transforms.push_back(transform);
+    return this->transforms.size() - 1;
+}
+
+/*!
+    * \brief Get the output of a transform of a row major matrix. The source is written through the cache,
+    * so it is only uploaded when the cache does not hold it. The output is derived only when there is
+    * no output yet for the current version of the source.
+    * \param queue The command queue the transfer and the transform are enqueued on
+    * \param transform The id of the transform
+    * \param ptr The host pointer of the source
+    * \param rows The number of rows of the source
+    * \param cols The number of columns of the source
+    * \param elementSize The size of an element of the source in bytes
+    * \return The output, the caller releases it with clReleaseMemObject
+    */
+cl_mem DerivedCache::get(cl_command_queue queue, int transform, const void *ptr, unsigned int rows, unsigned int cols, size_t elementSize)
+{
+    const DerivedTransform &derived = this->transforms[transform];
+    const size_t sourceSize = (size_t) rows * cols * elementSize;
+    const size_t size = (size_t) (sourceSize * derived.sizeRatio);
+
+    cl_int err;
+    cl_mem source = this->cache->createBuffer(this->context, CL_MEM_READ_ONLY, sourceSize, NULL, &err);
+    err |= this->cache->enqueueWriteBuffer(queue, source, CL_FALSE, 0, sourceSize, ptr, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to write the source of a transform! %s\n", getErrorString(err).c_str());
+        exit(1);
+    }
+
+    const unsigned long long version = this->cache->getVersion(ptr, sourceSize);
+    int idx = findEntry(ptr, transform);
+    if (idx != -1 && version != 0 && this->entries[idx].version == version && this->entries[idx].size == size)
+    {
+        this->hits += 1;
+        this->entries[idx].lastUse = ++this->useClock;
+        this->cache->releaseMemObject(source);
+        clRetainMemObject(this->entries[idx].buffer);
+        return this->entries[idx].buffer;
+    }
+
+    this->misses += 1;
+    if (idx != -1) dropEntry(idx);
+
+    cl_mem output = clCreateBuffer(this->context, CL_MEM_READ_WRITE, size, NULL, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to allocate %lu bytes for a transform! %s\n", size, getErrorString(err).c_str());
+        exit(1);
+    }
+
+    const int rowsArg = rows;
+    const int colsArg = cols;
+    const size_t global_work_size[2] = {cols, rows};
+    err  = this->cache->setKernelArg(derived.kernel, 0, sizeof(cl_mem), &source);
+    err |= this->cache->setKernelArg(derived.kernel, 1, sizeof(cl_mem), &output);
+    err |= this->cache->setKernelArg(derived.kernel, 2, sizeof(int), &rowsArg);
+    err |= this->cache->setKernelArg(derived.kernel, 3, sizeof(int), &colsArg);
+    err |= this->cache->enqueueNDRangeKernel(queue, derived.kernel, 2, NULL, global_work_size, NULL, 0, NULL, NULL);
+    this->cache->releaseMemObject(source);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to execute transform %d! %s\n", transform, getErrorString(err).c_str());
+        exit(1);
+    }
+
+    // Without argument info the transform counts as a write of the source, so the version is taken afterwards
+    const unsigned long long derivedVersion = this->cache->getVersion(ptr, sourceSize);
+    if (derivedVersion == 0 || !makeRoom(size, derived.priority)) return output;    // Not kept, the caller owns it
+
+    DerivedEntry entry = {ptr, transform, derivedVersion, output, size, derived.priority, ++this->useClock};
+    this->entries.push_back(entry);
+    this->used += size;
+    clRetainMemObject(output);     // The reference of the caller
+    return output;
+}
+
+void DerivedCache::printStats()
+{
+    printf("%-30s %u\n", "Derived hits:", this->hits);
+    printf("%-30s %u\n", "Derived misses:", this->misses);
+    printf("%-30s %zu / %zu\n", "Derived bytes in use:", this->used, this->budget);
+}
+
+/* ===================== PRIVATE METHODS ===================== */
+
+/*!
+    * \brief Find the output of a transform of a source
+    * \return The index of the entry, -1 if there is none
+    */
+int DerivedCache::findEntry(const void *tag, int transform)
+{
+    for (size_t i = 0; i < this->entries.size(); ++i)
+    {
+        if (this->entries[i].tag == tag && this->entries[i].transform == transform) return i;
+    }
+    return -1;
+}
+
+void DerivedCache::dropEntry(int idx)
+{
+    this->used -= this->entries[idx].size;
+    clReleaseMemObject(this->entries[idx].buffer);
+    this->entries.erase(this->entries.begin() + idx);
+}
+
+/*!
+    * \brief Evict outputs until a new output fits the budget. Only outputs of the same or a lower
+    * priority are evicted, the lowest priority and then the least recently used first.
+    * \param size The size of the new output
+    * \param priority The priority of the new output
+    * \return False when the new output does not fit
+    */
+bool DerivedCache::makeRoom(size_t size, int priority)
+{
+    if (size > this->budget) return false;
+
+    while (this->used + size > this->budget)
+    {
+        int victim = -1;
+        for (size_t i = 0; i < this->entries.size(); ++i)
+        {
+            const DerivedEntry &entry = this->entries[i];
+            if (entry.priority > priority) continue;
+            if (victim == -1
+                || entry.priority < this->entries[victim].priority
+                || (entry.priority == this->entries[victim].priority && entry.lastUse < this->entries[victim].lastUse))
+            {
+                victim = i;
+            }
+        }
+        if (victim == -1) return false;
+        dropEntry(victim);
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef DERIVEDCACHE_H
+#define DERIVEDCACHE_H
+
+#include <CL/cl.h>
+
+#include <softcache.hpp>
+
+#include <vector>
+
+struct DerivedTransform {
+    cl_kernel kernel;   // (__global const src, __global dst, int rows, int cols), one work-item per element of the source
+    double sizeRatio;   // The size of the output relative to the size of the source
+    int priority;       // Outputs of a higher priority are evicted last
+};
+
+struct DerivedEntry {
+    const void *tag;            // The host pointer of the source
+    int transform;
+    unsigned long long version; // The version of the source the output was derived from
+    cl_mem buffer;
+    size_t size;
+    int priority;
+    unsigned long long lastUse;
+};
+
+/*!
+    * \brief Memoises the output of device side layout transforms (transpose, packing, type conversion)
+    * of buffers held by a Cache. An output is keyed by the tag of the source and the transform, and is
+    * derived again only when the version of the source changed. The outputs have their own budget of
+    * device memory, an output is evicted by priority and then by least recent use.
+    */
+class DerivedCache
+{
+    private:
+        Cache *cache;
+        cl_context context;
+        size_t budget;      // < bytes of device memory the outputs may use >
+        size_t used;
+        unsigned long long useClock;
+        std::vector<DerivedTransform> transforms;
+        std::vector<DerivedEntry> entries;
+
+        int findEntry(const void *tag, int transform);
+        void dropEntry(int idx);
+        bool makeRoom(size_t size, int priority);
+
+    public:
+        DerivedCache(Cache *cache, cl_context context, size_t budget = 0);
+        ~DerivedCache();
+
+        int registerTransform(cl_kernel kernel, double sizeRatio = 1.0, int priority = 0);
+        cl_mem get(cl_command_queue queue, int transform, const void *ptr, unsigned int rows, unsigned int cols, size_t elementSize = sizeof(float));
+        void printStats();
+
+        unsigned int hits;
+        unsigned int misses;
+};
+
+#endif // DERIVEDCACHE_H
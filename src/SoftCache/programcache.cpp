@@ -0,0 +1,313 @@
+#include <programcache.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>      // std::setw
+#include <iterator>
+#include <vector>
+#include <atomic>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>     // _mkdir
+#include <process.h>    // _getpid
+#define getpid _getpid
+#else
+#include <unistd.h>     // getpid
+#endif
+#ifdef __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+#define PROGRAM_BINARY_VERSION  2
+
+/*!
+    * \brief Constructor
+    * \param context The OpenCL context the programs are built for
+    * \param cacheDir The directory of the program binaries, created when it does not exist.
+    * When empty the directory of SOFTCACHE_PROGRAM_CACHE is used, or PROGRAM_CACHE_DIR when that is not set
+    * \param keepBinaries Save the binaries in the directory and load them in later runs, otherwise programs are only kept in memory
+    */
+ProgramCache::ProgramCache(cl_context context, const std::string &cacheDir, bool keepBinaries)
+{
+    this->context = context;
+    this->keepBinaries = keepBinaries;
+    this->memoryHits = 0;
+    this->diskHits = 0;
+    this->builds = 0;
+
+    const char *environmentDir = getenv(PROGRAM_CACHE_ENV);
+    if (!cacheDir.empty())
+        this->cacheDir = cacheDir;
+    else if (environmentDir != nullptr && environmentDir[0] != '\0')
+        this->cacheDir = environmentDir;
+    else
+        this->cacheDir = PROGRAM_CACHE_DIR;
+
+    if (!this->keepBinaries) return;
+#ifdef _WIN32
+    _mkdir(this->cacheDir.c_str());
+#else
+    mkdir(this->cacheDir.c_str(), 0755);
+#endif
+}
+
+ProgramCache::~ProgramCache()
+{
+    for (auto& program : this->programs)
+    {
+        clReleaseProgram(program.second);
+    }
+}
+
+/*!
+    * \brief Get a built program, from memory, from its binary on disk or by building the source
+    * \param source The source of the program
+    * \param options The build options, e.g. "-D WIDTH=1024 -D TILE=16"
+    * \param device The device to build for
+    * \return The program, owned by the cache
+    */
+cl_program ProgramCache::getProgram(const std::string &source, const std::string &options, cl_device_id device)
+{
+    const std::string identity = getIdentity(source, options, device);
+    auto cached = this->programs.find(identity);
+    if (cached != this->programs.end())
+    {
+        this->memoryHits += 1;
+        return cached->second;
+    }
+
+    cl_program program = loadBinary(identity, options, device);
+    if (program != NULL)
+    {
+        this->diskHits += 1;
+        this->programs[identity] = program;
+        return program;
+    }
+
+    cl_int err;
+    const char *text = source.c_str();
+    const size_t length = source.size();
+    program = clCreateProgramWithSource(this->context, 1, &text, &length, &err);
+    if (err == CL_SUCCESS) err = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to build program with options \"%s\"! %s\n", options.c_str(), getErrorString(err).c_str());
+        exit(1);
+    }
+
+    this->builds += 1;
+    saveBinary(identity, program);
+    this->programs[identity] = program;
+    return program;
+}
+
+/*!
+    * \brief Create a kernel of a built program, the caller releases the kernel
+    * \param source The source of the program
+    * \param name The name of the kernel
+    * \param options The build options
+    * \param device The device to build for
+    * \return The kernel
+    */
+cl_kernel ProgramCache::createKernel(const std::string &source, const char *name, const std::string &options, cl_device_id device)
+{
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(getProgram(source, options, device), name, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create kernel %s! %s\n", name, getErrorString(err).c_str());
+        exit(1);
+    }
+    return kernel;
+}
+
+void ProgramCache::printStats()
+{
+    printf("%-30s %u\n", "Program memory hits:", this->memoryHits);
+    printf("%-30s %u\n", "Program disk hits:", this->diskHits);
+    printf("%-30s %u\n", "Program builds:", this->builds);
+}
+
+/*!
+    * \brief Read a source file of any size. On unix the file is mapped instead of read through a stream.
+    * \param path The path of the file
+    * \return The contents of the file
+    */
+std::string ProgramCache::loadSource(const std::string &path)
+{
+    std::string source;
+#ifdef __unix__
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        printf("Error: Unable to open '%s'\n", path.c_str());
+        exit(1);
+    }
+
+    if (info.st_size > 0)
+    {
+        void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            printf("Error: Unable to map '%s'\n", path.c_str());
+            exit(1);
+        }
+        source.assign((const char *) data, info.st_size);
+        munmap(data, info.st_size);
+    }
+    close(fd);
+#else
+    ifstream file(path, ios::binary);
+    if (!file.is_open())
+    {
+        printf("Error: Unable to open '%s'\n", path.c_str());
+        exit(1);
+    }
+    source.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+#endif
+    return source;
+}
+
+/* ===================== PRIVATE METHODS ===================== */
+
+/*!
+    * \brief The identity of a program: the hash of the source, the build options, the name of the device
+    * and the version of its driver, separated by null characters. A new driver can't load the binaries of an old one.
+    */
+std::string ProgramCache::getIdentity(const std::string &source, const std::string &options, cl_device_id device)
+{
+    char name[256] = "";
+    char driver[256] = "";
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+
+    std::ostringstream identity;
+    identity << std::hex << std::setw(16) << std::setfill('0') << hashChunk(source.data(), source.size())
+             << '\0' << options << '\0' << name << '\0' << driver;
+    return identity.str();
+}
+
+/*!
+    * \brief The file of a program, named by the hash of its identity. Identities with the same hash share 
+    * the file, the identity in the header tells them apart.
+    */
+std::string ProgramCache::getPath(const std::string &identity)
+{
+    std::ostringstream path;
+    path << this->cacheDir << "/" << std::hex << std::setw(16) << std::setfill('0') 
+         << hashChunk(identity.data(), identity.size()) << ".bin";
+    return path.str();
+}
+
+/*!
+    * \brief Create a program from the binary on disk
+    * \return The program, NULL if there is no valid binary or the device rejects it
+    */
+cl_program ProgramCache::loadBinary(const std::string &identity, const std::string &options, cl_device_id device)
+{
+    if (!this->keepBinaries) return NULL;
+
+    ifstream file(getPath(identity), ios::binary);
+    if (!file.is_open()) return NULL;
+
+    ProgramBinaryHeader header;
+    if (!file.read((char *) &header, sizeof(header))
+        || memcmp(header.magic, "SCPB", 4) != 0
+        || header.version != PROGRAM_BINARY_VERSION
+        || header.identitySize != identity.size()
+        || header.size == 0)
+    {
+        printf("Warning: Ignoring stale program binary %s\n", getPath(identity).c_str());
+        return NULL;
+    }
+
+    // The whole identity has to match, not only its hash
+    std::string savedIdentity(identity.size(), '\0');
+    if (!file.read(&savedIdentity[0], savedIdentity.size()) || savedIdentity != identity)
+    {
+        printf("Warning: Ignoring stale program binary %s\n", getPath(identity).c_str());
+        return NULL;
+    }
+
+    std::vector<unsigned char> binary(header.size);
+    if (!file.read((char *) binary.data(), binary.size()) || hashChunk(binary.data(), binary.size()) != header.checksum)
+    {
+        printf("Warning: Ignoring damaged program binary %s\n", getPath(identity).c_str());
+        return NULL;
+    }
+
+    cl_int err, binaryStatus;
+    const size_t size = binary.size();
+    const unsigned char *data = binary.data();
+    cl_program program = clCreateProgramWithBinary(this->context, 1, &device, &size, &data, &binaryStatus, &err);
+    if (err != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+    {
+        if (program != NULL) clReleaseProgram(program);
+        return NULL;
+    }
+
+    // A program created from a binary still has to be built, this does not compile the source
+    err = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+/*!
+    * \brief Save the binary of a program built for a single device. The file is written under a temporary
+    * name of this process first, so a concurrent run never reads a partial binary or writes the same file.
+    */
+void ProgramCache::saveBinary(const std::string &identity, cl_program program)
+{
+    if (!this->keepBinaries) return;
+
+    size_t size = 0;
+    clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL);
+    if (size == 0) return;
+
+    std::vector<unsigned char> binary(size);
+    unsigned char *data = binary.data();
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, NULL) != CL_SUCCESS) return;
+
+    ProgramBinaryHeader header;
+    memcpy(header.magic, "SCPB", 4);
+    header.version = PROGRAM_BINARY_VERSION;
+    header.identitySize = identity.size();
+    header.size = size;
+    header.checksum = hashChunk(binary.data(), binary.size());
+
+    // The process id tells concurrent runs apart, the counter the saves of one run
+    static std::atomic<unsigned int> saves(0);
+    const std::string path = getPath(identity);
+    std::ostringstream temporary;
+    temporary << path << "." << getpid() << "." << saves++ << ".tmp";
+    {
+        ofstream file(temporary.str(), ios::binary);
+        if (!file.is_open())
+        {
+            printf("Warning: Failed to save program binary in %s\n", this->cacheDir.c_str());
+            return;
+        }
+        file.write((const char *) &header, sizeof(header));
+        file.write(identity.data(), identity.size());
+        file.write((const char *) binary.data(), binary.size());
+        if (!file.good())
+        {
+            printf("Warning: Failed to save program binary in %s\n", this->cacheDir.c_str());
+            file.close();
+            remove(temporary.str().c_str());
+            return;
+        }
+    }
+    remove(path.c_str());
+    rename(temporary.str().c_str(), path.c_str());
+}
@@ -0,0 +1,61 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <CL/cl.h>
+
+#include <utils.hpp>
+
+#include <string>
+#include <unordered_map>
+
+// Settings
+#define PROGRAM_CACHE_DIR   "./programcache"            // Directory of the program binaries, one <key>.bin per program
+#define PROGRAM_CACHE_ENV   "SOFTCACHE_PROGRAM_CACHE"   // Environment variable that overrides the directory
+
+struct ProgramBinaryHeader {
+    char magic[4];          // "SCPB"
+    uint32_t version;       // The layout of the file
+    uint64_t identitySize;  // The size of the identity that follows the header, see ProgramCache::getIdentity
+    uint64_t size;          // The size of the binary that follows the identity
+    uint64_t checksum;      // The hash of the binary
+};
+
+/*!
+    * \brief Cache of built programs, so specialised variants of a kernel (built with -D per shape) are built only once.
+    * Programs are kept in memory for the lifetime of the cache, keyed by their identity: the hex hash of the source,
+    * the build options, the device name and the driver version, separated by null characters. Their binaries are
+    * also saved on disk, in a file named by the hash of the identity, with the identity stored after the header.
+    * A later run compares that identity byte for byte, creates the program from the binary and skips the compilation
+    * of the source. A binary that is missing, truncated or saved with another identity, such as one built by another
+    * driver, is ignored and replaced by a build from source. A cache that does not keep binaries only holds the
+    * programs in memory and never touches the disk.
+    */
+class ProgramCache
+{
+    private:
+        cl_context context;
+        std::string cacheDir;
+        bool keepBinaries;      // Load and save the binaries on disk
+        std::unordered_map<std::string, cl_program> programs;  // < identity, built program >
+
+        std::string getIdentity(const std::string &source, const std::string &options, cl_device_id device);
+        std::string getPath(const std::string &identity);
+        cl_program loadBinary(const std::string &identity, const std::string &options, cl_device_id device);
+        void saveBinary(const std::string &identity, cl_program program);
+
+    public:
+        ProgramCache(cl_context context, const std::string &cacheDir = "", bool keepBinaries = true);
+        ~ProgramCache();
+
+        cl_program getProgram(const std::string &source, const std::string &options, cl_device_id device);
+        cl_kernel createKernel(const std::string &source, const char *name, const std::string &options, cl_device_id device);
+        void printStats();
+
+        static std::string loadSource(const std::string &path);
+
+        unsigned int memoryHits;
+        unsigned int diskHits;
+        unsigned int builds;
+};
+
+#endif // PROGRAMCACHE_H
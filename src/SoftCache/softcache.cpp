@@ -23,6 +23,13 @@ Cache::Cache(int argc, char** argv)
     const std::string &cacheSizeString = input.getCmdOption("-c");
     const std::string &linesPerSetString = input.getCmdOption("-l");
     const std::string &writeBackString = input.getCmdOption("-w");
+    const bool lazyCoherence = input.cmdOptionExists("-lazy");
+    const std::string &flushQueuesString = input.getCmdOption("-fq");
+    const bool overlapTransfers = input.cmdOptionExists("-overlap");
+    const bool virtualBuffers = input.cmdOptionExists("-virtual");
+    const std::string &pipelineString = input.getCmdOption("-pipeline");    // Chunk size in MiB
+    const std::string &blockSizeString = input.getCmdOption("-b");          // Block size in KiB
+    const std::string &modeString = input.getCmdOption("-m");
 
     if (!orgString.empty() && !rpString.empty() && !cacheSizeString.empty()){
         cout << cacheSizeString << endl;
@@ -67,6 +74,20 @@ Cache::Cache(int argc, char** argv)
     }
 
     initialise(org, rp, cacheSize, linesPerSet, write_back);
+    if (modeString == "pass" || modeString == "pass_through") {
+        setMode(PASS_THROUGH);
+    } else if (modeString == "shadow") {
+        setMode(SHADOW);
+    } else if (!modeString.empty() && modeString != "active") {
+        cout << "Invalid cache mode" << endl;
+        exit(1);
+    }
+    if (lazyCoherence) setLazyCoherence(true);
+    if (!flushQueuesString.empty()) setFlushQueues(atoi(flushQueuesString.c_str()));
+    if (overlapTransfers) setTransferOverlap(true);
+    if (virtualBuffers) setVirtualBuffers(true);
+    if (!pipelineString.empty()) setPipelining((size_t) atoi(pipelineString.c_str()) * 1024 * 1024);
+    if (!blockSizeString.empty()) setBlockSize((size_t) atoi(blockSizeString.c_str()) * 1024);
 }
 
 /*! 
@@ -84,10 +105,15 @@ Cache::Cache(Organisation organisation, ReplacementPolicy replacementPolicy, int
 Cache::~Cache()
 {
     cout << "Cleaning up..." << endl;
+    dropEvictions();
+    setTransferOverlap(false);
+    for (auto& memo : this->memoTable) clearKernelLaunches(memo.second);
+
     // Free all openCL objects
     cl_int err = 0;
     for (int i = 0; i < this->nrOfLines; ++i)
     {
+        unfenceLine(i);
         if (this->lines[i].deviceAddress != NULL)
         {
             buffers--;
@@ -95,34 +121,66 @@ Cache::~Cache()
         }
         
     }
+    for (auto& parent : this->blockParents)
+    {
+        buffers--;
+        err |= clReleaseMemObject(parent.first);
+    }
+    this->blockParents.clear();
+    for (auto& proxy : this->virtualBuffers)
+    {
+        if (proxy.second->binding != NULL) err |= clReleaseMemObject(proxy.second->binding);
+        delete proxy.second;
+    }
+    this->virtualBuffers.clear();
 
     if (err != CL_SUCCESS) 
     {
         printf("Error: Failed to release memory objects! %d", err);
     }
 
+    for (auto& queue : this->transferQueues)
+    {
+        clReleaseCommandQueue(queue);
+    }
+
+#ifdef __unix__
+    if (lazyCoherenceCache == this)
+    {
+        sigaction(SIGSEGV, &previousFaultHandler, NULL);
+        stopFaultService();
+        lazyCoherenceCache = nullptr;
+    }
+#endif
+
     // Free allocated memory for cache lines
+    delete this->directory;
     delete[] this->lines;
 }
 
-#if CACHE_ENABLED
 /*! 
-    * \brief Create a buffer in the cache
+    * \brief Create a buffer in the cache. With virtual buffers the application gets a proxy,
+    * device memory is only allocated when a transfer or kernel argument needs it and a miss decides 
+    * the data needs a buffer of its own. A proxy is not an OpenCL buffer, it may only be passed back to
+    * the functions of the cache.
     * \param context The OpenCL context
     * \param flags The OpenCL flags
     * \param size The size of the buffer in bytes
     * \param host_ptr The host pointer
     * \param errcode_ret The error code
-    * \return The device pointer
+    * \return The device pointer, or the proxy with virtual buffers
     */
 cl_mem Cache::createBuffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *errcode_ret)
 {
-    cl_mem deviceAddress;
+    if (this->mode != ACTIVE) return passThroughCreateBuffer(context, flags, size, host_ptr, errcode_ret);
+
+    cl_mem deviceAddress = NULL;
     //START_TIMER
     if (flags & CL_MEM_COPY_HOST_PTR) 
     {
         this->duration.bytesTotal += size;
         this->duration.bytesh2d_total += size;
+        discardEvictions(host_ptr, size);
 
         CacheLine *cacheLine = getCacheLine(host_ptr);
 
@@ -130,8 +188,10 @@ cl_mem Cache::createBuffer(cl_context context, cl_mem_flags flags, size_t size,
         {
             this->duration.cacheMiss += 1;
             dout << "createBuffer: Cache miss" << endl;
+            unfenceRange(host_ptr, size);
             deviceAddress = clCreateBuffer(context, flags, size, host_ptr, errcode_ret);
-            addToCache(host_ptr, size, deviceAddress, BOTH);
+            const int idx = addToCache(host_ptr, size, deviceAddress, BOTH);
+            if (idx != -1) updateChunkHashes(idx);
         } 
         else 
         {
@@ -142,26 +202,149 @@ cl_mem Cache::createBuffer(cl_context context, cl_mem_flags flags, size_t size,
             this->lockedLines.push_back(idx);
             dout << "createBuffer: Cache hit on Line " << idx << endl;
             deviceAddress = cacheLine->deviceAddress;
+            clRetainMemObject(deviceAddress);     // The reference of the application
+            if (errcode_ret != NULL) *errcode_ret = CL_SUCCESS;
         }
     } 
-    else 
+    else if (!this->virtual_buffers)
     {
         deviceAddress = clCreateBuffer(context, flags, size, host_ptr, errcode_ret);
         buffers++;
     }
+    else if (errcode_ret != NULL)
+    {
+        *errcode_ret = CL_SUCCESS;
+    }
 
-    if (*errcode_ret != CL_SUCCESS || deviceAddress == nullptr)
+    const bool deferred = this->virtual_buffers && !(flags & CL_MEM_COPY_HOST_PTR);
+    if (!deferred && (*errcode_ret != CL_SUCCESS || deviceAddress == nullptr))
     {
         printf("Error: Failed to create buffer! %p -> %s\n", deviceAddress, getErrorString(*errcode_ret).c_str());
+        return deviceAddress;
     }
     //STOP_TIMER(this->duration.hostToDevice);
-    return deviceAddress;   
+    if (!this->virtual_buffers) return deviceAddress;
+
+    // A copy of host data is bound right away, the proxy takes over the reference of the application
+    VirtualBuffer *proxy = new VirtualBuffer;
+    proxy->context = context;
+    proxy->flags = flags & ~CL_MEM_COPY_HOST_PTR;
+    proxy->size = size;
+    proxy->host_ptr = (flags & CL_MEM_USE_HOST_PTR) ? host_ptr : NULL;
+    proxy->binding = deviceAddress;
+    proxy->references = 1;
+    this->virtualBuffers[(cl_mem) proxy] = proxy;
+    dout << "createBuffer: Proxy " << proxy << (deferred ? " without buffer" : " bound") << endl;
+    return (cl_mem) proxy;
+}
+
+cl_int Cache::retainMemObject(cl_mem memobj)
+{
+    VirtualBuffer *proxy = getVirtualBuffer(memobj);
+    if (proxy == nullptr) return clRetainMemObject(memobj);
+
+    proxy->references += 1;
+    return CL_SUCCESS;
+}
+
+/*! 
+    * \brief Release a buffer of createBuffer. A proxy releases its device buffer with its last reference,
+    * the cache keeps its own reference on buffers that are still cached.
+    * \param memobj The buffer or proxy
+    * \return The error code
+    */
+cl_int Cache::releaseMemObject(cl_mem memobj)
+{
+    VirtualBuffer *proxy = getVirtualBuffer(memobj);
+    if (proxy == nullptr) return clReleaseMemObject(memobj);
+
+    if (--proxy->references > 0) return CL_SUCCESS;
+
+    for (auto& kernel : this->kernelArguments)
+    {
+        for (auto& argument : kernel.second)
+        {
+            if (argument.proxy == memobj) argument.proxy = nullptr;
+        }
+    }
+    bindVirtualBuffer(proxy, nullptr);
+    this->virtualBuffers.erase(memobj);
+    delete proxy;
+    return CL_SUCCESS;
 }
 
 /*! 
-    * \brief Enqueue a write buffer command
+    * \brief Enqueue a write buffer command. A proxy is bound to the cached buffer on a hit,
+    * device memory is only allocated on a miss. The handle of a buffer that was not created 
+    * by the cache can't be replaced, a hit is copied into that buffer on the device.
     * \param command_queue The OpenCL command queue
-    * \param buffer The buffer
+    * \param buffer The proxy or buffer
+    * \param blocking_write Blocking write
+    * \param offset The offset
+    * \param cb The size of the buffer in bytes
+    * \param ptr The host pointer
+    * \param event_wait_list The event wait list
+    * \param event The event
+    * \return The error code
+    */
+cl_int Cache::enqueueWriteBuffer(
+    cl_command_queue command_queue, 
+    cl_mem buffer, cl_bool blocking_write, 
+    size_t offset, 
+    size_t cb, 
+    const void *ptr, 
+    cl_uint num_events_in_wait_list, 
+    const cl_event *event_wait_list, 
+    cl_event *event) 
+{
+    VirtualBuffer *proxy = getVirtualBuffer(buffer);
+    if (proxy == nullptr)
+    {
+        // On a hit the cache releases the buffer it is given, the extra reference keeps the buffer of the application
+        cl_mem target = buffer;
+        clRetainMemObject(buffer);
+        cl_int err = enqueueWriteBuffer(command_queue, &target, blocking_write, offset, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+        if (target == buffer)
+        {
+            clReleaseMemObject(buffer);
+            return err;
+        }
+
+        // The copy takes the place of the marker of the hit, so the event of the application covers it
+        forgetKernelLaunches(buffer);
+        std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+        appendLastWriter(waitList, target);
+        if (event != NULL) clReleaseEvent(*event);
+        err |= clEnqueueCopyBuffer(
+            command_queue, 
+            target, 
+            buffer, 
+            0, 
+            offset, 
+            cb, 
+            waitList.size(), 
+            waitList.empty() ? NULL : waitList.data(), 
+            event
+        );
+        if (blocking_write) clFinish(command_queue);
+        clReleaseMemObject(target);
+        return err;
+    }
+
+    if (this->mode == ACTIVE) bindForWrite(proxy, ptr, cb);
+    cl_mem target = getBinding(proxy);
+    cl_int err = enqueueWriteBuffer(command_queue, &target, blocking_write, offset, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+
+    // On a hit the cache released the binding and retained the cached buffer for the proxy
+    proxy->binding = target;
+    return err;
+}
+
+/*! 
+    * \brief Enqueue a write buffer command on a buffer handle the caller can replace, for callers 
+    * that keep their own handles such as an interposer
+    * \param command_queue The OpenCL command queue
+    * \param buffer The buffer, replaced by the cached buffer on a hit
     * \param blocking_write Blocking write
     * \param offset The offset
     * \param cb The size of the buffer in bytes
@@ -180,23 +363,57 @@ cl_int Cache::enqueueWriteBuffer(
     const cl_event *event_wait_list, 
     cl_event *event) 
 {
+    if (this->mode != ACTIVE) 
+    {
+        return passThroughWriteBuffer(command_queue, *buffer, blocking_write, offset, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+    }
+
     this->duration.bytesTotal += cb;
     this->duration.bytesh2d_total += cb;
 
     this->cache_command_queue = command_queue;
+    discardEvictions(ptr, cb);
+    if (isBlocked(offset, cb)) 
+    {
+        forgetKernelLaunches(*buffer);
+        return enqueueBlockWrite(command_queue, buffer, blocking_write, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+    }
     //START_TIMER
     CacheLine *cacheLine = getCacheLine(ptr);
+    int idx;
 
     if (cacheLine == nullptr)
     {
         this->duration.cacheMiss += 1;
         dout << "enqueueWriteBuffer: Cache miss" << endl;
-        addToCache(ptr, cb, *buffer, BOTH);
+        idx = addToCache(ptr, cb, *buffer, BOTH);
     } 
     else if (cacheLine->flag == CPU)
     {
         this->duration.cacheMiss += 1;
-        addToCache(ptr, cb, *buffer, BOTH, (cacheLine - this->lines));
+        idx = (cacheLine - this->lines);
+#if DELTA_UPLOAD
+        if (offset == 0 && cb == cacheLine->size && !this->chunkHashes[idx].empty())
+        {
+            // The device still holds the previous version of this data, 
+            // so we patch it in place and free the newly created buffer
+            if (cacheLine->deviceAddress != *buffer && *buffer != NULL)
+            {
+                buffers--;
+                clReleaseMemObject(*buffer);
+                *buffer = cacheLine->deviceAddress;
+                clRetainMemObject(*buffer);     // The reference of the application
+            }
+            this->lockedLines.push_back(idx);
+            setLineFlag(idx, BOTH);
+            stampLine(idx);
+            forgetKernelLaunches(*buffer);
+            dout << "enqueueWriteBuffer: Delta upload on Line " << idx << endl;
+            unfenceRange(ptr, cb);
+            return enqueueDeltaWrite(command_queue, idx, blocking_write, num_events_in_wait_list, event_wait_list, event);
+        }
+#endif
+        addToCache(ptr, cb, *buffer, BOTH, idx);
     }
     else 
     {
@@ -211,28 +428,85 @@ cl_int Cache::enqueueWriteBuffer(
             buffers--;
             clReleaseMemObject(*buffer);
             *buffer = cacheLine->deviceAddress;
+            clRetainMemObject(*buffer);     // The reference of the application
         }
 
         int idx = (cacheLine - this->lines);
         this->lockedLines.push_back(idx);
         dout << "enqueueWriteBuffer: Cache hit on Line " << idx << endl;
-        return CL_SUCCESS;  // No need to write the buffer so return CL_SUCCESS
+
+        // No need to write the buffer, the event completes once the data of the line is on the device
+        cl_int err = CL_SUCCESS;
+        if (event != NULL)
+        {
+            std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+            appendLastWriter(waitList, cacheLine->deviceAddress);
+            err = clEnqueueMarkerWithWaitList(command_queue, waitList.size(), waitList.empty() ? NULL : waitList.data(), event);
+        }
+        return err;
     }
     // On cache miss we have to write the buffer to the device
+    forgetKernelLaunches(*buffer);
+    unfenceRange(ptr, cb);
     cl_event myevent;
     cl_int err;
-    err = clEnqueueWriteBuffer(
-        command_queue, 
-        *buffer, 
-        blocking_write, 
-        offset, 
-        cb, 
-        ptr, 
-        num_events_in_wait_list, 
-        event_wait_list, 
-        &myevent
-    );
-    this->duration.hostToDevice += probe_event_time(myevent, command_queue);
+    if (this->overlap_transfers && idx != -1)
+    {
+        // Upload on the transfer queue, after the last kernel that used the buffer. 
+        // Kernels that need this data wait for the event of the upload.
+        std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+        auto kernel = this->lastKernel.find(*buffer);
+        if (kernel != this->lastKernel.end()) waitList.push_back(kernel->second);
+
+        if (this->pipelineChunkSize > 0 && cb > this->pipelineChunkSize && offset == 0)
+        {
+            err = enqueuePipelinedWrite(idx, blocking_write, waitList, event);
+            updateChunkHashes(idx);
+            return err;
+        }
+
+        cl_command_queue transfer_queue = getTransferQueue(0);
+        err = clEnqueueWriteBuffer(
+            transfer_queue, 
+            *buffer, 
+            blocking_write, 
+            offset, 
+            cb, 
+            ptr, 
+            waitList.size(), 
+            waitList.empty() ? NULL : waitList.data(), 
+            &myevent
+        );
+        clFlush(transfer_queue);
+        setLastWriter(idx, myevent);
+        if (event != NULL) 
+        {
+            clRetainEvent(myevent);
+            *event = myevent;
+        }
+        profileEvent(myevent, transfer_queue, this->duration.hostToDevice);
+    }
+    else 
+    {
+        err = clEnqueueWriteBuffer(
+            command_queue, 
+            *buffer, 
+            blocking_write, 
+            offset, 
+            cb, 
+            ptr, 
+            num_events_in_wait_list, 
+            event_wait_list, 
+            &myevent
+        );
+        if (event != NULL) 
+        {
+            clRetainEvent(myevent);
+            *event = myevent;
+        }
+        profileEvent(myevent, command_queue, this->duration.hostToDevice);
+    }
+    if (offset == 0 && idx != -1) updateChunkHashes(idx);
     //STOP_TIMER(this->duration.hostToDevice);
     return err;
 }
@@ -248,6 +522,14 @@ cl_int Cache::enqueueReadBuffer(
         cl_event *event
     )
 {
+    VirtualBuffer *proxy = getVirtualBuffer(buffer);
+    if (proxy != nullptr) buffer = getBinding(proxy);
+
+    if (this->mode != ACTIVE) 
+    {
+        return passThroughReadBuffer(command_queue, buffer, blocking_read, offset, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+    }
+
     this->lockedLines.clear();
     this->duration.bytesTotal += cb;
     this->duration.bytesSaved += cb; // Will subtract if transferred from device 
@@ -256,9 +538,40 @@ cl_int Cache::enqueueReadBuffer(
 
     //START_TIMER
     this->cache_command_queue = command_queue;
+    waitForEvictions(ptr, cb);
     cl_int err = CL_SUCCESS;
+
+    CacheLine *cacheLine = getCacheLine(ptr);
+    int idx = (cacheLine == nullptr) ? -1 : (cacheLine - this->lines);
+
+    if (isBlocked(offset, cb) && (cacheLine == nullptr || cacheLine->deviceAddress != buffer))
+    {
+        this->duration.bytesSaved -= cb;
+        this->duration.bytesd2h_saved -= cb;
+        return enqueueBlockRead(command_queue, buffer, blocking_read, cb, ptr, num_events_in_wait_list, event_wait_list, event);
+    }
+
+    if (!write_back 
+        && cacheLine != nullptr 
+        && cacheLine->deviceAddress == buffer 
+        && cacheLine->flag == BOTH 
+        && offset == 0 && cb == cacheLine->size)
+    {
+        // No kernel wrote this buffer since the last transfer, so the host already holds the data
+        this->duration.d2hHit += 1;
+        dout << "enqueueReadBuffer: Host copy is up to date on Line " << idx << endl;
+        this->lockedLines.clear();
+        return err;
+    }
+
     if (!write_back) 
     {
+        unfenceRange(ptr, cb);
+
+        // The buffer might still be uploading on a transfer queue
+        std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+        appendLastWriter(waitList, buffer);
+
         cl_event myevent;
         err = clEnqueueReadBuffer(
             command_queue, 
@@ -267,31 +580,28 @@ cl_int Cache::enqueueReadBuffer(
             offset, 
             cb, 
             ptr, 
-            num_events_in_wait_list, 
-            event_wait_list, 
+            waitList.size(), 
+            waitList.empty() ? NULL : waitList.data(), 
             &myevent
         );
-        this->duration.deviceToHost += probe_event_time(myevent, command_queue);
+        profileEvent(myevent, command_queue, this->duration.deviceToHost);
         this->duration.bytesSaved -= cb;
         this->duration.bytesd2h_saved -= cb;
 
     }    
 
-    CacheLine *cacheLine = getCacheLine(ptr);
-    if (cacheLine == nullptr) 
+    if (cacheLine == nullptr || buffer != cacheLine->deviceAddress) 
     {
+        // The buffer that was read holds the most recent data, so it replaces whatever the line had
         dout << "enqueueReadBuffer: Cache miss" << endl;
-        addToCache(ptr, cb, buffer, (!write_back && write_through) ? BOTH : GPU);
+        idx = addToCache(ptr, cb, buffer, write_back ? GPU : BOTH, idx);
         //STOP_TIMER(this->duration.deviceToHost);
     } 
-    else if (buffer != cacheLine->deviceAddress) 
+    else if (!write_back)
     {
-        // Cache hit, but we do have to remove the newly created buffer
-        // otherwise it'll never be freed
-        buffers--;
-        clReleaseMemObject(buffer);
-        //STOP_TIMER(this->duration.deviceToHost);
+        setLineFlag(idx, BOTH);
     }
+    if (!write_back && blocking_read && offset == 0) updateChunkHashes(idx);
     
     // Clear locked lines again...
     this->lockedLines.clear();
@@ -299,29 +609,31 @@ cl_int Cache::enqueueReadBuffer(
     return err;
 }
 
-#else
-
-cl_mem Cache::createBuffer(
-    cl_context context, 
-    cl_mem_flags flags, 
-    size_t size, 
-    void *host_ptr, 
-    cl_int *errcode_ret) 
+/*! 
+    * \brief Create a buffer without caching it. In shadow mode a copy of host data is accounted 
+    * as a write of the simulated cache.
+    */
+cl_mem Cache::passThroughCreateBuffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *errcode_ret)
 {
-    //START_TIMER
+    cl_mem deviceAddress = clCreateBuffer(context, flags, size, host_ptr, errcode_ret);
     if (flags & CL_MEM_COPY_HOST_PTR) 
     {
-        this->duration.cacheMiss += 1;
         this->duration.bytesTotal += size;
+        this->duration.bytesh2d_total += size;
+        if (this->mode == SHADOW) 
+            shadowTransfer(host_ptr, size, deviceAddress, true);
+        else
+            this->duration.cacheMiss += 1;
     }
-    cl_mem deviceAddress = clCreateBuffer(context, flags, size, host_ptr, errcode_ret);
-    //STOP_TIMER(this->duration.hostToDevice)
     return deviceAddress;
 }
 
-cl_int Cache::enqueueWriteBuffer(
+/*! 
+    * \brief Write a buffer without caching it. In shadow mode the simulated cache accounts whether it would have hit.
+    */
+cl_int Cache::passThroughWriteBuffer(
     cl_command_queue command_queue, 
-    cl_mem *buffer, cl_bool blocking_write, 
+    cl_mem buffer, cl_bool blocking_write, 
     size_t offset, 
     size_t cb, 
     const void *ptr, 
@@ -329,13 +641,17 @@ cl_int Cache::enqueueWriteBuffer(
     const cl_event *event_wait_list, 
     cl_event *event) 
 {
-    this->duration.cacheMiss += 1;
     this->duration.bytesTotal += cb;
-    //START_TIMER
+    this->duration.bytesh2d_total += cb;
+    if (this->mode == SHADOW && offset == 0) 
+        shadowTransfer(ptr, cb, buffer, true);
+    else
+        this->duration.cacheMiss += 1;
+
     cl_event myevent;
     cl_int err = clEnqueueWriteBuffer(
         command_queue, 
-        *buffer, 
+        buffer, 
         blocking_write, 
         offset, 
         cb, 
@@ -344,25 +660,33 @@ cl_int Cache::enqueueWriteBuffer(
         event_wait_list, 
         &myevent
     );
+    if (event != NULL) 
+    {
+        clRetainEvent(myevent);
+        *event = myevent;
+    }
     this->duration.hostToDevice += probe_event_time(myevent, command_queue);
-    //STOP_TIMER(this->duration.hostToDevice)
+    clReleaseEvent(myevent);
     return err;
 }
 
-cl_int Cache::enqueueReadBuffer(
-        cl_command_queue command_queue,
-        cl_mem buffer, cl_bool blocking_read,
-        size_t offset,
-        size_t cb,
-        void *ptr,
-        cl_uint num_events_in_wait_list,
-        const cl_event *event_wait_list,
-        cl_event *event,
-        bool write_through
-    )
+/*! 
+    * \brief Read a buffer without caching it. In shadow mode the simulated cache accounts whether it would have hit.
+    */
+cl_int Cache::passThroughReadBuffer(
+    cl_command_queue command_queue,
+    cl_mem buffer, cl_bool blocking_read,
+    size_t offset,
+    size_t cb,
+    void *ptr,
+    cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list,
+    cl_event *event)
 {
     this->duration.bytesTotal += cb;
-    //START_TIMER
+    this->duration.bytesd2h_total += cb;
+    if (this->mode == SHADOW && offset == 0) shadowTransfer(ptr, cb, buffer, false);
+
     cl_event myevent;
     cl_int err = clEnqueueReadBuffer(
         command_queue, 
@@ -375,18 +699,162 @@ cl_int Cache::enqueueReadBuffer(
         event_wait_list, 
         &myevent
     );
+    if (event != NULL) 
+    {
+        clRetainEvent(myevent);
+        *event = myevent;
+    }
     this->duration.deviceToHost += probe_event_time(myevent, command_queue);
-    //STOP_TIMER(this->duration.deviceToHost)
+    clReleaseEvent(myevent);
     return err;
 }
-#endif
 
+/*! 
+    * \brief Account a transfer on the simulated cache of shadow mode, the same way an active cache would 
+    * serve it. The lines only hold metadata, kernels that write an application buffer still mark its line as GPU.
+    * Reads are simulated as write-through reads, with write back they count as deferred.
+    * \param ptr The host pointer
+    * \param cb The size of the transfer
+    * \param buffer The application buffer
+    * \param toDevice The direction of the transfer
+    * \return The index of the line that holds the buffer, -1 when the cache did not take it
+    */
+int Cache::shadowTransfer(const void *ptr, size_t cb, cl_mem buffer, bool toDevice)
+{
+    CacheLine *cacheLine = getCacheLine(ptr);
+    int idx = (cacheLine == nullptr) ? -1 : (cacheLine - this->lines);
+
+    if (toDevice)
+    {
+        if (cacheLine != nullptr && cacheLine->flag != CPU && cacheLine->size == cb)
+        {
+            this->duration.cacheHit += 1;
+            this->duration.bytesSaved += cb;
+            this->duration.bytesh2d_saved += cb;
+            this->lockedLines.push_back(idx);
+        }
+        else 
+        {
+            this->duration.cacheMiss += 1;
+            idx = addToCache(ptr, cb, nullptr, BOTH, idx);
+        }
+        if (idx != -1) setShadowBuffer(idx, buffer);
+        return idx;
+    }
+
+    this->lockedLines.clear();
+    if (write_back || (cacheLine != nullptr && cacheLine->flag == BOTH && this->shadowBuffers[idx] == buffer && cacheLine->size == cb))
+    {
+        if (!write_back) this->duration.d2hHit += 1;
+        this->duration.bytesSaved += cb;
+        this->duration.bytesd2h_saved += cb;
+    }
+
+    if (cacheLine == nullptr || this->shadowBuffers[idx] != buffer)
+    {
+        idx = addToCache(ptr, cb, nullptr, write_back ? GPU : BOTH, idx);
+        if (idx != -1) setShadowBuffer(idx, buffer);
+    }
+    else if (!write_back)
+    {
+        setLineFlag(idx, BOTH);
+    }
+    this->lockedLines.clear();
+    return idx;
+}
+
+/*!
+    * \brief Account a transfer on the simulated cache of shadow mode without enqueueing it, for tools that
+    * replay accesses. The transfer ends its command, the line it used is not kept locked.
+    * \param ptr The host pointer
+    * \param cb The size of the transfer
+    * \param buffer The application buffer, it is never dereferenced
+    * \param toDevice The direction of the transfer
+    * \return The index of the line that holds the buffer, -1 when the cache did not take it or is not in shadow mode
+    */
+int Cache::simulateTransfer(const void *ptr, size_t cb, cl_mem buffer, bool toDevice)
+{
+    if (this->mode != SHADOW) return -1;
+
+    const int idx = shadowTransfer(ptr, cb, buffer, toDevice);
+    this->lockedLines.clear();
+    return idx;
+}
+
+/*!
+    * \brief Let a simulated line stand for an application buffer, so kernels that write the buffer mark the line
+    * \param idx The index of the cache line
+    * \param buffer The application buffer
+    */
+void Cache::setShadowBuffer(int idx, cl_mem buffer)
+{
+    auto line = this->deviceLines.find(this->shadowBuffers[idx]);
+    if (line != this->deviceLines.end() && line->second == idx) this->deviceLines.erase(line);
+
+    this->shadowBuffers[idx] = buffer;
+    if (buffer != NULL) this->deviceLines[buffer] = idx;
+}
+
+
+/*! 
+    * \brief Set a kernel argument. Buffers the kernel can write are remembered,
+    * so they can be marked dirty after the kernel has been executed.
+    * \param kernel The OpenCL kernel
+    * \param index The argument index
+    * \param size The size of the argument value
+    * \param value Pointer to the argument value
+    * \return The error code
+    */
 cl_int Cache::setKernelArg(cl_kernel kernel, cl_uint index, size_t size, const void * value)
 {
-    kernelArguments[kernel].insert(value);
+    std::vector<KernelArgument> &arguments = getKernelArguments(kernel);
+    if (index < arguments.size())
+    {
+        KernelArgument &argument = arguments[index];
+        argument.buffer = nullptr;
+        argument.proxy = nullptr;
+        argument.written = false;
+        argument.size = size;
+        argument.value.clear();
+
+        if (!argument.scalar && size == sizeof(cl_mem) && value != nullptr)
+        {
+            VirtualBuffer *proxy = getVirtualBuffer(*(const cl_mem *) value);
+            if (proxy != nullptr)
+            {
+                // The kernel needs device memory now, an unbound proxy gets a buffer of its own
+                argument.proxy = (cl_mem) proxy;
+                setArgumentBuffer(argument, getBinding(proxy));
+                return clSetKernelArg(kernel, index, size, &argument.buffer);
+            }
+            setArgumentBuffer(argument, *(const cl_mem *) value);
+        }
+        else if (value != nullptr)
+        {
+            argument.value.assign((const unsigned char *) value, (const unsigned char *) value + size);
+        }
+    }
     return clSetKernelArg(kernel, index, size, value); 
 }
 
+/*!
+    * \brief Bind a buffer to a kernel argument and derive whether the kernel writes it
+    * \param argument The argument
+    * \param buffer The buffer
+    */
+void Cache::setArgumentBuffer(KernelArgument &argument, cl_mem buffer)
+{
+    argument.buffer = buffer;
+    cl_mem_flags flags = 0;
+
+    // Without argument info the value could also be a scalar of the same size as a cl_mem,
+    // so only ask for the buffer flags when the argument is known to be a __global pointer
+    argument.written = argument.writable 
+        && (!argument.global 
+            || clGetMemObjectInfo(argument.buffer, CL_MEM_FLAGS, sizeof(flags), &flags, NULL) != CL_SUCCESS 
+            || !(flags & CL_MEM_READ_ONLY));
+}
+
 cl_int Cache::enqueueNDRangeKernel(
     cl_command_queue command_queue,
     cl_kernel kernel,
@@ -400,245 +868,2229 @@ cl_int Cache::enqueueNDRangeKernel(
 {
     this->lockedLines.clear();
 
-    cl_event myevent;
-    cl_int err = clEnqueueNDRangeKernel(
-        command_queue, 
-        kernel, 
-        work_dim, 
-        global_work_offset, 
-        global_work_size, 
-        local_work_size, 
-        num_events_in_wait_list, 
-        event_wait_list, 
+    auto memo = this->memoTable.find(kernel);
+    KernelLaunch launch;
+    bindProxyArguments(kernel);
+    const bool memoisable = memo != this->memoTable.end() && this->mode == ACTIVE 
+                            && getKernelLaunch(kernel, work_dim, global_work_offset, global_work_size, local_work_size, launch);
+    if (memoisable)
+    {
+        for (auto& previous : memo->second)
+        {
+            if (previous.signature != launch.signature || previous.versions != launch.versions) continue;
+
+            // The same inputs, the buffers the earlier launch wrote still hold its results
+            this->duration.kernelsElided += 1;
+            dout << "enqueueNDRangeKernel: Elided launch of kernel " << kernel << endl;
+            return replayKernelLaunch(command_queue, previous, launch, num_events_in_wait_list, event_wait_list, event);
+        }
+    }
+
+    cl_int err = launchKernel(command_queue, kernel, work_dim, global_work_offset, global_work_size, local_work_size, 
+                              num_events_in_wait_list, event_wait_list, event, nullptr);
+
+    if (memoisable && err == CL_SUCCESS)
+    {
+        // The launch wrote its outputs, so launchKernel already forgot the launches that wrote them earlier.
+        // The memo keeps a reference on the outputs, they hold the results until they are written again.
+        std::vector<KernelLaunch> &launches = memo->second;
+        if (launches.size() >= MEMO_ENTRIES) 
+        {
+            for (auto output : launches.front().outputs) clReleaseMemObject(output);
+            launches.erase(launches.begin());
+        }
+        for (auto output : launch.outputs) clRetainMemObject(output);
+        launches.push_back(launch);
+    }
+    return err;
+}
+
+/*!
+    * \brief Enable or disable memoisation of a kernel. A launch of a memoised kernel is skipped when 
+    * it equals one of the last MEMO_ENTRIES launches: the same data in the buffers it reads, the same sizes 
+    * of the buffers it writes, other argument bytes and NDRange. The results of the earlier launch are copied 
+    * into the buffers the launch writes, the memo keeps them until they are written again.
+    * Only for kernels whose results depend on nothing but their inputs: a kernel that reads a buffer it writes
+    * must not be memoised. Every buffer the kernel reads has to be held by a cache line and every argument 
+    * has to be set through the cache, other launches are never skipped.
+    * \param kernel The OpenCL kernel
+    * \param enable Enable memoisation
+    */
+void Cache::setMemoisation(cl_kernel kernel, bool enable)
+{
+    if (enable) 
+    {
+        this->memoTable[kernel];
+        return;
+    }
+
+    auto memo = this->memoTable.find(kernel);
+    if (memo == this->memoTable.end()) return;
+    clearKernelLaunches(memo->second);
+    this->memoTable.erase(memo);
+}
+
+/*! 
+    * \brief Enqueue a kernel in sub-ranges that follow the chunks of a pipelined upload. 
+    * The slowest varying dimension (work_dim - 1) is split and every sub-range only waits for the 
+    * chunks of the streamed buffer it covers, so it can start while later chunks are still uploading.
+    * The kernel has to use get_global_id, as the sub-ranges are launched with a global offset.
+    * \param streamed_ptr The host pointer of the pipelined buffer
+    * \param bytes_per_item The number of bytes of the streamed buffer one index of the split dimension needs
+    * \return The error code
+    */
+cl_int Cache::enqueueNDRangeKernelPipelined(
+    cl_command_queue command_queue,
+    cl_kernel kernel,
+    cl_uint work_dim,
+    const size_t *global_work_offset,
+    const size_t *global_work_size,
+    const size_t *local_work_size,
+    const void *streamed_ptr,
+    size_t bytes_per_item,
+    cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list,
+    cl_event *event)
+{
+    this->lockedLines.clear();
+
+    CacheLine *cacheLine = getCacheLine(streamed_ptr);
+    const int idx = (cacheLine == nullptr) ? -1 : (cacheLine - this->lines);
+    if (idx == -1 || this->chunkEvents[idx].empty() || bytes_per_item == 0 || work_dim == 0)
+    {
+        return launchKernel(command_queue, kernel, work_dim, global_work_offset, global_work_size, local_work_size, 
+                            num_events_in_wait_list, event_wait_list, event, nullptr);
+    }
+
+    // Sub-ranges of whole chunks, rounded down to a multiple of the work-group size
+    const cl_uint dim = work_dim - 1;
+    const size_t local = (local_work_size != NULL) ? local_work_size[dim] : 1;
+    size_t itemsPerChunk = this->pipelineChunkSize / bytes_per_item;
+    itemsPerChunk = max(local, itemsPerChunk - itemsPerChunk % local);
+
+    std::vector<size_t> offset(work_dim, 0);
+    std::vector<size_t> size(global_work_size, global_work_size + work_dim);
+    if (global_work_offset != NULL) offset.assign(global_work_offset, global_work_offset + work_dim);
+    const size_t firstItem = offset[dim];
+
+    // Copy, launching a kernel can release the chunk events of the line
+    const std::vector<cl_event> chunks = this->chunkEvents[idx];
+    for (auto& chunkEvent : chunks) clRetainEvent(chunkEvent);
+
+    cl_int err = CL_SUCCESS;
+    for (size_t start = 0; start < global_work_size[dim]; start += itemsPerChunk)
+    {
+        size[dim] = min(itemsPerChunk, global_work_size[dim] - start);
+        offset[dim] = firstItem + start;
+
+        // The chunks holding the bytes of this sub-range
+        const size_t firstChunk = offset[dim] * bytes_per_item / this->pipelineChunkSize;
+        const size_t lastChunk = ((offset[dim] + size[dim]) * bytes_per_item - 1) / this->pipelineChunkSize;
+        std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+        for (size_t chunk = firstChunk; chunk <= lastChunk && chunk < chunks.size(); ++chunk) 
+        {
+            waitList.push_back(chunks[chunk]);
+        }
+
+        const bool last = start + itemsPerChunk >= global_work_size[dim];
+        err |= launchKernel(command_queue, kernel, work_dim, offset.data(), size.data(), local_work_size, 
+                            waitList.size(), waitList.empty() ? NULL : waitList.data(), last ? event : NULL, 
+                            cacheLine->deviceAddress);
+    }
+
+    for (auto& chunkEvent : chunks) clReleaseEvent(chunkEvent);
+    return err;
+}
+
+/*! 
+    * \brief Enqueue a kernel after the uploads of its arguments and mark the buffers it writes as dirty
+    * \param streamed_buffer A buffer whose upload is not waited for, the caller already did that. Can be nullptr
+    * \return The error code
+    */
+cl_int Cache::launchKernel(
+    cl_command_queue command_queue,
+    cl_kernel kernel,
+    cl_uint work_dim,
+    const size_t *global_work_offset,
+    const size_t *global_work_size,
+    const size_t *local_work_size,
+    cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list,
+    cl_event *event,
+    cl_mem streamed_buffer)
+{
+    collectProfiles(false);
+
+    // Only wait for the uploads of the buffers this kernel uses
+    std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+    bindProxyArguments(kernel);
+    auto arguments = this->kernelArguments.find(kernel);
+    if (arguments != this->kernelArguments.end()) 
+    {
+        for (auto& argument : arguments->second) 
+        {
+            if (argument.buffer != nullptr && argument.buffer != streamed_buffer) appendLastWriter(waitList, argument.buffer);
+        }
+    }
+
+    cl_event myevent;
+    cl_int err = clEnqueueNDRangeKernel(
+        command_queue, 
+        kernel, 
+        work_dim, 
+        global_work_offset, 
+        global_work_size, 
+        local_work_size, 
+        waitList.size(), 
+        waitList.empty() ? NULL : waitList.data(), 
         &myevent
     );   
-    this->duration.kernel += probe_event_time(myevent, command_queue);
+    if (this->overlap_transfers) clFlush(command_queue);
 
-    auto& argumentsVector = kernelArguments[kernel];
-    if (!argumentsVector.empty()) {
-        // std::cout << "nr of args: " << argumentsVector.size() << endl;
-        for (auto& argument : argumentsVector) 
+    if (arguments != this->kernelArguments.end()) 
+    {
+        for (auto& argument : arguments->second) 
         {
-            setDirtyFlag(argument, GPU);
+            if (argument.buffer == nullptr) continue;
+
+            if (this->overlap_transfers)
+            {
+                // Uploads to this buffer have to wait until the kernel is done with it
+                clRetainEvent(myevent);
+                auto kernelEvent = this->lastKernel.find(argument.buffer);
+                if (kernelEvent != this->lastKernel.end()) 
+                {
+                    clReleaseEvent(kernelEvent->second);
+                    kernelEvent->second = myevent;
+                }
+                else 
+                {
+                    this->lastKernel[argument.buffer] = myevent;
+                }
+            }
+
+            if (!argument.written) continue;
+
+            forgetKernelLaunches(argument.buffer);
+            auto line = this->deviceLines.find(argument.buffer);
+            if (line != this->deviceLines.end()) 
+            {
+                setLineFlag(line->second, GPU);
+                setLastWriter(line->second, myevent);
+                stampLine(line->second);
+            }
+            else if (this->blockSize > 0)
+            {
+                markBlocks(argument.buffer, myevent);
+            }
         }
     }
 
+    // The caller owns its own reference, in both modes
+    if (event != NULL)
+    {
+        clRetainEvent(myevent);
+        *event = myevent;
+    }
+    profileEvent(myevent, command_queue, this->duration.kernel);
+
     return err;
 }
 
 cl_int Cache::writeBack()
 {
     cl_int err = CL_SUCCESS;
-#if CACHE_ENABLED
-    if (this->write_back == false) return err;
+    if (this->write_back == false || this->mode != ACTIVE) return err;
     
+    settleEvictions();
+    std::vector<int> dirtyLines;
     for (int i = 0; i < this->nrOfLines; ++i) 
     {
         if (this->lines[i].flag == GPU) 
         {
-            cl_event myevent;
-            err |= clEnqueueReadBuffer(
-                this->cache_command_queue, 
-                this->lines[i].deviceAddress, 
-                CL_TRUE, 
-                0, 
-                this->lines[i].size, 
-                this->lines[i].tag, 
-                0, 
-                NULL, 
-                &myevent
-            );
-            this->duration.deviceToHost += probe_event_time(myevent, this->cache_command_queue);
-            this->lines[i].flag = BOTH;
-            this->duration.bytesSaved -= this->lines[i].size;
-            this->duration.bytesd2h_saved -= this->lines[i].size;
+            dirtyLines.push_back(i);
         }
     }
-#endif
+    err = flushLines(dirtyLines);
+    return err;
+}
+
+/*!
+    * \brief Write a set of buffers back to the host in one batch
+    * \param host_ptrs The host pointers of the buffers
+    * \param count The number of host pointers
+    * \return The error code
+    */
+cl_int Cache::writeBack(void * const *host_ptrs, size_t count)
+{
+    cl_int err = CL_SUCCESS;
+    if (this->write_back == false || this->mode != ACTIVE) return err;
+
+    std::vector<int> dirtyLines;
+    for (size_t i = 0; i < count; ++i) 
+    {
+        CacheLine *cacheLine = getCacheLine(host_ptrs[i]);
+        waitForEvictions(host_ptrs[i], cacheLine != nullptr ? cacheLine->size : 1);
+        if (cacheLine != nullptr && cacheLine->flag == GPU 
+            && find(dirtyLines.begin(), dirtyLines.end(), cacheLine - this->lines) == dirtyLines.end()) 
+        {
+            dirtyLines.push_back(cacheLine - this->lines);
+        }
+    }
+    err = flushLines(dirtyLines);
     return err;
 }
 
 cl_int Cache::writeBack(void *host_ptr) 
 {
     cl_int err = CL_SUCCESS;
-#if CACHE_ENABLED
-    if (this->write_back == false) return err;
+    if (this->write_back == false || this->mode != ACTIVE) return err;
 
-    
     CacheLine *cacheLine = getCacheLine(host_ptr);
-    if (cacheLine != nullptr && cacheLine->flag == GPU) 
+    waitForEvictions(host_ptr, cacheLine != nullptr ? cacheLine->size : 1);
+    if (cacheLine != nullptr && cacheLine->parent != NULL)
     {
-        cl_event myevent;
-        err |= clEnqueueReadBuffer(
-            this->cache_command_queue, 
-            cacheLine->deviceAddress, 
-            CL_TRUE, 
-            0, 
-            cacheLine->size, 
-            cacheLine->tag, 
-            0, 
-            NULL, 
-            &myevent
-        );
-        this->duration.deviceToHost += probe_event_time(myevent, this->cache_command_queue);
-        cacheLine->flag = BOTH;
-        this->duration.bytesSaved -= cacheLine->size;
-        this->duration.bytesd2h_saved -= cacheLine->size;
+        // A block, write back all blocks of the same buffer
+        settleEvictions();
+        std::vector<int> dirtyLines;
+        for (int i = 0; i < this->nrOfLines; ++i) 
+        {
+            if (this->lines[i].parent == cacheLine->parent && this->lines[i].flag == GPU) dirtyLines.push_back(i);
+        }
+        err = flushLines(dirtyLines);
+    }
+    else if (cacheLine != nullptr && cacheLine->flag == GPU) 
+    {
+        err |= readBackLine(cacheLine - this->lines);
+    }
+    return err;
+}
+
+/*!
+    * \brief Set the number of transfer queues a flush is spread over
+    * \param count The number of queues, at least 1
+    */
+void Cache::setFlushQueues(unsigned int count)
+{
+    this->nrOfFlushQueues = max(count, 1u);
+}
+
+/*!
+    * \brief Switch the mode of the cache. Dirty lines are written back and the cache is cleared first,
+    * the lines of one mode mean nothing in another.
+    * \param mode ACTIVE, PASS_THROUGH or SHADOW
+    */
+void Cache::setMode(CacheMode mode)
+{
+    if (mode == this->mode) return;
+
+    writeBack();
+    setLazyCoherence(false);
+    resetCache();
+    this->mode = mode;
+
+    const string modeString[3] = {"ACTIVE", "PASS_THROUGH", "SHADOW"};
+    printf("%-30s %s\n", "Cache mode:", modeString[this->mode].c_str());
+}
+
+CacheMode Cache::getMode()
+{
+    return this->mode;
+}
+
+/*!
+    * \brief Enable or disable write back. Dirty lines are written back first and the directory is created again,
+    * whether evicted lines are written back is part of its type.
+    * \param enable Enable write back
+    */
+void Cache::setWriteBack(bool enable)
+{
+    if (enable == this->write_back) return;
+
+    writeBack();
+    delete this->directory;
+    this->directory = createCacheDirectory(this->organisation, this->replacementPolicy, this->lines, this->nrOfSets, this->nrOfLinesPerSet, enable);
+    this->write_back = enable;
+    printf("%-30s %s\n", "Write back:", this->write_back ? "true" : "false");
+}
+
+bool Cache::getWriteBack()
+{
+    return this->write_back;
+}
+
+/*!
+    * \brief Enable or disable lazy coherence. When enabled (and write back is enabled) the host 
+    * pages of GPU-dirty lines are made inaccessible, the first host access reads the line back.
+    * Only lines whose host range starts on a page boundary and spans whole pages can be covered,
+    * a page shared with other data would fault on accesses to that data as well. The other lines 
+    * are not fenced and follow the usual write back rules, the host has to call writeBack before 
+    * it reads them. The profile counts every GPU-dirty line that could not be fenced as unfenced.
+    * Only one cache at a time can use lazy coherence.
+    * \param enable Enable lazy coherence
+    * \return The number of GPU-dirty lines lazy coherence could not fence when it was enabled
+    */
+int Cache::setLazyCoherence(bool enable)
+{
+    int unfenced = 0;
+#ifdef __unix__
+    if (enable && !this->lazy_coherence)
+    {
+        if (this->mode != ACTIVE)
+        {
+            printf("Error: Lazy coherence needs an active cache\n");
+            return unfenced;
+        }
+
+        if (lazyCoherenceCache != nullptr && lazyCoherenceCache != this)
+        {
+            printf("Error: Lazy coherence is already enabled on another cache\n");
+            return unfenced;
+        }
+
+        if (!startFaultService())
+        {
+            printf("Error: Failed to start the fault service of lazy coherence\n");
+            return unfenced;
+        }
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = handleFault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previousFaultHandler);
+        lazyCoherenceCache = this;
+        this->lazy_coherence = true;
+
+        for (int i = 0; i < this->nrOfLines; ++i)
+        {
+            if (this->write_back && this->lines[i].flag == GPU && !fenceLine(i)) unfenced += 1;
+        }
+    }
+    else if (!enable && this->lazy_coherence)
+    {
+        settleEvictions();
+        for (int i = 0; i < this->nrOfLines; ++i)
+        {
+            if (this->lines[i].fenced) readBackLine(i);
+        }
+
+        sigaction(SIGSEGV, &previousFaultHandler, NULL);
+        stopFaultService();
+        lazyCoherenceCache = nullptr;
+        this->lazy_coherence = false;
+    }
+#else
+    if (enable) printf("Lazy coherence is not supported on this platform\n");
+#endif
+    return unfenced;
+}
+
+void Cache::setDirtyFlag(const void *ptr, Flag flag)
+{
+    CacheLine *cacheLine = getCacheLine(ptr);
+    if (cacheLine != nullptr)
+    {
+        setLineFlag(cacheLine - this->lines, flag);
+    }
+}
+
+/*!
+    * \brief Set the flag of every line that overlaps a host range, 
+    * with block granular caching only the blocks of the range are affected
+    * \param ptr The start of the host range
+    * \param size The size of the range in bytes
+    * \param flag The new flag
+    */
+void Cache::setDirtyRange(const void *ptr, size_t size, Flag flag)
+{
+    // The host data of the range is newer than what evicted lines still hold for it
+    if (flag == CPU) discardEvictions(ptr, size);
+
+    const uintptr_t start = (uintptr_t) ptr;
+    for (int i = 0; i < this->nrOfLines; ++i)
+    {
+        const uintptr_t tag = (uintptr_t) this->lines[i].tag;
+        if (this->lines[i].tag != nullptr && tag < start + size && start < tag + this->lines[i].size)
+        {
+            setLineFlag(i, flag);
+        }
     }
+}
+
+/*!
+    * \brief Get the number of lines of the cache, which is the number of buffers it can hold
+    * \return The number of lines
+    */
+int Cache::getNrOfLines()
+{
+    return this->nrOfLines;
+}
+
+/*!
+    * \brief Get a line of the cache, to look at what it holds without changing it
+    * \param idx The index of the cache line, below getNrOfLines
+    * \return The cache line
+    */
+const CacheLine& Cache::getLine(int idx)
+{
+    return this->lines[idx];
+}
+
+/*!
+    * \brief Get the version of the device data of a buffer, it changes whenever the device data changes.
+    * For a buffer that is cached as blocks this is the newest version of its blocks.
+    * \param ptr The host pointer of the buffer
+    * \param size The size of the buffer in bytes
+    * \return The version, 0 if the buffer is not (completely) cached
+    */
+unsigned long long Cache::getVersion(const void *ptr, size_t size)
+{
+    if (!isBlocked(0, size))
+    {
+        CacheLine *cacheLine = getCacheLine(ptr);
+        return (cacheLine != nullptr && cacheLine->size == size) ? cacheLine->version : 0;
+    }
+
+    unsigned long long version = 0;
+    for (size_t offset = 0; offset < size; offset += this->blockSize)
+    {
+        CacheLine *cacheLine = getCacheLine((const unsigned char *) ptr + offset);
+        if (cacheLine == nullptr || cacheLine->parent == NULL) return 0;
+        version = max(version, cacheLine->version);
+    }
+    return version;
+}
+
+void Cache::printCache()
+{
+    const string flags[] = {"CPU", "GPU", "BOTH"};
+
+    printf("=============================================================================================\n");
+    for (int i = 0; i < this->nrOfLines; ++i) 
+    {
+        if (this->organisation == SET_ASSOCIATIVE && i % this->nrOfLinesPerSet == 0) 
+            printf("---------------------------------------------------------------------------------------------\n");
+
+        printf("Line %-6d", i);
+        printf("Flag: %-6s", flags[this->lines[i].flag].c_str());
+        printf("Age: %-6d", this->lines[i].age);
+        printf("Tag: %-18p", this->lines[i].tag);
+        printf("Size: %-10lu", this->lines[i].size);
+        printf("Device addr: %-18p", this->lines[i].deviceAddress);
+        printf("\n");
+    }
+    const string organisationString[3] = {"DIRECT_MAPPING", "SET_ASSOCIATIVE", "FULLY_ASSOCIATIVE"};
+    const string replacementPolicyString[4] = {"LRU", "FIFO", "RANDOM", "SMALLEST"};
+    printf("%-30s %s\n", "Cache organisation:", organisationString[this->organisation].c_str());
+    printf("%-30s %s\n", "Cache replacement policy:", replacementPolicyString[this->replacementPolicy].c_str());
+    printf("%-30s %d\n", "Cache number of sets:", this->nrOfSets);
+    printf("%-30s %d\n", "Cache number of lines:", this->nrOfLines);
+    printf("=============================================================================================\n\n");
+}
+
+void Cache::printTimeProfile()
+{
+    collectProfiles(true);
+    printf("=========================================\n");
+    printf("%-20s Time (ms)\n", "Action");
+    printf("-----------------------------------------\n");
+    printf("%-20s %llu\n", "Host to device", this->duration.hostToDevice / 1000);
+    printf("%-20s %llu\n", "Device to host", this->duration.deviceToHost / 1000);
+    printf("%-20s %llu\n", "Total on transfers", (this->duration.hostToDevice + this->duration.deviceToHost) / 1000);
+    printf("%-20s %llu\n", "Kernel execution", this->duration.kernel / 1000);
+    printf("%-20s %llu\n", "Total time ", (this->duration.hostToDevice + this->duration.deviceToHost + this->duration.kernel) / 1000);
+    printf("-----------------------------------------\n");
+    printf("%-20s %u\n", "Cache hits", this->duration.cacheHit);
+    printf("%-20s %u\n", "Cache misses", this->duration.cacheMiss);
+    printf("%-20s %.2f%%\n", "Hit ratio", (float) this->duration.cacheHit / (float)(this->duration.cacheHit + this->duration.cacheMiss) * 100);    
+    printf("%-20s %u\n", "D2H hits", this->duration.d2hHit);
+    printf("%-20s %u\n", "Kernels elided", this->duration.kernelsElided);
+    printf("%-20s %u\n", "Unfenced lines", this->duration.unfencedLines);
+    printf("%-20s %zu\n", "Bytes saved", this->duration.bytesSaved);
+    printf("%-20s %zu\n", "Bytes total", this->duration.bytesTotal);
+    printf("%-20s %.2f%%\n", "byte ratio", (float) this->duration.bytesSaved / (float)(this->duration.bytesTotal) * 100);
+    printf("%-20s %zu\n", "Bytes h2d saved", this->duration.bytesh2d_saved);
+    printf("%-20s %zu\n", "Bytes h2d total", this->duration.bytesh2d_total);
+    printf("%-20s %.2f%%\n", "byte h2d ratio", (float) this->duration.bytesh2d_saved / (float)(this->duration.bytesh2d_total) * 100);
+    printf("%-20s %zu\n", "Bytes d2h saved", this->duration.bytesd2h_saved);
+    printf("%-20s %zu\n", "Bytes d2h total", this->duration.bytesd2h_total);
+    printf("%-20s %.2f%%\n", "byte d2h ratio", (float) this->duration.bytesd2h_saved / (float)(this->duration.bytesd2h_total) * 100);
+    printf("=========================================\n");
+}
+
+void Cache::writeTimeProfileToFile(vector<string> other_info) 
+{
+    collectProfiles(true);
+    ofstream myfile ("log.txt", fstream::app);
+    myfile.imbue(std::locale(std::cout.getloc(), new DecimalSeparator<char>(',')));
+    if (myfile.is_open())
+    {
+        const string organisationString[3] = {"DIRECT_MAPPING", "SET_ASSOCIATIVE", "FULLY_ASSOCIATIVE"};
+        const string replacementPolicyString[4] = {"LRU", "FIFO", "RANDOM", "SMALLEST"};
+
+        // Timestamp YY-MM-DD hh:mm:ss
+        myfile << currentDateTime() << " ";
+        
+        // Cache info
+        myfile << organisationString[this->organisation] << " ";
+        myfile << replacementPolicyString[this->replacementPolicy] << " ";
+        myfile << this->nrOfSets << " ";
+        myfile << this->nrOfLines << " ";       
+
+        // h2d, kernel, d2h, total
+        myfile << (this->duration.hostToDevice / 1000) << " " << (this->duration.deviceToHost / 1000) << " " << (this->duration.kernel / 1000) << " ";
+        myfile << (this->duration.hostToDevice + this->duration.deviceToHost + this->duration.kernel) / 1000 << " "; // Total time
+
+        // Cache hit, cache miss, cache hit ratio
+        myfile << this->duration.cacheHit << " " << this->duration.cacheMiss << " ";
+        myfile << ((float) this->duration.cacheHit / (float)(this->duration.cacheHit + this->duration.cacheMiss) * 100) << " "; // Cache hit ratio
+
+        // Bytes saved, bytes total, byte hit ratio
+        myfile << this->duration.bytesSaved << " " << this->duration.bytesTotal << " ";
+        myfile << ((float) this->duration.bytesSaved / (float)(this->duration.bytesTotal) * 100) << " ";                        // Byte hit ratio
+
+        // Bytes h2d saved, bytes h2d total, byte h2d ratio
+        myfile << this->duration.bytesh2d_saved << " " << this->duration.bytesh2d_total << " ";
+        myfile << ((float) this->duration.bytesh2d_saved / (float)(this->duration.bytesh2d_total) * 100) << " ";                        // Byte h2d ratio
+
+        // Bytes d2h saved, bytes d2h total, byte d2h ratio
+        myfile << this->duration.bytesd2h_saved << " " << this->duration.bytesd2h_total << " ";
+        myfile << ((float) this->duration.bytesd2h_saved / (float)(this->duration.bytesd2h_total) * 100) << " ";                        // Byte d2h ratio
+
+        // Whatever the client wants to add
+        for (int i = 0; i < other_info.size(); ++i)
+        {
+            myfile << other_info[i] << " ";
+        }
+
+        myfile << endl;
+        myfile.close();
+    }
+}
+
+/*!
+    * \brief Get the timers and counters, after the profiles of all completed commands are collected
+    * \return The timers in microseconds and the counters since the last resetTimers
+    */
+durations_t Cache::getDurations()
+{
+    collectProfiles(true);
+    return this->duration;
+}
+
+void Cache::resetTimers()
+{
+    collectProfiles(true);
+    this->duration.hostToDevice = 0;
+    this->duration.deviceToHost = 0;
+    this->duration.kernel = 0;
+    this->duration.cacheHit = 0;
+    this->duration.cacheMiss = 0;
+    this->duration.d2hHit = 0;
+    this->duration.kernelsElided = 0;
+    this->duration.unfencedLines = 0;
+    this->duration.bytesSaved = 0;
+    this->duration.bytesTotal = 0;
+    this->duration.bytesd2h_saved = 0;
+    this->duration.bytesd2h_total = 0;
+    this->duration.bytesh2d_saved = 0;
+    this->duration.bytesh2d_total = 0;
+}
+
+void Cache::resetCache()
+{
+    cout << "Clearing cache..." << endl;
+    dropEvictions();
+    collectProfiles(true);
+    for (int i = 0; i < this->nrOfLines; ++i) setLastWriter(i, NULL);
+    cl_int err = 0;
+    for (int i = 0; i < this->nrOfLines; ++i)
+    {
+        unfenceLine(i);
+        if (this->lines[i].deviceAddress != NULL)
+        {
+            buffers--;
+            err |= clReleaseMemObject(this->lines[i].deviceAddress);
+        }
+        
+    }
+    for (auto& parent : this->blockParents)
+    {
+        buffers--;
+        err |= clReleaseMemObject(parent.first);
+    }
+    this->blockParents.clear();
+
+    if (err != CL_SUCCESS) 
+    {
+        printf("Error: Failed to release memory objects! %d", err);
+    }
+
+    memset(this->lines, 0, sizeof(CacheLine) * this->nrOfLines);
+    for (auto& hashes : this->chunkHashes) hashes.clear();
+    this->shadowBuffers.assign(this->nrOfLines, NULL);
+    this->deviceLines.clear();
+    for (auto& memo : this->memoTable) clearKernelLaunches(memo.second);
+}
+
+
+/* ===================== PRIVATE METHODS ===================== */
+
+
+/*!
+    * \brief Set the arguments that are bound to a proxy again, a transfer can have bound the proxy 
+    * to another buffer since the argument was set
+    * \param kernel The OpenCL kernel
+    */
+void Cache::bindProxyArguments(cl_kernel kernel)
+{
+    auto arguments = this->kernelArguments.find(kernel);
+    if (arguments == this->kernelArguments.end() || this->virtualBuffers.empty()) return;
+
+    for (cl_uint index = 0; index < arguments->second.size(); ++index)
+    {
+        KernelArgument &argument = arguments->second[index];
+        VirtualBuffer *proxy = getVirtualBuffer(argument.proxy);
+        if (proxy == nullptr || getBinding(proxy) == argument.buffer) continue;
+
+        setArgumentBuffer(argument, proxy->binding);
+        clSetKernelArg(kernel, index, sizeof(cl_mem), &argument.buffer);
+    }
+}
+
+/*!
+    * \brief Give a line a new version, called whenever its device data changes
+    * \param idx The index of the cache line
+    */
+void Cache::stampLine(int idx)
+{
+    this->lines[idx].version = ++this->versionClock;
+}
+
+/*!
+    * \brief Describe a launch for the memo table. The buffers the kernel only reads are described by the versions 
+    * of their lines, so equal data in another buffer matches. The buffers it writes only by their size, 
+    * the results of an earlier launch can be copied into any buffer of that size.
+    * \param launch Returns the signature, the versions of the lines of the read buffers and the written buffers
+    * \return False when the launch can't be memoised, an argument was not set through the cache 
+    * or a buffer the kernel reads is not held by a cache line
+    */
+bool Cache::getKernelLaunch(
+    cl_kernel kernel, 
+    cl_uint work_dim, 
+    const size_t *global_work_offset, 
+    const size_t *global_work_size, 
+    const size_t *local_work_size, 
+    KernelLaunch &launch)
+{
+    const std::vector<KernelArgument> &arguments = getKernelArguments(kernel);
+    launch.signature.clear();
+    launch.versions.clear();
+    launch.outputs.clear();
+
+    for (cl_uint dim = 0; dim < work_dim; ++dim)
+    {
+        const size_t range[3] = {
+            (global_work_offset != NULL) ? global_work_offset[dim] : 0,
+            global_work_size[dim],
+            (local_work_size != NULL) ? local_work_size[dim] : 0
+        };
+        launch.signature.append((const char *) range, sizeof(range));
+    }
+
+    for (auto& argument : arguments)
+    {
+        if (argument.size == 0) return false;
+
+        launch.signature.append((const char *) &argument.size, sizeof(argument.size));
+        if (argument.buffer == nullptr)
+        {
+            launch.signature.append(argument.value.begin(), argument.value.end());
+            continue;
+        }
+
+        if (argument.written)
+        {
+            size_t size = 0;
+            if (clGetMemObjectInfo(argument.buffer, CL_MEM_SIZE, sizeof(size), &size, NULL) != CL_SUCCESS) return false;
+            launch.signature.append((const char *) &size, sizeof(size));
+            launch.outputs.push_back(argument.buffer);
+            continue;
+        }
+
+        auto line = this->deviceLines.find(argument.buffer);
+        if (line == this->deviceLines.end()) return false;
+        launch.versions.push_back(this->lines[line->second].version);
+    }
+    return true;
+}
+
+/*!
+    * \brief Serve a launch from the results of an earlier one, they are copied into the buffers 
+    * this launch writes unless it writes the same buffers
+    * \param previous The remembered launch
+    * \param launch The launch to serve, with the same signature and versions
+    * \return The error code
+    */
+cl_int Cache::replayKernelLaunch(
+    cl_command_queue command_queue, 
+    const KernelLaunch &previous, 
+    const KernelLaunch &launch, 
+    cl_uint num_events_in_wait_list, 
+    const cl_event *event_wait_list, 
+    cl_event *event)
+{
+    cl_int err = CL_SUCCESS;
+    std::vector<cl_event> copies;
+    std::vector<cl_mem> targets;
+    for (size_t i = 0; i < launch.outputs.size(); ++i)
+    {
+        cl_mem source = previous.outputs[i];
+        cl_mem target = launch.outputs[i];
+        if (source == target) continue;
+        targets.push_back(target);
+
+        size_t size = 0;
+        err |= clGetMemObjectInfo(target, CL_MEM_SIZE, sizeof(size), &size, NULL);
+
+        std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+        appendLastWriter(waitList, source);
+        appendLastWriter(waitList, target);
+
+        cl_event copy;
+        cl_int copyErr = clEnqueueCopyBuffer(
+            command_queue, 
+            source, 
+            target, 
+            0, 
+            0, 
+            size, 
+            waitList.size(), 
+            waitList.empty() ? NULL : waitList.data(), 
+            &copy
+        );
+        if (copyErr != CL_SUCCESS)
+        {
+            err |= copyErr;
+            continue;
+        }
+        copies.push_back(copy);
+
+        // The target now holds results of the kernel, as if it had been launched
+        auto line = this->deviceLines.find(target);
+        if (line != this->deviceLines.end()) 
+        {
+            setLineFlag(line->second, GPU);
+            setLastWriter(line->second, copy);
+            stampLine(line->second);
+        }
+        else if (this->blockSize > 0)
+        {
+            markBlocks(target, copy);
+        }
+    }
+
+    if (event != NULL)
+    {
+        err |= clEnqueueMarkerWithWaitList(
+            command_queue, 
+            copies.empty() ? num_events_in_wait_list : copies.size(), 
+            copies.empty() ? event_wait_list : copies.data(), 
+            event
+        );
+    }
+    for (auto copy : copies) clReleaseEvent(copy);
+
+    // Last, previous can be one of the launches that wrote a target
+    for (auto target : targets) forgetKernelLaunches(target);
+    return err;
+}
+
+/*!
+    * \brief Forget the remembered launches that wrote a buffer, called whenever the buffer is written
+    * \param buffer The device buffer
+    */
+void Cache::forgetKernelLaunches(cl_mem buffer)
+{
+    for (auto& memo : this->memoTable)
+    {
+        std::vector<KernelLaunch> &launches = memo.second;
+        for (size_t i = 0; i < launches.size(); )
+        {
+            const std::vector<cl_mem> &outputs = launches[i].outputs;
+            if (std::find(outputs.begin(), outputs.end(), buffer) == outputs.end())
+            {
+                ++i;
+                continue;
+            }
+            for (auto output : outputs) clReleaseMemObject(output);
+            launches.erase(launches.begin() + i);
+        }
+    }
+}
+
+/*!
+    * \brief Forget every remembered launch of a kernel
+    * \param launches The remembered launches
+    */
+void Cache::clearKernelLaunches(std::vector<KernelLaunch> &launches)
+{
+    for (auto& launch : launches)
+    {
+        for (auto output : launch.outputs) clReleaseMemObject(output);
+    }
+    launches.clear();
+}
+
+/*!
+    * \brief Get the argument table of a kernel, the table is created on first use. 
+    * The access of every argument is derived from the address and type qualifiers 
+    * (requires the program to be built with -cl-kernel-arg-info).
+    * If the qualifiers are not available every argument is assumed to be writable.
+    * \param kernel The OpenCL kernel
+    * \return The argument table, indexed by argument index
+    */
+std::vector<KernelArgument>& Cache::getKernelArguments(cl_kernel kernel)
+{
+    auto it = this->kernelArguments.find(kernel);
+    if (it != this->kernelArguments.end()) return it->second;
+
+    cl_uint nrOfArgs = 0;
+    clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(nrOfArgs), &nrOfArgs, NULL);
+
+    std::vector<KernelArgument> arguments(nrOfArgs);
+    for (cl_uint arg = 0; arg < nrOfArgs; ++arg)
+    {
+        arguments[arg].buffer = nullptr;
+        arguments[arg].proxy = nullptr;
+        arguments[arg].written = false;
+        arguments[arg].writable = true;
+        arguments[arg].global = false;
+        arguments[arg].scalar = false;
+        arguments[arg].size = 0;
+
+        cl_kernel_arg_address_qualifier addressQualifier;
+        cl_kernel_arg_type_qualifier typeQualifier;
+        cl_int err = clGetKernelArgInfo(kernel, arg, CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(addressQualifier), &addressQualifier, NULL);
+        err |= clGetKernelArgInfo(kernel, arg, CL_KERNEL_ARG_TYPE_QUALIFIER, sizeof(typeQualifier), &typeQualifier, NULL);
+        if (err != CL_SUCCESS) continue; // No argument info, so we have to assume the worst
+
+        // __local, __constant and private (scalar) arguments never point to a buffer the kernel can write
+        arguments[arg].global = addressQualifier == CL_KERNEL_ARG_ADDRESS_GLOBAL 
+                                || addressQualifier == CL_KERNEL_ARG_ADDRESS_CONSTANT;
+        arguments[arg].scalar = !arguments[arg].global;
+        arguments[arg].writable = addressQualifier == CL_KERNEL_ARG_ADDRESS_GLOBAL 
+                                  && !(typeQualifier & CL_KERNEL_ARG_TYPE_CONST);
+    }
+    dout << "getKernelArguments: classified " << nrOfArgs << " arguments of kernel " << kernel << endl;
+    return this->kernelArguments.emplace(kernel, arguments).first->second;
+}
+
+/*!
+    * \brief Change the coherence flag of a cache line
+    * \param idx The index of the cache line
+    * \param flag Indicates whether the most recent data is on the CPU, GPU or both
+    */
+void Cache::setLineFlag(int idx, Flag flag)
+{
+    this->lines[idx].flag = flag;
+
+    // The device copy changes, so the chunk hashes no longer describe it
+    if (flag == GPU) this->chunkHashes[idx].clear();
+
+    if (flag == GPU && this->lazy_coherence && this->write_back)
+        fenceLine(idx);
+    else if (flag != GPU && this->lines[idx].fenced)
+        unfenceLine(idx);
+}
+
+/*!
+    * \brief Copy the device data of a cache line back to the host (blocking) and mark the line as coherent
+    * \param idx The index of the cache line
+    * \return The error code
+    */
+cl_int Cache::readBackLine(int idx)
+{
+    CacheLine &line = this->lines[idx];
+
+    // An older version of this range might still be on its way to the host
+    waitForEvictions(line.tag, line.size);
+
+    // The host pages have to be accessible before the runtime can write to them
+    if (line.fenced) unfenceLine(idx);
+
+    std::vector<cl_event> waitList;
+    appendLastWriter(waitList, line.deviceAddress);
+
+    cl_event myevent;
+    cl_int err = clEnqueueReadBuffer(
+        this->cache_command_queue, 
+        line.deviceAddress, 
+        CL_TRUE, 
+        0, 
+        line.size, 
+        line.tag, 
+        waitList.size(), 
+        waitList.empty() ? NULL : waitList.data(), 
+        &myevent
+    );
+    this->duration.deviceToHost += probe_event_time(myevent, this->cache_command_queue);
+    this->duration.bytesSaved -= line.size;
+    this->duration.bytesd2h_saved -= line.size;
+
+    setLineFlag(idx, BOTH);
+    updateChunkHashes(idx);
+    return err;
+}
+
+
+/*!
+    * \brief Write a batch of GPU-dirty lines back to the host. All reads are enqueued without 
+    * blocking, round robin over the flush queues, after which we wait for all of them at once.
+    * The transfer time that is accounted is the time between the first start and the last end.
+    * \param dirtyLines The indices of the cache lines
+    * \return The error code
+    */
+cl_int Cache::flushLines(const std::vector<int> &dirtyLines)
+{
+    cl_int err = CL_SUCCESS;
+    if (dirtyLines.empty()) return err;
+
+    // Fenced lines cover whole pages of their own, so lifting their fence touches no other line
+    const std::vector<int> &lineIndices = dirtyLines;
+    for (int idx : lineIndices)
+    {
+        if (!this->lines[idx].fenced) continue;
+#ifdef __unix__
+        uintptr_t start, end;
+        getPageRange(idx, start, end);
+        mprotect((void *) start, end - start, PROT_READ | PROT_WRITE);
+#endif
+        this->lines[idx].fenced = false;
+    }
+
+    // Everything that is enqueued by the application, that might write to these lines, has to finish first
+    cl_event ready;
+    err |= clEnqueueMarkerWithWaitList(this->cache_command_queue, 0, NULL, &ready);
+    clFlush(this->cache_command_queue);
+
+    // Only the reads that were enqueued are waited for, a line whose read failed stays GPU-dirty
+    std::vector<cl_event> events;
+    std::vector<int> readLines;
+    for (size_t i = 0; i < lineIndices.size(); ++i)
+    {
+        CacheLine &line = this->lines[lineIndices[i]];
+        std::vector<cl_event> waitList(1, ready);
+        appendLastWriter(waitList, line.deviceAddress);
+
+        cl_event myevent;
+        cl_int readErr = clEnqueueReadBuffer(
+            getTransferQueue(i % this->nrOfFlushQueues), 
+            line.deviceAddress, 
+            CL_FALSE, 
+            0, 
+            line.size, 
+            line.tag, 
+            waitList.size(), 
+            waitList.data(), 
+            &myevent
+        );
+        if (readErr != CL_SUCCESS)
+        {
+            printf("Error: Failed to write back line %d! %s\n", lineIndices[i], getErrorString(readErr).c_str());
+            err |= readErr;
+            if (this->lazy_coherence) fenceLine(lineIndices[i]);
+            continue;
+        }
+        events.push_back(myevent);
+        readLines.push_back(lineIndices[i]);
+    }
+    for (unsigned int q = 0; q < min((size_t) this->nrOfFlushQueues, lineIndices.size()); ++q)
+    {
+        clFlush(getTransferQueue(q));
+    }
+    if (!events.empty()) err |= clWaitForEvents(events.size(), events.data());
+    clReleaseEvent(ready);
+
+    cl_ulong first = ~(cl_ulong) 0, last = 0;
+    for (size_t i = 0; i < readLines.size(); ++i)
+    {
+        cl_ulong start, end;
+        if (clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) == CL_SUCCESS
+            && clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) == CL_SUCCESS)
+        {
+            first = min(first, start);
+            last = max(last, end);
+        }
+        clReleaseEvent(events[i]);
+
+        const int idx = readLines[i];
+        this->duration.bytesSaved -= this->lines[idx].size;
+        this->duration.bytesd2h_saved -= this->lines[idx].size;
+        setLineFlag(idx, BOTH);
+        updateChunkHashes(idx);
+    }
+    if (last > first) this->duration.deviceToHost += (last - first) / 1000;
+
+    dout << "flushLines: " << lineIndices.size() << " lines over " << this->nrOfFlushQueues << " queues" << endl;
+    return err;
+}
+
+/*!
+    * \brief Account the execution time of a command. When transfers overlap with kernels, 
+    * waiting for the command would serialise them again, so the event is kept until it has completed.
+    * Takes ownership of the event.
+    * \param event The event of the command
+    * \param command_queue The queue the command was enqueued on
+    * \param duration The duration to add the execution time to
+    * \param defer Keep the event until it has completed, also without overlap
+    */
+void Cache::profileEvent(cl_event event, cl_command_queue command_queue, unsigned long long &duration, bool defer)
+{
+    if (this->overlap_transfers || defer)
+    {
+        this->pendingProfiles.push_back(std::make_pair(event, &duration));
+        return;
+    }
+    duration += probe_event_time(event, command_queue);
+    clReleaseEvent(event);
+}
+
+/*!
+    * \brief Account the execution time of completed commands and release their events
+    * \param wait Wait for all commands to complete
+    */
+void Cache::collectProfiles(bool wait)
+{
+    size_t i = 0;
+    while (i < this->pendingProfiles.size())
+    {
+        cl_event event = this->pendingProfiles[i].first;
+        cl_int status = CL_COMPLETE;
+        if (wait) 
+            clWaitForEvents(1, &event);
+        else 
+            clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+
+        if (status > CL_COMPLETE)
+        {
+            ++i;
+            continue;
+        }
+        *this->pendingProfiles[i].second += get_event_time(event);
+        clReleaseEvent(event);
+        this->pendingProfiles[i] = this->pendingProfiles.back();
+        this->pendingProfiles.pop_back();
+    }
+
+    // Kernels that have completed no longer block uploads
+    for (auto it = this->lastKernel.begin(); it != this->lastKernel.end(); )
+    {
+        cl_int status = CL_COMPLETE;
+        clGetEventInfo(it->second, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+        if (status <= CL_COMPLETE) 
+        {
+            clReleaseEvent(it->second);
+            it = this->lastKernel.erase(it);
+        }
+        else 
+        {
+            ++it;
+        }
+    }
+}
+
+/*!
+    * \brief Set the last command that wrote the device data of a line
+    * \param idx The index of the cache line
+    * \param event The event of the command, NULL to clear
+    */
+void Cache::setLastWriter(int idx, cl_event event)
+{
+    if (!this->overlap_transfers && event != NULL) return;
+
+    // A new writer makes the chunk events of a pipelined upload meaningless
+    clearChunkEvents(idx);
+
+    if (this->lines[idx].lastWriter != NULL) clReleaseEvent(this->lines[idx].lastWriter);
+    if (event != NULL) clRetainEvent(event);
+    this->lines[idx].lastWriter = event;
+}
+
+/*!
+    * \brief Add the last writer of a buffer to a wait list, if the buffer is cached and still being written
+    * \param waitList The wait list
+    * \param buffer The device buffer
+    */
+void Cache::appendLastWriter(std::vector<cl_event> &waitList, cl_mem buffer)
+{
+    auto line = this->deviceLines.find(buffer);
+    if (line == this->deviceLines.end() || this->lines[line->second].lastWriter == NULL) return;
+
+    cl_event lastWriter = this->lines[line->second].lastWriter;
+    cl_int status = CL_COMPLETE;
+    clGetEventInfo(lastWriter, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+    if (status > CL_COMPLETE) 
+    {
+        waitList.push_back(lastWriter);
+    }
+    else 
+    {
+        setLastWriter(line->second, NULL);
+    }
+}
+
+/*!
+    * \brief Release the chunk events of a pipelined upload
+    * \param idx The index of the cache line
+    */
+void Cache::clearChunkEvents(int idx)
+{
+    for (auto& chunkEvent : this->chunkEvents[idx])
+    {
+        clReleaseEvent(chunkEvent);
+    }
+    this->chunkEvents[idx].clear();
+}
+
+/*!
+    * \brief Upload a line in chunks of pipelineChunkSize, alternating between two transfer queues.
+    * The last writer of the line becomes a marker that completes with the last chunk, 
+    * the events of the chunks are kept for enqueueNDRangeKernelPipelined and getChunkEvents.
+    * \param idx The index of the cache line
+    * \param blocking_write Wait until all chunks have been uploaded
+    * \param waitList The events every chunk has to wait for
+    * \param event Returns the marker, can be NULL
+    * \return The error code
+    */
+cl_int Cache::enqueuePipelinedWrite(int idx, cl_bool blocking_write, const std::vector<cl_event> &waitList, cl_event *event)
+{
+    CacheLine &line = this->lines[idx];
+    const unsigned char *host = (const unsigned char *) line.tag;
+    const size_t nrOfChunks = (line.size + this->pipelineChunkSize - 1) / this->pipelineChunkSize;
+
+    cl_int err = CL_SUCCESS;
+    std::vector<cl_event> chunks;
+    chunks.reserve(nrOfChunks);
+    for (size_t chunk = 0; chunk < nrOfChunks; ++chunk)
+    {
+        const size_t start = chunk * this->pipelineChunkSize;
+        cl_command_queue transfer_queue = getTransferQueue(chunk % 2);
+        cl_event myevent;
+        cl_int chunkErr = clEnqueueWriteBuffer(
+            transfer_queue, 
+            line.deviceAddress, 
+            CL_FALSE, 
+            start, 
+            min(this->pipelineChunkSize, line.size - start), 
+            host + start, 
+            waitList.size(), 
+            waitList.empty() ? NULL : waitList.data(), 
+            &myevent
+        );
+        if (chunkErr != CL_SUCCESS)
+        {
+            printf("Error: Failed to upload chunk %zu of line %d! %s\n", chunk, idx, getErrorString(chunkErr).c_str());
+            err |= chunkErr;
+            continue;
+        }
+        clFlush(transfer_queue);
+
+        // profileEvent takes over one reference, the line keeps its own
+        clRetainEvent(myevent);
+        chunks.push_back(myevent);
+        profileEvent(myevent, transfer_queue, this->duration.hostToDevice);
+    }
+
+    cl_event marker;
+    err |= clEnqueueMarkerWithWaitList(getTransferQueue(0), chunks.size(), chunks.empty() ? NULL : chunks.data(), &marker);
+    clFlush(getTransferQueue(0));
+    setLastWriter(idx, marker);
+    if (event != NULL)
+    {
+        clRetainEvent(marker);
+        *event = marker;
+    }
+    clReleaseEvent(marker);
+
+    if (blocking_write && !chunks.empty()) clWaitForEvents(chunks.size(), chunks.data());
+
+    // setLastWriter cleared the old chunk events, the line now owns these. 
+    // After a failed chunk they no longer map onto the line, then kernels wait for the marker.
+    if (err == CL_SUCCESS)
+    {
+        this->chunkEvents[idx] = chunks;
+    }
+    else
+    {
+        for (auto& chunkEvent : chunks) clReleaseEvent(chunkEvent);
+    }
+    dout << "enqueuePipelinedWrite: Line " << idx << " in " << nrOfChunks << " chunks" << endl;
+    return err;
+}
+
+/*!
+    * \brief Enable pipelined uploads, lines larger than the chunk size are uploaded in chunks.
+    * Also enables overlap of transfers and kernels.
+    * \param chunkSize The size of a chunk in bytes, 0 disables pipelining
+    */
+void Cache::setPipelining(size_t chunkSize)
+{
+    this->pipelineChunkSize = chunkSize;
+    if (chunkSize > 0) setTransferOverlap(true);
+}
+
+/*!
+    * \brief Get the events of the chunks of the last pipelined upload of a buffer
+    * \param ptr The host pointer of the buffer
+    * \return The events, empty if the buffer was not uploaded in chunks or the upload has completed
+    */
+const std::vector<cl_event>& Cache::getChunkEvents(const void *ptr)
+{
+    static const std::vector<cl_event> none;
+    CacheLine *cacheLine = getCacheLine(ptr);
+    if (cacheLine == nullptr) return none;
+    return this->chunkEvents[cacheLine - this->lines];
+}
+
+/*!
+    * \brief Enable block granular caching. Buffers larger than the block size are cached as blocks,
+    * every block is a line with its own tag, flag and replacement state. The device buffer of a block
+    * is a sub-buffer of the buffer the blocks were assembled in, so kernels still get one contiguous buffer.
+    * Only used with a fully associative cache and for buffers with at most half as many blocks as there are lines.
+    * \param size The size of a block in bytes, rounded up to whole pages. 0 disables block granular caching
+    */
+void Cache::setBlockSize(size_t size)
+{
+    this->blockSize = ((size + this->pageSize - 1) / this->pageSize) * this->pageSize;
+}
+
+/*!
+    * \brief Check whether a transfer is handled per block
+    * \param offset The offset of the transfer
+    * \param cb The size of the transfer
+    * \return True when the transfer covers a whole buffer that is cached as blocks
+    */
+bool Cache::isBlocked(size_t offset, size_t cb)
+{
+    if (this->blockSize == 0 || offset != 0 || cb <= this->blockSize) return false;
+
+    const size_t nrOfBlocks = (cb + this->blockSize - 1) / this->blockSize;
+    return this->organisation == FULLY_ASSOCIATIVE && nrOfBlocks <= (size_t) this->nrOfLines / 2;
+}
+
+/*!
+    * \brief Point a block at a new sub-buffer of an assembled buffer, the old device buffer is released
+    * \param idx The index of the cache line of the block
+    * \param parent The assembled buffer
+    * \param offset The offset of the block in the assembled buffer
+    */
+void Cache::setBlockBuffer(int idx, cl_mem parent, size_t offset)
+{
+    CacheLine &line = this->lines[idx];
+    cl_buffer_region region = {offset, line.size};
+    cl_int err;
+    cl_mem block = clCreateSubBuffer(parent, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create block of %lu bytes at offset %lu! %s\n", line.size, offset, getErrorString(err).c_str());
+        exit(1);
+    }
+    buffers++;
+
+    if (line.deviceAddress != nullptr)
+    {
+        auto deviceLine = this->deviceLines.find(line.deviceAddress);
+        if (deviceLine != this->deviceLines.end() && deviceLine->second == idx) this->deviceLines.erase(deviceLine);
+        buffers--;
+        clReleaseMemObject(line.deviceAddress);
+    }
+    if (line.parent != NULL) dropBlockParent(line.parent);
+
+    if (this->blockParents[parent]++ == 0) clRetainMemObject(parent);
+    this->deviceLines[block] = idx;
+    line.deviceAddress = block;
+    line.parent = parent;
+    stampLine(idx);
+}
+
+/*!
+    * \brief Forget a block of an assembled buffer, the buffer is released with its last block
+    * \param parent The assembled buffer
+    */
+void Cache::dropBlockParent(cl_mem parent)
+{
+    auto it = this->blockParents.find(parent);
+    if (it == this->blockParents.end()) return;
+
+    if (--it->second == 0)
+    {
+        this->blockParents.erase(it);
+        buffers--;
+        clReleaseMemObject(parent);
+    }
+}
+
+/*!
+    * \brief Mark every block of an assembled buffer as written by the GPU
+    * \param parent The assembled buffer
+    * \param event The event of the kernel that wrote the buffer
+    */
+void Cache::markBlocks(cl_mem parent, cl_event event)
+{
+    if (this->blockParents.find(parent) == this->blockParents.end()) return;
+
+    for (int i = 0; i < this->nrOfLines; ++i)
+    {
+        if (this->lines[i].parent != parent) continue;
+
+        setLineFlag(i, GPU);
+        setLastWriter(i, event);
+        stampLine(i);
+    }
+}
+
+/*!
+    * \brief Write a buffer block by block. When all blocks are still resident in one assembled buffer
+    * that buffer is returned. Otherwise the blocks are assembled in the given buffer: resident blocks
+    * are copied on the device and only the missing or CPU-dirty blocks are uploaded from the host.
+    * \param buffer The buffer to assemble the blocks in, replaced by the cached buffer on a hit
+    * \return The error code
+    */
+cl_int Cache::enqueueBlockWrite(
+    cl_command_queue command_queue,
+    cl_mem *buffer, cl_bool blocking_write,
+    size_t cb,
+    const void *ptr,
+    cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list,
+    cl_event *event)
+{
+    const unsigned char *host = (const unsigned char *) ptr;
+    const size_t nrOfBlocks = (cb + this->blockSize - 1) / this->blockSize;
+
+    // Find the lines of the blocks, the buffer is a hit when all blocks are resident in the same assembled buffer
+    std::vector<int> blockLines(nrOfBlocks, -1);
+    std::vector<bool> resident(nrOfBlocks, false);
+    cl_mem parent = NULL;
+    bool hit = true;
+    for (size_t b = 0; b < nrOfBlocks; ++b)
+    {
+        CacheLine *cacheLine = getCacheLine(host + b * this->blockSize);
+        if (cacheLine == nullptr)
+        {
+            hit = false;
+            continue;
+        }
+
+        blockLines[b] = cacheLine - this->lines;
+        this->lockedLines.push_back(blockLines[b]);
+        resident[b] = cacheLine->parent != NULL && cacheLine->flag != CPU && cacheLine->deviceAddress != nullptr
+                      && cacheLine->size == min(this->blockSize, cb - b * this->blockSize);
+        if (b == 0) parent = cacheLine->parent;
+        hit = hit && resident[b] && cacheLine->parent == parent;
+    }
+
+    if (hit)
+    {
+        this->duration.cacheHit += nrOfBlocks;
+        this->duration.bytesSaved += cb;
+        this->duration.bytesh2d_saved += cb;
+        if (parent != *buffer && *buffer != NULL)
+        {
+            buffers--;
+            clReleaseMemObject(*buffer);
+            *buffer = parent;
+            clRetainMemObject(*buffer);     // The reference of the application
+        }
+        dout << "enqueueBlockWrite: Cache hit on all " << nrOfBlocks << " blocks" << endl;
+
+        // Nothing is written, the event completes once the data of every block is on the device
+        cl_int err = CL_SUCCESS;
+        if (event != NULL)
+        {
+            std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+            for (size_t b = 0; b < nrOfBlocks; ++b) appendLastWriter(waitList, this->lines[blockLines[b]].deviceAddress);
+            err = clEnqueueMarkerWithWaitList(command_queue, waitList.size(), waitList.empty() ? NULL : waitList.data(), event);
+        }
+        return err;
+    }
+
+    if (*buffer == NULL)
+    {
+        printf("Error: Can't assemble %lu blocks without a buffer!\n", nrOfBlocks);
+        return CL_INVALID_MEM_OBJECT;
+    }
+
+    cl_int err = CL_SUCCESS;
+    for (size_t b = 0; b < nrOfBlocks; ++b)
+    {
+        const size_t offset = b * this->blockSize;
+        const size_t size = min(this->blockSize, cb - offset);
+        int idx = blockLines[b];
+        std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+        cl_event myevent;
+
+        if (resident[b] && this->lines[idx].parent == *buffer)
+        {
+            // Already in place
+            this->duration.cacheHit += 1;
+            this->duration.bytesSaved += size;
+            this->duration.bytesh2d_saved += size;
+        }
+        else if (resident[b])
+        {
+            // Resident in another assembled buffer, copy it on the device
+            this->duration.cacheHit += 1;
+            this->duration.bytesSaved += size;
+            this->duration.bytesh2d_saved += size;
+            appendLastWriter(waitList, this->lines[idx].deviceAddress);
+            err |= clEnqueueCopyBuffer(
+                command_queue,
+                this->lines[idx].deviceAddress,
+                *buffer,
+                0,
+                offset,
+                size,
+                waitList.size(),
+                waitList.empty() ? NULL : waitList.data(),
+                &myevent
+            );
+            clReleaseEvent(myevent);
+            setLastWriter(idx, NULL);
+            setBlockBuffer(idx, *buffer, offset);
+        }
+        else
+        {
+            this->duration.cacheMiss += 1;
+            unfenceRange(host + offset, size);
+            err |= clEnqueueWriteBuffer(
+                command_queue,
+                *buffer,
+                CL_FALSE,
+                offset,
+                size,
+                host + offset,
+                waitList.size(),
+                waitList.empty() ? NULL : waitList.data(),
+                &myevent
+            );
+            profileEvent(myevent, command_queue, this->duration.hostToDevice);
+
+            if (idx != -1 && this->lines[idx].parent == *buffer)
+            {
+                setLineFlag(idx, BOTH);
+                stampLine(idx);
+            }
+            else
+            {
+                idx = addToCache(host + offset, size, nullptr, BOTH, idx);
+                if (idx != -1) setBlockBuffer(idx, *buffer, offset);
+            }
+        }
+    }
+    dout << "enqueueBlockWrite: Assembled " << nrOfBlocks << " blocks" << endl;
+
+    if (event != NULL) err |= clEnqueueMarkerWithWaitList(command_queue, 0, NULL, event);
+    if (blocking_write) clFinish(command_queue);
+    return err;
+}
+
+/*!
+    * \brief Read a buffer block by block, only the blocks the host does not hold yet are transferred.
+    * Blocks that were not cached yet are added as sub-buffers of the buffer.
+    * With write back nothing is transferred, the blocks are written back when evicted or on writeBack.
+    * \return The error code
+    */
+cl_int Cache::enqueueBlockRead(
+    cl_command_queue command_queue,
+    cl_mem buffer, cl_bool blocking_read,
+    size_t cb,
+    void *ptr,
+    cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list,
+    cl_event *event)
+{
+    unsigned char *host = (unsigned char *) ptr;
+    const size_t nrOfBlocks = (cb + this->blockSize - 1) / this->blockSize;
+
+    cl_int err = CL_SUCCESS;
+    std::vector<cl_event> readEvents;
+    for (size_t b = 0; b < nrOfBlocks; ++b)
+    {
+        const size_t offset = b * this->blockSize;
+        const size_t size = min(this->blockSize, cb - offset);
+        CacheLine *cacheLine = getCacheLine(host + offset);
+        int idx = (cacheLine == nullptr) ? -1 : (cacheLine - this->lines);
+        const bool owned = cacheLine != nullptr && cacheLine->parent == buffer;
+
+        if (!owned)
+        {
+            idx = addToCache(host + offset, size, nullptr, write_back ? GPU : BOTH, idx);
+            if (idx != -1) setBlockBuffer(idx, buffer, offset);
+        }
+
+        // Without a line a block can not be written back later, so it is read right away
+        if ((write_back && idx != -1) || (owned && cacheLine->flag == BOTH))
+        {
+            // The host already holds this block, or it is written back later
+            this->duration.bytesSaved += size;
+            this->duration.bytesd2h_saved += size;
+            if (!write_back) this->duration.d2hHit += 1;
+        }
+        else
+        {
+            unfenceRange(host + offset, size);
+            std::vector<cl_event> waitList(event_wait_list, event_wait_list + num_events_in_wait_list);
+            if (owned) appendLastWriter(waitList, cacheLine->deviceAddress);
+
+            cl_event myevent;
+            cl_int readErr = clEnqueueReadBuffer(
+                command_queue,
+                buffer,
+                CL_FALSE,
+                offset,
+                size,
+                host + offset,
+                waitList.size(),
+                waitList.empty() ? NULL : waitList.data(),
+                &myevent
+            );
+            if (readErr == CL_SUCCESS) 
+                readEvents.push_back(myevent);
+            else 
+                err |= readErr;
+        }
+
+        if (owned && !write_back) setLineFlag(idx, BOTH);
+    }
+    this->lockedLines.clear();
+
+    // The marker completes with the reads of the blocks, without reads with the wait list of the application
+    if (event != NULL)
+    {
+        err |= clEnqueueMarkerWithWaitList(
+            command_queue, 
+            readEvents.empty() ? num_events_in_wait_list : readEvents.size(), 
+            readEvents.empty() ? event_wait_list : readEvents.data(), 
+            event
+        );
+    }
+    for (auto readEvent : readEvents) profileEvent(readEvent, command_queue, this->duration.deviceToHost, true);
+
+    if (blocking_read && !write_back) clFinish(command_queue);
+    return err;
+}
+
+/*!
+    * \brief Enable or disable virtual buffers, they are disabled by default. Disabled, createBuffer allocates 
+    * right away and returns the buffer itself. Enabled, it returns a proxy, which the application may only 
+    * pass back to the cache: a proxy handed to OpenCL directly is an invalid memory object. 
+    * Proxies that were already handed out stay valid.
+    * \param enable Enable virtual buffers
+    */
+void Cache::setVirtualBuffers(bool enable)
+{
+    this->virtual_buffers = enable;
+}
+
+bool Cache::getVirtualBuffers()
+{
+    return this->virtual_buffers;
+}
+
+/*!
+    * \brief Get the proxy behind a handle
+    * \param buffer The handle
+    * \return The proxy, nullptr if the handle is not a proxy
+    */
+VirtualBuffer* Cache::getVirtualBuffer(cl_mem buffer)
+{
+    if (buffer == nullptr || this->virtualBuffers.empty()) return nullptr;
+
+    auto proxy = this->virtualBuffers.find(buffer);
+    return (proxy == this->virtualBuffers.end()) ? nullptr : proxy->second;
+}
+
+/*!
+    * \brief Get the device buffer of a proxy, allocated on first use
+    * \param proxy The proxy
+    * \return The device buffer
+    */
+cl_mem Cache::getBinding(VirtualBuffer *proxy)
+{
+    if (proxy->binding != nullptr) return proxy->binding;
+
+    cl_int err;
+    proxy->binding = clCreateBuffer(proxy->context, proxy->flags, proxy->size, proxy->host_ptr, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to allocate %lu bytes for a virtual buffer! %s\n", proxy->size, getErrorString(err).c_str());
+        exit(1);
+    }
+    buffers++;
+    dout << "getBinding: Allocated buffer for proxy " << proxy << endl;
+    return proxy->binding;
+}
+
+/*!
+    * \brief Bind a proxy to a device buffer, the proxy holds a reference on the buffer it is bound to
+    * \param proxy The proxy
+    * \param buffer The device buffer, nullptr to unbind
+    */
+void Cache::bindVirtualBuffer(VirtualBuffer *proxy, cl_mem buffer)
+{
+    if (proxy->binding == buffer) return;
+
+    if (buffer != nullptr) clRetainMemObject(buffer);
+    if (proxy->binding != nullptr) clReleaseMemObject(proxy->binding);
+    proxy->binding = buffer;
+}
+
+/*!
+    * \brief Decide the buffer a write through a proxy goes to before the transfer. The cached buffer 
+    * when the data is cached (a hit, or an in place upload of CPU-dirty data), otherwise the buffer 
+    * the proxy is bound to unless that holds the data of another line. An unbound proxy is only 
+    * allocated by the transfer when none of these apply.
+    * \param proxy The proxy
+    * \param ptr The host pointer of the transfer
+    * \param cb The size of the transfer
+    */
+void Cache::bindForWrite(VirtualBuffer *proxy, const void *ptr, size_t cb)
+{
+    CacheLine *cacheLine = getCacheLine(ptr);
+    if (cacheLine != nullptr && cacheLine->deviceAddress != nullptr && cacheLine->parent == NULL 
+        && cacheLine->size == cb && cb == proxy->size)
+    {
+        bindVirtualBuffer(proxy, cacheLine->deviceAddress);
+    }
+    else if (proxy->binding != nullptr 
+             && (cacheLine == nullptr || cacheLine->parent != proxy->binding)
+             && (this->deviceLines.count(proxy->binding) > 0 || this->blockParents.count(proxy->binding) > 0))
+    {
+        bindVirtualBuffer(proxy, nullptr);
+    }
+}
+
+/*!
+    * \brief Enable or disable overlap of transfers and kernels. Uploads are issued on a transfer queue
+    * owned by the cache and kernels only wait for the uploads of their own arguments, 
+    * so uploads for the next kernel can run while the current one is executing.
+    * \param enable Enable overlap
+    */
+void Cache::setTransferOverlap(bool enable)
+{
+    if (!enable) 
+    {
+        collectProfiles(true);
+        for (int i = 0; i < this->nrOfLines; ++i) setLastWriter(i, NULL);
+    }
+    this->overlap_transfers = enable;
+}
+
+bool Cache::getTransferOverlap()
+{
+    return this->overlap_transfers;
+}
+
+/*!
+    * \brief Get one of the transfer queues owned by the cache, created on first use 
+    * on the same context and device as the command queue of the application.
+    * \param i The index of the transfer queue
+    * \return The transfer queue
+    */
+cl_command_queue Cache::getTransferQueue(unsigned int i)
+{
+    while (this->transferQueues.size() <= i)
+    {
+        cl_context context;
+        cl_device_id device;
+        clGetCommandQueueInfo(this->cache_command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+        clGetCommandQueueInfo(this->cache_command_queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+
+        cl_int err;
+        cl_command_queue queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to create transfer queue! %s\n", getErrorString(err).c_str());
+            return this->cache_command_queue;
+        }
+        this->transferQueues.push_back(queue);
+    }
+    return this->transferQueues[i];
+}
+
+/*!
+    * \brief Write a GPU-dirty line back without blocking. The read is issued on a transfer queue after 
+    * everything that is already enqueued on the command queue of the application, into a staging buffer,
+    * so the host never sees a partial write back and host writes in the meantime are not overwritten.
+    * Once the read has completed the device buffer is released and the staged data is copied to the host, 
+    * the next time the cache retires evictions (see retireEvictions). writeBack, finish and a read of the range 
+    * wait for the copy. Afterwards the line is empty.
+    * \param idx The index of the cache line
+    */
+void Cache::evictLine(int idx)
+{
+    CacheLine &line = this->lines[idx];
+    PendingEviction eviction;
+    eviction.tag = line.tag;
+    eviction.size = line.size;
+    eviction.deviceAddress = line.deviceAddress;
+    eviction.staging = malloc(line.size);
+    eviction.fenced = line.fenced && eviction.staging != nullptr;
+
+    // A fenced host range stays fenced until the staged data is copied
+    if (eviction.fenced) 
+        line.fenced = false;
+    else 
+        unfenceLine(idx);
+
+    std::vector<cl_event> waitList(1);
+    cl_command_queue queue = getTransferQueue(0);
+    cl_int err = clEnqueueMarkerWithWaitList(this->cache_command_queue, 0, NULL, &waitList[0]);
+    appendLastWriter(waitList, line.deviceAddress);
+    if (eviction.staging != nullptr)
+    {
+        err |= clEnqueueReadBuffer(queue, line.deviceAddress, CL_FALSE, 0, line.size, eviction.staging, waitList.size(), waitList.data(), &eviction.event);
+    }
+    else
+    {
+        // Without a staging buffer the write back blocks, then the host is only written while the cache waits
+        err |= clEnqueueReadBuffer(queue, line.deviceAddress, CL_TRUE, 0, line.size, line.tag, waitList.size(), waitList.data(), &eviction.event);
+    }
+    clFlush(this->cache_command_queue);
+    clFlush(queue);
+    clReleaseEvent(waitList[0]);
+    setLastWriter(idx, NULL);
+
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to write back evicted line %d! %s\n", idx, getErrorString(err).c_str());
+    }
+    if (eviction.staging != nullptr)
+    {
+        this->pendingEvictions.push_back(eviction);
+    }
+    else
+    {
+        retireEviction(eviction);
+    }
+
+    auto deviceLine = this->deviceLines.find(line.deviceAddress);
+    if (deviceLine != this->deviceLines.end() && deviceLine->second == idx) this->deviceLines.erase(deviceLine);
+    line.deviceAddress = nullptr;
+    line.flag = BOTH;
+}
+
+/*!
+    * \brief Settle the evictions whose write back has completed, their staged data is copied to the host 
+    * while the application still owns the range instead of on some later use of the range
+    * \param wait Wait for all pending write backs instead of only settling completed ones
+    */
+void Cache::retireEvictions(bool wait)
+{
+    size_t i = 0;
+    while (i < this->pendingEvictions.size())
+    {
+        cl_int status = CL_COMPLETE;
+        if (!wait && this->pendingEvictions[i].event != nullptr) 
+        {
+            clGetEventInfo(this->pendingEvictions[i].event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+        }
+
+        if (status <= CL_COMPLETE)
+            settleEviction(i);
+        else
+            ++i;
+    }
+}
+
+/*!
+    * \brief Account a completed write back, release its event and the device buffer
+    * \param eviction The eviction
+    */
+void Cache::retireEviction(PendingEviction &eviction)
+{
+    this->duration.deviceToHost += get_event_time(eviction.event);
+    this->duration.bytesSaved -= eviction.size;
+    this->duration.bytesd2h_saved -= eviction.size;
+    clReleaseEvent(eviction.event);
+    eviction.event = nullptr;
+
+    buffers--;
+    clReleaseMemObject(eviction.deviceAddress);
+    eviction.deviceAddress = nullptr;
+}
+
+/*!
+    * \brief Wait for the write back of an eviction, copy the staged data to the host, 
+    * lift the fence of the host range and remove the eviction from the pending list
+    * \param i The index in the pending list
+    * \param newer A host range whose data is newer than the staged data, it is not overwritten
+    * \param newerSize The size of that range in bytes
+    */
+void Cache::settleEviction(size_t i, const void *newer, size_t newerSize)
+{
+    PendingEviction eviction = this->pendingEvictions[i];
+    this->pendingEvictions.erase(this->pendingEvictions.begin() + i);
+
+    if (eviction.event != nullptr)
+    {
+        clWaitForEvents(1, &eviction.event);
+        retireEviction(eviction);
+    }
+#ifdef __unix__
+    // Only page aligned lines are fenced, so the range is exactly the pages of the line
+    if (eviction.fenced) mprotect(eviction.tag, eviction.size, PROT_READ | PROT_WRITE);
+#endif
+
+    unsigned char *host = (unsigned char *) eviction.tag;
+    const unsigned char *staging = (const unsigned char *) eviction.staging;
+    const size_t keepStart = min(max((uintptr_t) newer, (uintptr_t) host) - (uintptr_t) host, eviction.size);
+    const size_t keepEnd = max(min((uintptr_t) newer + newerSize, (uintptr_t) host + eviction.size), (uintptr_t) host + keepStart) - (uintptr_t) host;
+    memcpy(host, staging, keepStart);
+    memcpy(host + keepEnd, staging + keepEnd, eviction.size - keepEnd);
+    free(eviction.staging);
+    dout << "settleEviction: " << eviction.size - (keepEnd - keepStart) << " bytes written back to " << eviction.tag << endl;
+}
+
+/*!
+    * \brief Copy the staged data of every eviction to the host
+    */
+void Cache::settleEvictions()
+{
+    while (!this->pendingEvictions.empty()) settleEviction(0);
+}
+
+/*!
+    * \brief Wait until the commands of a queue have completed and copy the data of every evicted line 
+    * to the host, use it instead of clFinish when the host reads data the cache may have evicted
+    * \param command_queue The command queue
+    * \return The error code
+    */
+cl_int Cache::finish(cl_command_queue command_queue)
+{
+    cl_int err = clFinish(command_queue);
+    settleEvictions();
+    return err;
+}
+
+/*!
+    * \brief Drop every eviction without copying its staged data, for when the cache forgets its contents
+    */
+void Cache::dropEvictions()
+{
+    for (auto& eviction : this->pendingEvictions)
+    {
+        if (eviction.event != nullptr)
+        {
+            clWaitForEvents(1, &eviction.event);
+            retireEviction(eviction);
+        }
+#ifdef __unix__
+        if (eviction.fenced) mprotect(eviction.tag, eviction.size, PROT_READ | PROT_WRITE);
+#endif
+        free(eviction.staging);
+    }
+    this->pendingEvictions.clear();
+}
+
+/*!
+    * \brief Copy the staged data of the evictions overlapping a host range to the host, before it is read
+    * \param ptr The start of the host range
+    * \param size The size of the host range in bytes
+    */
+void Cache::waitForEvictions(const void *ptr, size_t size)
+{
+    const uintptr_t start = (uintptr_t) ptr;
+    const uintptr_t end = start + size;
+
+    size_t i = 0;
+    while (i < this->pendingEvictions.size())
+    {
+        const PendingEviction &eviction = this->pendingEvictions[i];
+        if ((uintptr_t) eviction.tag < end && start < (uintptr_t) eviction.tag + eviction.size)
+            settleEviction(i);
+        else
+            ++i;
+    }
+}
+
+/*!
+    * \brief Settle the evictions overlapping a host range that the host has written, 
+    * only the staged data outside the range is copied to the host
+    * \param ptr The start of the host range
+    * \param size The size of the host range in bytes
+    */
+void Cache::discardEvictions(const void *ptr, size_t size)
+{
+    const uintptr_t start = (uintptr_t) ptr;
+    const uintptr_t end = start + size;
+
+    size_t i = 0;
+    while (i < this->pendingEvictions.size())
+    {
+        const PendingEviction &eviction = this->pendingEvictions[i];
+        if ((uintptr_t) eviction.tag < end && start < (uintptr_t) eviction.tag + eviction.size)
+            settleEviction(i, ptr, size);
+        else
+            ++i;
+    }
+}
+
+
+/* ===================== LAZY COHERENCE ===================== */
+
+
+Cache *Cache::lazyCoherenceCache = nullptr;
+#ifdef __unix__
+struct sigaction Cache::previousFaultHandler;
+int Cache::faultRequests[2] = {-1, -1};
+int Cache::faultReplies[2] = {-1, -1};
+pthread_t Cache::faultService;
+std::atomic_flag Cache::faultLock = ATOMIC_FLAG_INIT;
+#endif
+
+/*!
+    * \brief Get the page aligned host range covered by a cache line
+    * \param idx The index of the cache line
+    * \param start Returns the start of the first page
+    * \param end Returns the end of the last page
+    */
+void Cache::getPageRange(int idx, uintptr_t &start, uintptr_t &end)
+{
+    start = (uintptr_t) this->lines[idx].tag & ~(this->pageSize - 1);
+    end = ((uintptr_t) this->lines[idx].tag + this->lines[idx].size + this->pageSize - 1) & ~(this->pageSize - 1);
+}
+
+/*!
+    * \brief Make the host pages of a GPU-dirty line inaccessible, the first host access 
+    * will then fault and trigger the read back of the line. Only lines that cover whole pages 
+    * are fenced, a page shared with other data would fault on accesses to that data as well.
+    * The other lines follow the usual write back rules and are counted as unfenced.
+    * \param idx The index of the cache line
+    * \return Returns true if the line is fenced
+    */
+bool Cache::fenceLine(int idx)
+{
+#ifdef __unix__
+    CacheLine &line = this->lines[idx];
+    if (line.fenced || line.tag == nullptr) return line.fenced;
+    if ((uintptr_t) line.tag % this->pageSize != 0 || line.size % this->pageSize != 0)
+    {
+        dout << "fenceLine: Line " << idx << " is not page aligned, it is not fenced" << endl;
+        this->duration.unfencedLines += 1;
+        return false;
+    }
+
+    if (mprotect(line.tag, line.size, PROT_NONE) != 0)
+    {
+        printf("Error: Failed to protect host memory of line %d\n", idx);
+        return false;
+    }
+    line.fenced = true;
+    return true;
+#else
+    return false;
 #endif
-    return err;
 }
 
-void Cache::setDirtyFlag(const void *ptr, Flag flag)
+/*!
+    * \brief Make the host pages of a line accessible again
+    * \param idx The index of the cache line
+    */
+void Cache::unfenceLine(int idx)
 {
-    CacheLine *cacheLine = getCacheLine(ptr);
-    if (cacheLine != nullptr)
-    {
-        cacheLine->flag = flag;
-    }
+#ifdef __unix__
+    if (!this->lines[idx].fenced) return;
+    this->lines[idx].fenced = false;
+
+    // A fenced line covers whole pages of its own
+    mprotect(this->lines[idx].tag, this->lines[idx].size, PROT_READ | PROT_WRITE);
+#endif
 }
 
-void Cache::printCache()
+/*!
+    * \brief Read back every fenced line that shares a page with the host range. 
+    * Needed before the OpenCL runtime itself touches host memory, a fault in 
+    * one of its threads would stall that thread until the fault service has read the line back.
+    * \param ptr The start of the host range
+    * \param size The size of the host range in bytes
+    */
+void Cache::unfenceRange(const void *ptr, size_t size)
 {
-    const string flags[] = {"CPU", "GPU", "BOTH"};
+    if (!this->lazy_coherence || ptr == nullptr) return;
 
-    printf("=============================================================================================\n");
-    for (int i = 0; i < this->nrOfLines; ++i) 
+    const uintptr_t start = (uintptr_t) ptr & ~(this->pageSize - 1);
+    const uintptr_t end = ((uintptr_t) ptr + size + this->pageSize - 1) & ~(this->pageSize - 1);
+    waitForEvictions((const void *) start, end - start);
+    for (int i = 0; i < this->nrOfLines; ++i)
     {
-        if (this->organisation == SET_ASSOCIATIVE && i % this->nrOfLinesPerSet == 0) 
-            printf("---------------------------------------------------------------------------------------------\n");
+        if (!this->lines[i].fenced) continue;
 
-        printf("Line %-6d", i);
-        printf("Flag: %-6s", flags[this->lines[i].flag].c_str());
-        printf("Age: %-6d", this->lines[i].age);
-        printf("Tag: %-18p", this->lines[i].tag);
-        printf("Size: %-10lu", this->lines[i].size);
-        printf("Device addr: %-18p", this->lines[i].deviceAddress);
-        printf("\n");
+        uintptr_t lineStart, lineEnd;
+        getPageRange(i, lineStart, lineEnd);
+        if (lineStart < end && start < lineEnd) readBackLine(i);
     }
-    const string organisationString[3] = {"DIRECT_MAPPING", "SET_ASSOCIATIVE", "FULLY_ASSOCIATIVE"};
-    const string replacementPolicyString[4] = {"LRU", "FIFO", "RANDOM", "SMALLEST"};
-    printf("%-30s %s\n", "Cache organisation:", organisationString[this->organisation].c_str());
-    printf("%-30s %s\n", "Cache replacement policy:", replacementPolicyString[this->replacementPolicy].c_str());
-    printf("%-30s %d\n", "Cache number of sets:", this->nrOfSets);
-    printf("%-30s %d\n", "Cache number of lines:", this->nrOfLines);
-    printf("=============================================================================================\n\n");
-}
-
-void Cache::printTimeProfile()
-{
-    printf("=========================================\n");
-    printf("%-20s Time (ms)\n", "Action");
-    printf("-----------------------------------------\n");
-    printf("%-20s %llu\n", "Host to device", this->duration.hostToDevice / 1000);
-    printf("%-20s %llu\n", "Device to host", this->duration.deviceToHost / 1000);
-    printf("%-20s %llu\n", "Total on transfers", (this->duration.hostToDevice + this->duration.deviceToHost) / 1000);
-    printf("%-20s %llu\n", "Kernel execution", this->duration.kernel / 1000);
-    printf("%-20s %llu\n", "Total time ", (this->duration.hostToDevice + this->duration.deviceToHost + this->duration.kernel) / 1000);
-    printf("-----------------------------------------\n");
-    printf("%-20s %u\n", "Cache hits", this->duration.cacheHit);
-    printf("%-20s %u\n", "Cache misses", this->duration.cacheMiss);
-    printf("%-20s %.2f%%\n", "Hit ratio", (float) this->duration.cacheHit / (float)(this->duration.cacheHit + this->duration.cacheMiss) * 100);    
-    printf("%-20s %zu\n", "Bytes saved", this->duration.bytesSaved);
-    printf("%-20s %zu\n", "Bytes total", this->duration.bytesTotal);
-    printf("%-20s %.2f%%\n", "byte ratio", (float) this->duration.bytesSaved / (float)(this->duration.bytesTotal) * 100);
-    printf("%-20s %zu\n", "Bytes h2d saved", this->duration.bytesh2d_saved);
-    printf("%-20s %zu\n", "Bytes h2d total", this->duration.bytesh2d_total);
-    printf("%-20s %.2f%%\n", "byte h2d ratio", (float) this->duration.bytesh2d_saved / (float)(this->duration.bytesh2d_total) * 100);
-    printf("%-20s %zu\n", "Bytes d2h saved", this->duration.bytesd2h_saved);
-    printf("%-20s %zu\n", "Bytes d2h total", this->duration.bytesd2h_total);
-    printf("%-20s %.2f%%\n", "byte d2h ratio", (float) this->duration.bytesd2h_saved / (float)(this->duration.bytesd2h_total) * 100);
-    printf("=========================================\n");
 }
 
-void Cache::writeTimeProfileToFile(vector<string> other_info) 
+/*!
+    * \brief Resolve a host access to a fenced page by reading back the lines on that page.
+    * Runs on the fault service thread while the faulting thread waits in the signal handler.
+    * \param address The faulting address
+    * \return Returns true if the address belonged to a fenced line
+    */
+bool Cache::resolveFault(const void *address)
 {
-    ofstream myfile ("log.txt", fstream::app);
-    myfile.imbue(std::locale(std::cout.getloc(), new DecimalSeparator<char>(',')));
-    if (myfile.is_open())
+    const uintptr_t page = (uintptr_t) address & ~(this->pageSize - 1);
+    bool resolved = false;
+    for (size_t i = 0; i < this->pendingEvictions.size(); ++i)
     {
-        const string organisationString[3] = {"DIRECT_MAPPING", "SET_ASSOCIATIVE", "FULLY_ASSOCIATIVE"};
-        const string replacementPolicyString[4] = {"LRU", "FIFO", "RANDOM", "SMALLEST"};
-
-        // Timestamp YY-MM-DD hh:mm:ss
-        myfile << currentDateTime() << " ";
-        
-        // Cache info
-        myfile << organisationString[this->organisation] << " ";
-        myfile << replacementPolicyString[this->replacementPolicy] << " ";
-        myfile << this->nrOfSets << " ";
-        myfile << this->nrOfLines << " ";       
+        const PendingEviction &eviction = this->pendingEvictions[i];
+        if (!eviction.fenced) continue;
 
-        // h2d, kernel, d2h, total
-        myfile << (this->duration.hostToDevice / 1000) << " " << (this->duration.deviceToHost / 1000) << " " << (this->duration.kernel / 1000) << " ";
-        myfile << (this->duration.hostToDevice + this->duration.deviceToHost + this->duration.kernel) / 1000 << " "; // Total time
+        const uintptr_t start = (uintptr_t) eviction.tag;
+        const uintptr_t end = start + eviction.size;
+        if (page >= start && page < end)
+        {
+            dout << "resolveFault: Host access to an evicted line, waiting for its write back" << endl;
+            waitForEvictions((const void *) page, this->pageSize);
+            resolved = true;
+            break;
+        }
+    }
+    for (int i = 0; i < this->nrOfLines; ++i)
+    {
+        if (!this->lines[i].fenced) continue;
 
-        // Cache hit, cache miss, cache hit ratio
-        myfile << this->duration.cacheHit << " " << this->duration.cacheMiss << " ";
-        myfile << ((float) this->duration.cacheHit / (float)(this->duration.cacheHit + this->duration.cacheMiss) * 100) << " "; // Cache hit ratio
+        uintptr_t start, end;
+        getPageRange(i, start, end);
+        if (page >= start && page < end)
+        {
+            dout << "resolveFault: Host access to Line " << i << ", reading back" << endl;
+            readBackLine(i);
+            resolved = true;
+        }
+    }
+    return resolved;
+}
 
-        // Bytes saved, bytes total, byte hit ratio
-        myfile << this->duration.bytesSaved << " " << this->duration.bytesTotal << " ";
-        myfile << ((float) this->duration.bytesSaved / (float)(this->duration.bytesTotal) * 100) << " ";                        // Byte hit ratio
+#ifdef __unix__
+/*!
+    * \brief SIGSEGV handler. Reading back a line is not async-signal-safe, so the handler only passes 
+    * the faulting address to the fault service thread over a pipe and waits for its answer. 
+    * The faulting instruction is retried once the line has been read back. Faults that are not caused 
+    * by a fenced line, and faults of the service thread itself, go to the previous handler.
+    * The cache is not thread safe, the application must not use it while another of its threads faults.
+    */
+void Cache::handleFault(int sig, siginfo_t *info, void *context)
+{
+    if (lazyCoherenceCache == nullptr || pthread_equal(pthread_self(), faultService))
+    {
+        forwardFault(sig, info, context);
+        return;
+    }
 
-        // Bytes h2d saved, bytes h2d total, byte h2d ratio
-        myfile << this->duration.bytesh2d_saved << " " << this->duration.bytesh2d_total << " ";
-        myfile << ((float) this->duration.bytesh2d_saved / (float)(this->duration.bytesh2d_total) * 100) << " ";                        // Byte h2d ratio
+    const int savedErrno = errno;
+    while (faultLock.test_and_set(std::memory_order_acquire))
+    {
+        const struct timespec pause = {0, 1000};
+        nanosleep(&pause, NULL);
+    }
 
-        // Bytes d2h saved, bytes d2h total, byte d2h ratio
-        myfile << this->duration.bytesd2h_saved << " " << this->duration.bytesd2h_total << " ";
-        myfile << ((float) this->duration.bytesd2h_saved / (float)(this->duration.bytesd2h_total) * 100) << " ";                        // Byte d2h ratio
+    char resolved = 0;
+    void *address = info->si_addr;
+    ssize_t n;
+    do n = write(faultRequests[1], &address, sizeof(address)); while (n < 0 && errno == EINTR);
+    if (n == sizeof(address))
+    {
+        do n = read(faultReplies[0], &resolved, sizeof(resolved)); while (n < 0 && errno == EINTR);
+    }
 
-        // Whatever the client wants to add
-        for (int i = 0; i < other_info.size(); ++i)
-        {
-            myfile << other_info[i] << " ";
-        }
+    faultLock.clear(std::memory_order_release);
+    errno = savedErrno;
+    if (!resolved) forwardFault(sig, info, context);
+}
 
-        myfile << endl;
-        myfile.close();
+/*!
+    * \brief Pass a fault on to the handler that was installed before lazy coherence was enabled.
+    * The default action is taken by resetting the handler, the fault repeats when the instruction is retried.
+    */
+void Cache::forwardFault(int sig, siginfo_t *info, void *context)
+{
+    if (previousFaultHandler.sa_flags & SA_SIGINFO)
+    {
+        previousFaultHandler.sa_sigaction(sig, info, context);
+    }
+    else if (previousFaultHandler.sa_handler != SIG_DFL && previousFaultHandler.sa_handler != SIG_IGN)
+    {
+        previousFaultHandler.sa_handler(sig);
+    }
+    else
+    {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = SIG_DFL;
+        sigemptyset(&action.sa_mask);
+        sigaction(sig, &action, NULL);
     }
 }
 
-void Cache::resetTimers()
+/*!
+    * \brief Fault service thread, resolves the faults the signal handler receives until the request pipe is closed
+    * \param cache The cache with lazy coherence
+    */
+void *Cache::serveFaults(void *cache)
 {
-    this->duration.hostToDevice = 0;
-    this->duration.deviceToHost = 0;
-    this->duration.kernel = 0;
-    this->duration.cacheHit = 0;
-    this->duration.cacheMiss = 0;
-    this->duration.bytesSaved = 0;
-    this->duration.bytesTotal = 0;
-    this->duration.bytesd2h_saved = 0;
-    this->duration.bytesd2h_total = 0;
-    this->duration.bytesh2d_saved = 0;
-    this->duration.bytesh2d_total = 0;
+    void *address;
+    while (read(faultRequests[0], &address, sizeof(address)) == sizeof(address))
+    {
+        const char resolved = ((Cache *) cache)->resolveFault(address) ? 1 : 0;
+        if (write(faultReplies[1], &resolved, sizeof(resolved)) != sizeof(resolved)) break;
+    }
+    return NULL;
 }
 
-void Cache::resetCache()
+/*!
+    * \brief Create the pipes and start the fault service thread
+    * \return Returns true if the thread is running
+    */
+bool Cache::startFaultService()
 {
-    cout << "Clearing cache..." << endl;
-    cl_int err = 0;
-    for (int i = 0; i < this->nrOfLines; ++i)
+    if (pipe(faultRequests) != 0) return false;
+    if (pipe(faultReplies) != 0)
     {
-        if (this->lines[i].deviceAddress != NULL)
-        {
-            buffers--;
-            err |= clReleaseMemObject(this->lines[i].deviceAddress);
-        }
-        
+        close(faultRequests[0]);
+        close(faultRequests[1]);
+        return false;
     }
-
-    if (err != CL_SUCCESS) 
+    if (pthread_create(&faultService, NULL, serveFaults, this) != 0)
     {
-        printf("Error: Failed to release memory objects! %d", err);
+        for (int i = 0; i < 2; ++i)
+        {
+            close(faultRequests[i]);
+            close(faultReplies[i]);
+        }
+        return false;
     }
-
-    memset(this->lines, 0, sizeof(CacheLine) * this->nrOfLines);
+    return true;
 }
 
-
-/* ===================== PRIVATE METHODS ===================== */
+/*!
+    * \brief Stop the fault service thread, closing the request pipe ends its loop
+    */
+void Cache::stopFaultService()
+{
+    close(faultRequests[1]);
+    pthread_join(faultService, NULL);
+    close(faultRequests[0]);
+    close(faultReplies[0]);
+    close(faultReplies[1]);
+    faultRequests[0] = faultRequests[1] = faultReplies[0] = faultReplies[1] = -1;
+}
+#endif
 
 
 void Cache::initialise(Organisation organisation, ReplacementPolicy replacementPolicy, int cacheSize, int nrOfSet, bool write_back)
@@ -679,17 +3131,30 @@ void Cache::initialise(Organisation organisation, ReplacementPolicy replacementP
 
     // Allocate memory for the cache lines and set to 0
     this->lines = new CacheLine[this->nrOfLines]();
+    this->directory = createCacheDirectory(organisation, replacementPolicy, this->lines, this->nrOfSets, this->nrOfLinesPerSet, write_back);
+    this->chunkHashes.resize(this->nrOfLines);
+    this->chunkEvents.resize(this->nrOfLines);
+    this->shadowBuffers.assign(this->nrOfLines, NULL);
+    this->mode = ACTIVE;
 
     this->write_back = write_back;
+    this->lazy_coherence = false;
+    this->nrOfFlushQueues = 1;
+    this->overlap_transfers = false;
+    this->pipelineChunkSize = 0;
+    this->blockSize = 0;
+    this->virtual_buffers = false;
+    this->versionClock = 0;
+#ifdef __unix__
+    this->pageSize = sysconf(_SC_PAGESIZE);
+#else
+    this->pageSize = 4096;
+#endif
 
     // Seed the random number generator
     srand ( time(NULL) );
 
     resetTimers();
-    for (int i = 0; i < this->nrOfSets; ++i)
-    {
-        this->FIFO_index.push_back(0);
-    }
 
 
     const string organisationString[3] = {"DIRECT_MAPPING", "SET_ASSOCIATIVE", "FULLY_ASSOCIATIVE"};
@@ -750,49 +3215,14 @@ int Cache::getTableSize(int n)
 }
 
 /*!
-    * \brief Get the set index
-    * \param tag The tag
-    * \return The set index
-    */
-int Cache::getSetIndex(const void *tag)
-{
-    int setIdx = ((uintptr_t) tag) % nrOfSets;
-    return setIdx;
-}
-
-/*!
-    * \brief Checks whether the tag is in the respective set
-    * \param setIndex The set index
+    * \brief Checks whether the tag is in the cache
     * \param tag The tag    
     * \return Returns a pointer to the respective cache line or NULL if it does not exist
     */
 CacheLine* Cache::getCacheLine(const void *tag)
 {
-    CacheLine *cacheLine = nullptr;
-    if (tag == nullptr) return cacheLine;
-
-    const int setIndex = getSetIndex(tag);
-    const int offset = setIndex * this->nrOfLinesPerSet;
-    const int end = offset + this->nrOfLinesPerSet;
-    for (int idx = offset; idx < end; ++idx) 
-    {
-        if (this->lines[idx].tag == tag)
-        {
-            cacheLine = &this->lines[idx];
-
-            if (this->replacementPolicy == LRU) 
-                this->lines[idx].age = 0;
-            else
-                break;
-        } 
-        
-        if (this->replacementPolicy == LRU) 
-        {
-            this->lines[idx].age += 1;
-        }
-    }
-
-    return cacheLine;
+    const int idx = visitCacheDirectory(this->directory, this->organisation, this->replacementPolicy, this->write_back, FindVisitor{tag});
+    return (idx == -1) ? nullptr : &this->lines[idx];
 }
 
 /*!
@@ -802,175 +3232,198 @@ CacheLine* Cache::getCacheLine(const void *tag)
     * \param deviceAddress The device address of the new line
     * \param flag Indicates whether the most recent data is on the CPU, GPU or both
     * \param idx (optional) provide the index of the cache line to be updated, if not provided it'll use the replacement policy to determine the index
-    * \return Returns the cache line
+    * \return Returns the index of the cache line, -1 if every candidate line is locked by the current command
     */
-CacheLine Cache::addToCache(const void *tag, size_t size, cl_mem deviceAddress, Flag flag, int idx)
+int Cache::addToCache(const void *tag, size_t size, cl_mem deviceAddress, Flag flag, int idx)
 {
     if (idx == -1) 
     {
-        idx = getSetIndex(tag);
-        if (this->organisation != DIRECT_MAPPING)
-        {
-            // Replacement policy needed
-            switch (this->replacementPolicy) 
-            {
-                case LRU:
-                    // Get the oldest index
-                    idx = getOldestIndex(idx);
-                    dout << "LRU idx: " << idx << endl;
-                    break;
-                case FIFO: {
-                        int setIndex = idx;
-                        int maxIter = 1000;
-                        do {
-                            this->FIFO_index[setIndex] = (this->FIFO_index[setIndex] + 1) % this->nrOfLinesPerSet;
-                            idx = this->FIFO_index[setIndex] + setIndex * this->nrOfLinesPerSet;
-                            // dout << "fifo idx: " << idx << endl;
-                        } while (find(this->lockedLines.begin(), this->lockedLines.end(), idx) != this->lockedLines.end() && --maxIter > 0);
-                        if (maxIter == 0) {
-                            cout << "Can't replace line using FIFO, infinite loop" << endl;
-                            for (auto x : this->lockedLines) {
-                                cout << x << endl;
-                            }
-                            printCache();
-                            exit(1);
-                        }
-                    }
-                    break;
-                case RANDOM:
-                    idx = getRandomIndex(idx);
-                    dout << "random idx: " << idx << endl;
-                    break;
-                case SMALLEST:
-                    idx = getSmallestDataLine(idx);
-                    dout << "smallest idx: " << idx << endl;
-                    break;
-                default:
-                    dout << "Replacement policy not implemented" << endl;
-                    break;
-            }
-        } 
-        else if (find(this->lockedLines.begin(), this->lockedLines.end(), idx) != this->lockedLines.end()) 
+        idx = visitCacheDirectory(this->directory, this->organisation, this->replacementPolicy, this->write_back, VictimVisitor{tag, this->lockedLines});
+        if (idx == -1)
         {
-            int randomInt;
-            do {
-                randomInt = rand();
-                idx = randomInt % this->nrOfLines;
-            } // Repeat until we find an index that is not locked
-            while(find(this->lockedLines.begin(), this->lockedLines.end(), idx) != this->lockedLines.end());
+            // The caller transfers the data without caching it
+            dout << "addToCache: Can't replace line, all candidates are locked" << endl;
+            return idx;
         }
-        
     }
     // cout << "write back: " << write_back << endl;
-    if (this->write_back && this->lines[idx].flag == GPU) 
+    retireEvictions(false);
+    if (this->mode == ACTIVE && visitCacheDirectory(this->directory, this->organisation, this->replacementPolicy, this->write_back, WriteBackVisitor{idx})) 
     {
         dout << "Replacing cache line and writing back" << endl;
-        // Write back to device
-        cl_event myevent;
-        
-        clEnqueueReadBuffer(this->cache_command_queue, this->lines[idx].deviceAddress, CL_TRUE, 0, this->lines[idx].size, this->lines[idx].tag, 0, NULL, &myevent);
-        this->duration.bytesSaved -= this->lines[idx].size;
-
-        this->duration.deviceToHost += probe_event_time(myevent, this->cache_command_queue);
-        this->lines[idx].flag = BOTH;        
+        // Write back to host in the background, the old buffer is released once that is done
+        evictLine(idx);
     } 
+    else if (this->lines[idx].fenced)
+    {
+        unfenceLine(idx);
+    }
 
     if (this->lines[idx].deviceAddress != deviceAddress 
         && this->lines[idx].deviceAddress != nullptr)
     {
         // There is an old buffer on this cache line, so free that first to avoid memory leaks.
+        auto line = this->deviceLines.find(this->lines[idx].deviceAddress);
+        if (line != this->deviceLines.end() && line->second == idx) this->deviceLines.erase(line);
+
         buffers--;
         clReleaseMemObject(this->lines[idx].deviceAddress);
     }
+    if (deviceAddress != nullptr && this->lines[idx].deviceAddress != deviceAddress) 
+    {
+        // The cache keeps its own reference, the application releases its reference as usual
+        clRetainMemObject(deviceAddress);
+        this->deviceLines[deviceAddress] = idx;
+    }
     
     this->lockedLines.push_back(idx);
-    this->lines[idx].flag = flag;
     this->lines[idx].age = 0;
     this->lines[idx].tag = (void*) tag;
     this->lines[idx].size = size;
     this->lines[idx].deviceAddress = deviceAddress;
-    return this->lines[idx];
+    if (this->lines[idx].parent != NULL) dropBlockParent(this->lines[idx].parent);
+    this->lines[idx].parent = NULL;
+    this->chunkHashes[idx].clear();
+    setLastWriter(idx, NULL);
+    setLineFlag(idx, flag);
+    stampLine(idx);
+    return idx;
 }
 
-/*! 
-    * \brief Get a random index within the set and return the cache index.
-    * \param idx The set index
-    * \return The random cache index
-    */
-int Cache::getRandomIndex(int setIndex) 
-{   
-    int randomInt, idx, maxIter = 1000;
-    do {
-        randomInt = rand();
-        idx = setIndex * nrOfLinesPerSet + randomInt % nrOfLinesPerSet;
-    } // Repeat until we find an index that is not locked
-    while(find(this->lockedLines.begin(), this->lockedLines.end(), idx) != this->lockedLines.end() && --maxIter > 0);
-
-    if (maxIter == 0) {
-        cout << "Can't replace line using random, infinite loop" << endl;
-        for (auto x : this->lockedLines) {
-            cout << x << endl;
-        }
-        printCache();
-        exit(1);
-    }
+/*!
+    * \brief Hash the host data of a cache line per DELTA_CHUNK_SIZE chunk. 
+    * Should only be called when the host and device data of the line are equal.
+    * \param idx The index of the cache line
+    */
+void Cache::updateChunkHashes(int idx)
+{
+#if DELTA_UPLOAD
+    std::vector<uint64_t> &hashes = this->chunkHashes[idx];
+    const unsigned char *host = (const unsigned char *) this->lines[idx].tag;
+    const size_t size = this->lines[idx].size;
 
-    return idx;
+    hashes.resize((size + DELTA_CHUNK_SIZE - 1) / DELTA_CHUNK_SIZE);
+    for (size_t chunk = 0; chunk < hashes.size(); ++chunk)
+    {
+        const size_t start = chunk * DELTA_CHUNK_SIZE;
+        hashes[chunk] = hashChunk(host + start, min((size_t) DELTA_CHUNK_SIZE, size - start));
+    }
+#endif
 }
 
-int Cache::getOldestIndex(int setIndex, bool increaseAge)
+/*!
+    * \brief Upload only the chunks of a CPU-dirty line whose hash differs from the one on the device.
+    * Consecutive changed chunks are merged into a single write. The writes do not depend on each other, 
+    * so they all wait for the wait list of the application and one marker event covers them.
+    * \param command_queue The OpenCL command queue
+    * \param idx The index of the cache line
+    * \param blocking_write Blocking write, waits for the marker
+    * \param num_events_in_wait_list The number of events in the wait list
+    * \param event_wait_list The event wait list
+    * \param event The marker event that completes when every write has completed
+    * \return The error code
+    */
+cl_int Cache::enqueueDeltaWrite(
+    cl_command_queue command_queue, 
+    int idx, 
+    cl_bool blocking_write, 
+    cl_uint num_events_in_wait_list, 
+    const cl_event *event_wait_list, 
+    cl_event *event)
 {
-    int oldestLineIndex = -1;
-    int oldestLineAge = -1;
+    std::vector<uint64_t> &hashes = this->chunkHashes[idx];
+    const unsigned char *host = (const unsigned char *) this->lines[idx].tag;
+    const size_t size = this->lines[idx].size;
+    const size_t nrOfChunks = hashes.size();
 
-    const int offset = setIndex * this->nrOfLinesPerSet;
-    const int end = offset + this->nrOfLinesPerSet;
-    for (int idx = offset; idx < end; ++idx)
+    cl_int err = CL_SUCCESS;
+    size_t bytesUploaded = 0;
+    size_t chunk = 0;
+    std::vector<cl_event> writeEvents;
+    while (chunk < nrOfChunks)
     {
-        if (this->lines[idx].age > oldestLineAge)
+        // Find the next run of changed chunks
+        size_t first = chunk;
+        for (; first < nrOfChunks; ++first)
         {
-            // Make sure that this line is not locked
-            if (find(this->lockedLines.begin(), this->lockedLines.end(), idx) != this->lockedLines.end()) 
-                continue;
+            const size_t start = first * DELTA_CHUNK_SIZE;
+            const uint64_t hash = hashChunk(host + start, min((size_t) DELTA_CHUNK_SIZE, size - start));
+            if (hash != hashes[first])
+            {
+                hashes[first] = hash;
+                break;
+            }
+        }
+        if (first == nrOfChunks) break;
 
-            oldestLineAge = this->lines[idx].age;
-            oldestLineIndex = idx;
+        size_t last = first + 1;
+        for (; last < nrOfChunks; ++last)
+        {
+            const size_t start = last * DELTA_CHUNK_SIZE;
+            const uint64_t hash = hashChunk(host + start, min((size_t) DELTA_CHUNK_SIZE, size - start));
+            if (hash == hashes[last]) break;
+            hashes[last] = hash;
         }
 
-        if (increaseAge) 
-            this->lines[idx].age += 1;
-    }
+        const size_t start = first * DELTA_CHUNK_SIZE;
+        const size_t cb = min(last * DELTA_CHUNK_SIZE, size) - start;
+        cl_event myevent;
+        cl_int writeErr = clEnqueueWriteBuffer(
+            command_queue, 
+            this->lines[idx].deviceAddress, 
+            CL_FALSE, 
+            start, 
+            cb, 
+            host + start, 
+            num_events_in_wait_list, 
+            event_wait_list, 
+            &myevent
+        );
+        if (writeErr == CL_SUCCESS) 
+        {
+            writeEvents.push_back(myevent);
+            bytesUploaded += cb;
+        }
+        else
+        {
+            printf("Error: Failed to write chunk %zu of line %d: %s\n", first, idx, getErrorString(writeErr).c_str());
+            err = writeErr;
+        }
 
-    if (oldestLineIndex == -1) {
-        dout << "Can't replace line using FIFO/LRU, replace a random line" << endl;
-        oldestLineIndex = getRandomIndex(setIndex);
+        // The chunk that ended the run is unchanged, no need to hash it again
+        chunk = last + 1;
     }
-    return oldestLineIndex;
-}
+    // The hashes no longer describe the device data, the next upload is a full one
+    if (err != CL_SUCCESS) hashes.clear();
 
-int Cache::getSmallestDataLine(int setIndex)
-{
-    int smallestLineIndex = -1;
-    int smallestLineSize = -1;
+    // Without changed chunks the marker only waits for the wait list of the application
+    cl_event marker;
+    cl_int markerErr = clEnqueueMarkerWithWaitList(
+        command_queue, 
+        writeEvents.empty() ? num_events_in_wait_list : writeEvents.size(), 
+        writeEvents.empty() ? event_wait_list : writeEvents.data(), 
+        &marker
+    );
+    for (auto writeEvent : writeEvents) profileEvent(writeEvent, command_queue, this->duration.hostToDevice, true);
 
-    const int offset = setIndex * this->nrOfLinesPerSet;
-    const int end = offset + this->nrOfLinesPerSet;
-    for (int idx = offset; idx < end; ++idx)
+    if (markerErr != CL_SUCCESS)
     {
-        if (this->lines[idx].size < smallestLineSize)
-        {
-            // Make sure that this line is not locked
-            if (find(this->lockedLines.begin(), this->lockedLines.end(), idx) != this->lockedLines.end()) 
-                continue;
-
-            smallestLineSize = this->lines[idx].size;
-            smallestLineIndex = idx;
-        }
+        printf("Error: Failed to enqueue the marker of line %d: %s\n", idx, getErrorString(markerErr).c_str());
+        // Nothing to return, so the writes have to be complete
+        clFinish(command_queue);
+        if (event != NULL) *event = NULL;
+        return markerErr;
     }
 
-    if (smallestLineIndex == -1) {
-        cout << "Can't replace line using FIFO/LRU, replace a random line" << endl;
-        smallestLineIndex = getRandomIndex(setIndex);
-    }
-    return smallestLineIndex;
+    setLastWriter(idx, marker);
+    if (blocking_write) clWaitForEvents(1, &marker);
+    if (event != NULL) 
+        *event = marker;
+    else 
+        clReleaseEvent(marker);
+
+    dout << "enqueueDeltaWrite: uploaded " << bytesUploaded << " of " << size << " bytes" << endl;
+    this->duration.bytesSaved += size - bytesUploaded;
+    this->duration.bytesh2d_saved += size - bytesUploaded;
+    return err;
 }
@@ -10,20 +10,30 @@
 #include <time.h>
 #include <assert.h>
 
+#ifdef __unix__
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
 #include <utils.hpp>
+#include <cachecore.hpp>
 
 #include <iostream>
 #include <fstream>
 #include <iomanip>      // std::setw
 #include <unordered_map>
 #include <unordered_set>
+#include <atomic>
 
 // Settings
 #define DEBUG           0
 #define TIMING          1
-#ifndef CACHE_ENABLED   // Can be overriden by compiler
-#define CACHE_ENABLED   1
-#endif
+#define DELTA_UPLOAD        1               // Only re-upload the changed chunks of CPU-dirty lines
+#define DELTA_CHUNK_SIZE    (64 * 1024)     // Granularity of the chunk hashes in bytes
+#define MEMO_ENTRIES        4               // Launches remembered per memoised kernel
 
 struct durations_t {
     unsigned long long hostToDevice;
@@ -31,6 +41,9 @@ struct durations_t {
     unsigned long long kernel;
     unsigned int cacheHit;
     unsigned int cacheMiss;
+    unsigned int d2hHit;        // Reads served from the host copy
+    unsigned int kernelsElided; // Launches of memoised kernels that were skipped
+    unsigned int unfencedLines; // GPU-dirty lines lazy coherence could not fence, they do not cover whole pages
     size_t bytesSaved;
     size_t bytesTotal;
     size_t bytesh2d_saved;
@@ -72,36 +85,53 @@ struct durations_t {
     #define STOP_TIMER
 #endif // TIMING
 
-enum Flag {
-    CPU,
-    GPU,
-    BOTH
+struct KernelArgument {
+    cl_mem buffer;      // The buffer bound to this argument, nullptr otherwise
+    cl_mem proxy;       // The virtual buffer the application bound, resolved again at every launch
+    bool written;       // The kernel can write to the bound buffer
+    bool writable;      // The kernel may write to this argument (also true if unknown)
+    bool global;        // The argument is known to be a __global or __constant pointer
+    bool scalar;        // The argument is known not to be a buffer
+    size_t size;        // The size of the argument value, 0 while the argument was not set through the cache
+    std::vector<unsigned char> value;   // The bytes of an argument that is not a buffer
 };
 
-struct CacheLine {
-    Flag flag;
-    int age;
-    size_t size;
+struct KernelLaunch {
+    std::string signature;                      // The NDRange, the other argument bytes and the sizes of the written buffers
+    std::vector<unsigned long long> versions;   // The versions of the lines of the buffers the kernel only reads
+    std::vector<cl_mem> outputs;                // The written buffers, retained while the launch is remembered
+};
+
+struct PendingEviction {
     void *tag;
-    cl_mem deviceAddress;
+    size_t size;
+    cl_mem deviceAddress;   // Released when the write back has completed, nullptr afterwards
+    cl_event event;         // The write back into the staging buffer, nullptr once it has completed
+    void *staging;          // Destination of the write back, copied to the host when the range is used again
+    bool fenced;            // The host range stays fenced until the staged data is copied
 };
 
-enum Organisation {
-    DIRECT_MAPPING,
-    SET_ASSOCIATIVE,
-    FULLY_ASSOCIATIVE
+struct VirtualBuffer {
+    cl_context context;
+    cl_mem_flags flags;
+    size_t size;
+    void *host_ptr;         // Only used with CL_MEM_USE_HOST_PTR
+    cl_mem binding;         // The device buffer, nullptr until a transfer or kernel argument needs one
+    cl_uint references;     // The references of the application
 };
 
-enum ReplacementPolicy {
-    LRU,
-    FIFO,
-    RANDOM,
-    SMALLEST
+enum CacheMode {
+    ACTIVE,         // Transfers are served from the cache
+    PASS_THROUGH,   // Every call is forwarded
+    SHADOW          // Every call is forwarded, a simulated cache accounts what would have hit
 };
 
 class Cache {
     private:
-        std::unordered_map<cl_kernel, std::unordered_set<const void*>> kernelArguments; // < pointer to kernel, set of pointers to CL buffers >
+        std::unordered_map<cl_kernel, std::vector<KernelArgument>> kernelArguments; // < pointer to kernel, argument table indexed by argument index >
+        std::unordered_map<cl_mem, int> deviceLines;                                // < device buffer, index of the cache line holding it >
+        std::unordered_map<cl_mem, cl_event> lastKernel;                            // < device buffer, last kernel using it, only tracked when transfers overlap >
+        std::unordered_map<cl_kernel, std::vector<KernelLaunch>> memoTable;        // < memoised kernel, its last launches >
 
         int nrOfSets;
         int nrOfLines;
@@ -110,37 +140,207 @@ class Cache {
         enum Organisation organisation;
         enum ReplacementPolicy replacementPolicy;
         CacheLine *lines;
-        vector<unsigned int> FIFO_index;
+        CacheDirectory *directory;      // < lookup and replacement, specialised for the configuration >
+        CacheMode mode;
 
         cl_command_queue cache_command_queue;
+        std::vector<cl_command_queue> transferQueues;       // < queues owned by the cache, used for background transfers >
+        std::vector<PendingEviction> pendingEvictions;      // < evicted lines that are still being written back >
 
-        std::vector<unsigned int> lockedLines;
+        std::vector<std::vector<uint64_t>> chunkHashes; // < per cache line, the hash of every DELTA_CHUNK_SIZE chunk as it is on the device >
 
-        bool isPrime(int n);
-        
-        int getTableSize(int n);
-        int getSetIndex(const void *tag);
+        std::vector<unsigned int> lockedLines;
 
-        CacheLine addToCache(const void *tag, size_t size, cl_mem deviceAddress, Flag flag, int idx = -1);
+        int addToCache(const void *tag, size_t size, cl_mem deviceAddress, Flag flag, int idx = -1);
         CacheLine* getCacheLine(const void *tag);
         void replaceCacheLine(const void *tag, size_t size, cl_mem deviceAddress);
 
-        // Helper functions for replacement policies
-        int getRandomIndex(int setIndex);
-        int getOldestIndex(int setIndex, bool increaseAge = false);
-        int getSmallestDataLine(int setIndex);
+        std::vector<KernelArgument>& getKernelArguments(cl_kernel kernel);
+        void setLineFlag(int idx, Flag flag);
+
+        // Kernel memoisation, a launch is skipped when it reads the same data as an earlier launch, whose results are copied
+        unsigned long long versionClock;
+        void stampLine(int idx);
+        bool getKernelLaunch(
+            cl_kernel kernel, 
+            cl_uint work_dim, 
+            const size_t *global_work_offset, 
+            const size_t *global_work_size, 
+            const size_t *local_work_size, 
+            KernelLaunch &launch
+        );
+        cl_int replayKernelLaunch(
+            cl_command_queue command_queue, 
+            const KernelLaunch &previous, 
+            const KernelLaunch &launch, 
+            cl_uint num_events_in_wait_list, 
+            const cl_event *event_wait_list, 
+            cl_event *event
+        );
+        void forgetKernelLaunches(cl_mem buffer);
+        void clearKernelLaunches(std::vector<KernelLaunch> &launches);
+        void bindProxyArguments(cl_kernel kernel);
+        cl_int readBackLine(int idx);
+
+        // Asynchronous eviction
+        cl_command_queue getTransferQueue(unsigned int i = 0);
+        void evictLine(int idx);
+        cl_int flushLines(const std::vector<int> &dirtyLines);
+        unsigned int nrOfFlushQueues;
+
+        // Overlap of transfers and kernels, events are profiled when they have completed
+        bool overlap_transfers;
+        std::vector<std::pair<cl_event, unsigned long long*>> pendingProfiles;
+        void profileEvent(cl_event event, cl_command_queue command_queue, unsigned long long &duration, bool defer = false);
+        void collectProfiles(bool wait);
+        void setLastWriter(int idx, cl_event event);
+        void appendLastWriter(std::vector<cl_event> &waitList, cl_mem buffer);
+
+        // Pipelined uploads, large lines are uploaded in chunks on alternating transfer queues
+        size_t pipelineChunkSize;
+        std::vector<std::vector<cl_event>> chunkEvents;    // < per cache line, the upload event of every chunk >
+        void clearChunkEvents(int idx);
+        cl_int enqueuePipelinedWrite(int idx, cl_bool blocking_write, const std::vector<cl_event> &waitList, cl_event *event);
+        // Pass-through and shadow mode, the lines only hold metadata and the application keeps its buffers
+        std::vector<cl_mem> shadowBuffers;      // < per cache line, the application buffer the simulated line stands for >
+        void setShadowBuffer(int idx, cl_mem buffer);
+        int shadowTransfer(const void *ptr, size_t cb, cl_mem buffer, bool toDevice);
+        cl_mem passThroughCreateBuffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *errcode_ret);
+        cl_int passThroughWriteBuffer(
+            cl_command_queue command_queue, 
+            cl_mem buffer, cl_bool blocking_write, 
+            size_t offset, 
+            size_t cb, 
+            const void *ptr, 
+            cl_uint num_events_in_wait_list, 
+            const cl_event *event_wait_list, 
+            cl_event *event
+        );
+        cl_int passThroughReadBuffer(
+            cl_command_queue command_queue,
+            cl_mem buffer, cl_bool blocking_read,
+            size_t offset,
+            size_t cb,
+            void *ptr,
+            cl_uint num_events_in_wait_list,
+            const cl_event *event_wait_list,
+            cl_event *event
+        );
+
+        // Virtual buffers, createBuffer returns a proxy that is bound to a device buffer on first use.
+        // Off by default, a proxy is not an OpenCL buffer and may only be passed back to the cache.
+        bool virtual_buffers;
+        std::unordered_map<cl_mem, VirtualBuffer*> virtualBuffers;     // < proxy handle, the buffer it stands for >
+        VirtualBuffer* getVirtualBuffer(cl_mem buffer);
+        cl_mem getBinding(VirtualBuffer *proxy);
+        void bindVirtualBuffer(VirtualBuffer *proxy, cl_mem buffer);
+        void bindForWrite(VirtualBuffer *proxy, const void *ptr, size_t cb);
+        void setArgumentBuffer(KernelArgument &argument, cl_mem buffer);
+
+        // Block granular caching, large buffers are cached as blocks that are sub-buffers of an assembled buffer
+        size_t blockSize;
+        std::unordered_map<cl_mem,int> blockParents;    // < assembled buffer, number of blocks in it >
+        bool isBlocked(size_t offset, size_t cb);
+        void setBlockBuffer(int idx, cl_mem parent, size_t offset);
+        void dropBlockParent(cl_mem parent);
+        void markBlocks(cl_mem parent, cl_event event);
+        cl_int enqueueBlockWrite(
+            cl_command_queue command_queue, 
+            cl_mem *buffer, cl_bool blocking_write, 
+            size_t cb, 
+            const void *ptr, 
+            cl_uint num_events_in_wait_list, 
+            const cl_event *event_wait_list, 
+            cl_event *event
+        );
+        cl_int enqueueBlockRead(
+            cl_command_queue command_queue,
+            cl_mem buffer, cl_bool blocking_read,
+            size_t cb,
+            void *ptr,
+            cl_uint num_events_in_wait_list,
+            const cl_event *event_wait_list,
+            cl_event *event
+        );
+
+        cl_int launchKernel(
+            cl_command_queue command_queue,
+            cl_kernel kernel,
+            cl_uint work_dim,
+            const size_t *global_work_offset,
+            const size_t *global_work_size,
+            const size_t *local_work_size,
+            cl_uint num_events_in_wait_list,
+            const cl_event *event_wait_list,
+            cl_event *event,
+            cl_mem streamed_buffer
+        );
+        void retireEvictions(bool wait);
+        void retireEviction(PendingEviction &eviction);
+        void settleEviction(size_t i, const void *newer = nullptr, size_t newerSize = 0);
+        void settleEvictions();
+        void dropEvictions();
+        void waitForEvictions(const void *ptr, size_t size);
+        void discardEvictions(const void *ptr, size_t size);
+
+        bool write_back;    // Only changed together with the directory, see setWriteBack
+
+        // Lazy coherence, host pages of GPU-dirty lines are protected and read back on first access.
+        // Only lines that start on a page and span whole pages are covered, see setLazyCoherence.
+        bool lazy_coherence;
+        uintptr_t pageSize;
+        static Cache *lazyCoherenceCache;
+#ifdef __unix__
+        static struct sigaction previousFaultHandler;
+        static int faultRequests[2];        // The fault handler sends the faulting address to the fault service thread
+        static int faultReplies[2];         // and blocks until the thread has answered whether the fault is resolved
+        static pthread_t faultService;
+        static std::atomic_flag faultLock;  // One faulting thread at a time
+        static void handleFault(int sig, siginfo_t *info, void *context);
+        static void forwardFault(int sig, siginfo_t *info, void *context);
+        static void *serveFaults(void *cache);
+        bool startFaultService();
+        void stopFaultService();
+#endif
+        void getPageRange(int idx, uintptr_t &start, uintptr_t &end);
+        bool fenceLine(int idx);
+        void unfenceLine(int idx);
+        void unfenceRange(const void *ptr, size_t size);
+        bool resolveFault(const void *address);
+
+        // Helper functions for delta uploads
+        void updateChunkHashes(int idx);
+        cl_int enqueueDeltaWrite(
+            cl_command_queue command_queue, 
+            int idx, 
+            cl_bool blocking_write, 
+            cl_uint num_events_in_wait_list, 
+            const cl_event *event_wait_list, 
+            cl_event *event
+        );
 
         void initialise(Organisation organisation, ReplacementPolicy replacementPolicy, int cacheSize, int linesPerSet, bool write_back = false);
 
         durations_t duration; 
         
-
     public:
         Cache(Organisation organisation, ReplacementPolicy replacementPolicy, int cacheSize, int linesPerSet = 1, bool write_back = false);
         Cache(int argc, char** argv);
         ~Cache();
 
         cl_mem createBuffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *errcode_ret);
+        cl_int retainMemObject(cl_mem memobj);
+        cl_int releaseMemObject(cl_mem memobj);
+        cl_int enqueueWriteBuffer(
+            cl_command_queue command_queue, 
+            cl_mem buffer, cl_bool blocking_write, 
+            size_t offset, 
+            size_t cb, 
+            const void *ptr, 
+            cl_uint num_events_in_wait_list, 
+            const cl_event *event_wait_list, 
+            cl_event *event
+        );
         cl_int enqueueWriteBuffer(
             cl_command_queue command_queue, 
             cl_mem *buffer, cl_bool blocking_write, 
@@ -175,18 +375,55 @@ class Cache {
             const cl_event *event_wait_list,
             cl_event *event
         );
+        cl_int enqueueNDRangeKernelPipelined(
+            cl_command_queue command_queue,
+            cl_kernel kernel,
+            cl_uint work_dim,
+            const size_t *global_work_offset,
+            const size_t *global_work_size,
+            const size_t *local_work_size,
+            const void *streamed_ptr,
+            size_t bytes_per_item,
+            cl_uint num_events_in_wait_list,
+            const cl_event *event_wait_list,
+            cl_event *event
+        );
         cl_int writeBack();                 // Write everything back to host
         cl_int writeBack(void *host_ptr);   // Write specific buffer back to host
+        cl_int writeBack(void * const *host_ptrs, size_t count);   // Write a set of buffers back to host in one batch
+        cl_int finish(cl_command_queue command_queue);              // clFinish, then copy the data of evicted lines to the host
+        void setFlushQueues(unsigned int count);
+        void setTransferOverlap(bool enable = true);
+        bool getTransferOverlap();
+        void setPipelining(size_t chunkSize);
+        void setBlockSize(size_t size);
+        void setVirtualBuffers(bool enable = true);
+        bool getVirtualBuffers();
+        void setMemoisation(cl_kernel kernel, bool enable = true);
+        const std::vector<cl_event>& getChunkEvents(const void *ptr);
 
         void setDirtyFlag(const void *tag, Flag flag = CPU);
+        void setDirtyRange(const void *ptr, size_t size, Flag flag = CPU);
+        int setLazyCoherence(bool enable = true);
+        void setMode(CacheMode mode);
+        CacheMode getMode();
+        void setWriteBack(bool enable = true);
+        bool getWriteBack();
+
+        int getNrOfLines();
+        const CacheLine& getLine(int idx);
+        int simulateTransfer(const void *ptr, size_t cb, cl_mem buffer, bool toDevice);
+        static bool isPrime(int n);
+        static int getTableSize(int n);
+        unsigned long long getVersion(const void *ptr, size_t size);
 
         void printCache();
         void printTimeProfile();
         void writeTimeProfileToFile(vector<string> other_info) ;
         void resetCache();
         void resetTimers();
+        durations_t getDurations();
 
-        bool write_back;
         unsigned int buffers;
 };
 
@@ -0,0 +1,99 @@
+#include <tests.hpp>
+
+#include <vector>
+
+using namespace std;
+
+/*!
+    * \brief Read a device buffer around the cache
+    */
+static vector<float> readDevice(const TestDevice &device, cl_mem buffer, size_t count)
+{
+    vector<float> data(count, -1.0f);
+    clEnqueueReadBuffer(device.queue, buffer, CL_TRUE, 0, count * sizeof(float), data.data(), 0, NULL, NULL);
+    return data;
+}
+
+/*!
+    * \brief Delta uploads: the hash notices moved data, a partial update reaches the device 
+    * and the write returns an event that covers it, as does a write that hits.
+    */
+void testDeltaUpload(const TestDevice &device)
+{
+    printf("Delta upload\n");
+
+    // Two swapped blocks of 8 floats change the hash, also far apart
+    vector<float> blocks(4096);
+    for (size_t i = 0; i < blocks.size(); ++i) blocks[i] = (float) (i % 37);
+    const uint64_t original = hashChunk(blocks.data(), blocks.size() * sizeof(float));
+    vector<float> swapped = blocks;
+    for (int i = 0; i < 8; ++i) std::swap(swapped[i], swapped[8 + i]);
+    CHECK(hashChunk(swapped.data(), swapped.size() * sizeof(float)) != original);
+    swapped = blocks;
+    for (int i = 0; i < 8; ++i) std::swap(swapped[i], swapped[8 * 200 + i]);
+    CHECK(hashChunk(swapped.data(), swapped.size() * sizeof(float)) != original);
+
+    // Four chunks, only the third one changes
+    const size_t count = 4 * DELTA_CHUNK_SIZE / sizeof(float);
+    const size_t bytes = count * sizeof(float);
+    vector<float> host(count);
+    for (size_t i = 0; i < count; ++i) host[i] = (float) i;
+
+    // Plain buffers, so the device data can be read around the cache
+    Cache *cache = new Cache(FULLY_ASSOCIATIVE, LRU, 4);
+    cache->setVirtualBuffers(false);
+    cl_int err;
+    cl_mem buffer = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    err = cache->enqueueWriteBuffer(device.queue, buffer, CL_TRUE, 0, bytes, host.data(), 0, NULL, NULL);
+    CHECK(err == CL_SUCCESS);
+
+    const size_t changed = 2 * DELTA_CHUNK_SIZE / sizeof(float) + 5;
+    host[changed] = -42.0f;
+    cache->setDirtyFlag(host.data(), CPU);
+
+    cl_event event = NULL;
+    err = cache->enqueueWriteBuffer(device.queue, buffer, CL_FALSE, 0, bytes, host.data(), 0, NULL, &event);
+    CHECK(err == CL_SUCCESS);
+    CHECK(event != NULL);
+    if (event != NULL)
+    {
+        CHECK(clWaitForEvents(1, &event) == CL_SUCCESS);
+        clReleaseEvent(event);
+    }
+
+    vector<float> device_data = readDevice(device, buffer, count);
+    CHECK(device_data == host);
+    durations_t durations = cache->getDurations();
+    CHECK(durations.bytesh2d_saved >= 3 * DELTA_CHUNK_SIZE);
+
+    // The same update again without a changed chunk still returns an event
+    cache->setDirtyFlag(host.data(), CPU);
+    event = NULL;
+    err = cache->enqueueWriteBuffer(device.queue, buffer, CL_TRUE, 0, bytes, host.data(), 0, NULL, &event);
+    CHECK(err == CL_SUCCESS);
+    CHECK(event != NULL);
+    if (event != NULL) clReleaseEvent(event);
+
+    // A hit on another buffer copies the cached data into it, the event of the write covers the copy.
+    // The data is read on a second queue, which only waits for what the event waits for.
+    cl_mem other = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    event = NULL;
+    err = cache->enqueueWriteBuffer(device.queue, other, CL_FALSE, 0, bytes, host.data(), 0, NULL, &event);
+    CHECK(err == CL_SUCCESS);
+    CHECK(event != NULL);
+    if (event != NULL)
+    {
+        CHECK(clWaitForEvents(1, &event) == CL_SUCCESS);
+        clReleaseEvent(event);
+
+        cl_command_queue queue = clCreateCommandQueue(device.ctx, device.device, 0, &err);
+        vector<float> copied(count, -1.0f);
+        clEnqueueReadBuffer(queue, other, CL_TRUE, 0, bytes, copied.data(), 0, NULL, NULL);
+        CHECK(copied == host);
+        clReleaseCommandQueue(queue);
+    }
+
+    cache->releaseMemObject(other);
+    cache->releaseMemObject(buffer);
+    delete cache;
+}
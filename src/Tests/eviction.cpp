@@ -0,0 +1,98 @@
+#include <tests.hpp>
+
+#include <vector>
+
+using namespace std;
+
+/*!
+    * \brief Upload a host array and increment it on the device, the kernel releases the locks of the cache
+    */
+static cl_int uploadAndIncrement(Cache *cache, const TestDevice &device, cl_kernel increment, cl_mem buffer, vector<float> &host)
+{
+    const size_t count = host.size();
+    cl_int err = cache->enqueueWriteBuffer(device.queue, buffer, CL_TRUE, 0, count * sizeof(float), host.data(), 0, NULL, NULL);
+    err |= cache->setKernelArg(increment, 0, sizeof(cl_mem), &buffer);
+    err |= cache->enqueueNDRangeKernel(device.queue, increment, 1, NULL, &count, NULL, 0, NULL, NULL);
+    return err;
+}
+
+/*!
+    * \brief Asynchronous eviction: the write back of an evicted line is staged and copied to the host
+    * at a sync point, after which the host can overwrite the range and upload it again.
+    */
+void testEviction(const TestDevice &device)
+{
+    printf("Eviction\n");
+
+    const size_t count = 1024;
+    const size_t bytes = count * sizeof(float);
+    vector<float> a(count), b(count, 1.0f), c(count, 2.0f), d(count, 3.0f), e(count, 4.0f), result(count);
+    for (size_t i = 0; i < count; ++i) a[i] = (float) i;
+
+    // Two lines, the third buffer evicts the least recently used one
+    Cache *cache = new Cache(FULLY_ASSOCIATIVE, LRU, 2, 1, true);
+    cl_kernel increment = createTestKernel(device, "increment");
+
+    cl_int err;
+    cl_mem bufferA = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    cl_mem bufferB = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    cl_mem bufferC = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    cl_mem bufferD = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    cl_mem bufferE = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+
+    // c evicts the GPU-dirty line of a, finish copies the staged data to the host
+    err = uploadAndIncrement(cache, device, increment, bufferA, a);
+    err |= uploadAndIncrement(cache, device, increment, bufferB, b);
+    err |= uploadAndIncrement(cache, device, increment, bufferC, c);
+    CHECK(err == CL_SUCCESS);
+    CHECK(cache->finish(device.queue) == CL_SUCCESS);
+    CHECK(a[1] == 2.0f && a[count - 1] == (float) count);
+
+    // a evicts b, d evicts c and e evicts a, then the host overwrites a after the sync and uploads it again
+    err = uploadAndIncrement(cache, device, increment, bufferA, a);
+    err |= uploadAndIncrement(cache, device, increment, bufferD, d);
+    err |= uploadAndIncrement(cache, device, increment, bufferE, e);
+    err |= cache->finish(device.queue);
+    CHECK(a[1] == 3.0f);
+    for (size_t i = 0; i < count; ++i) a[i] = -1.0f;
+    err |= cache->enqueueWriteBuffer(device.queue, bufferA, CL_TRUE, 0, bytes, a.data(), 0, NULL, NULL);
+    CHECK(err == CL_SUCCESS);
+    CHECK(a[1] == -1.0f);
+
+    // With write back the read only maps the result, the data arrives with its write back
+    err = cache->enqueueReadBuffer(device.queue, bufferA, CL_TRUE, 0, bytes, result.data(), 0, NULL, NULL);
+    err |= cache->writeBack(result.data());
+    CHECK(err == CL_SUCCESS);
+    CHECK(result == a);
+
+    cache->releaseMemObject(bufferA);
+    cache->releaseMemObject(bufferB);
+    cache->releaseMemObject(bufferC);
+    cache->releaseMemObject(bufferD);
+    cache->releaseMemObject(bufferE);
+    delete cache;
+    clReleaseKernel(increment);
+
+    // One line, the second input of a kernel finds it locked by the first and is transferred without caching it
+    cache = new Cache(FULLY_ASSOCIATIVE, LRU, 1, 1, false);
+    cl_kernel add = createTestKernel(device, "add");
+    bufferA = cache->createBuffer(device.ctx, CL_MEM_READ_ONLY, bytes, NULL, &err);
+    bufferB = cache->createBuffer(device.ctx, CL_MEM_READ_ONLY, bytes, NULL, &err);
+    bufferC = cache->createBuffer(device.ctx, CL_MEM_WRITE_ONLY, bytes, NULL, &err);
+
+    err = cache->enqueueWriteBuffer(device.queue, bufferA, CL_TRUE, 0, bytes, a.data(), 0, NULL, NULL);
+    err |= cache->enqueueWriteBuffer(device.queue, bufferB, CL_TRUE, 0, bytes, b.data(), 0, NULL, NULL);
+    err |= cache->setKernelArg(add, 0, sizeof(cl_mem), &bufferA);
+    err |= cache->setKernelArg(add, 1, sizeof(cl_mem), &bufferB);
+    err |= cache->setKernelArg(add, 2, sizeof(cl_mem), &bufferC);
+    err |= cache->enqueueNDRangeKernel(device.queue, add, 1, NULL, &count, NULL, 0, NULL, NULL);
+    err |= cache->enqueueReadBuffer(device.queue, bufferC, CL_TRUE, 0, bytes, result.data(), 0, NULL, NULL);
+    CHECK(err == CL_SUCCESS);
+    CHECK(result[0] == a[0] + b[0] && result[count - 1] == a[count - 1] + b[count - 1]);
+
+    cache->releaseMemObject(bufferA);
+    cache->releaseMemObject(bufferB);
+    cache->releaseMemObject(bufferC);
+    delete cache;
+    clReleaseKernel(add);
+}
@@ -0,0 +1,78 @@
+#include <tests.hpp>
+
+#include <vector>
+
+using namespace std;
+
+/*!
+    * \brief Lazy coherence: a host access to a fenced line reads it back, 
+    * lines that do not cover whole pages are counted as unfenced and their neighbours stay accessible.
+    */
+void testLazyCoherence(const TestDevice &device)
+{
+#ifdef __unix__
+    printf("Lazy coherence\n");
+
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t count = 2 * pageSize / sizeof(float);
+    const size_t bytes = count * sizeof(float);
+    float *host = NULL;
+    float *shared = NULL;
+    if (posix_memalign((void **) &host, pageSize, bytes) != 0 || posix_memalign((void **) &shared, pageSize, pageSize) != 0)
+    {
+        CHECK(false);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) host[i] = (float) i;
+
+    // An unaligned line at the start of a page, the rest of the page belongs to other data
+    const size_t smallCount = 100;
+    float *neighbour = shared + smallCount;
+    for (size_t i = 0; i < smallCount; ++i) shared[i] = (float) i;
+
+    Cache *cache = new Cache(FULLY_ASSOCIATIVE, LRU, 4, 1, true);
+    cache->setLazyCoherence(true);
+    cl_kernel increment = createTestKernel(device, "increment");
+
+    cl_int err;
+    cl_mem buffer = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    cl_mem smallBuffer = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, smallCount * sizeof(float), NULL, &err);
+    err = cache->enqueueWriteBuffer(device.queue, buffer, CL_TRUE, 0, bytes, host, 0, NULL, NULL);
+    err |= cache->enqueueWriteBuffer(device.queue, smallBuffer, CL_TRUE, 0, smallCount * sizeof(float), shared, 0, NULL, NULL);
+    CHECK(err == CL_SUCCESS);
+
+    err = cache->setKernelArg(increment, 0, sizeof(cl_mem), &buffer);
+    err |= cache->enqueueNDRangeKernel(device.queue, increment, 1, NULL, &count, NULL, 0, NULL, NULL);
+    err |= cache->setKernelArg(increment, 0, sizeof(cl_mem), &smallBuffer);
+    err |= cache->enqueueNDRangeKernel(device.queue, increment, 1, NULL, &smallCount, NULL, 0, NULL, NULL);
+    CHECK(err == CL_SUCCESS);
+    CHECK(cache->getDurations().unfencedLines == 1);
+
+    // The neighbour shares a page with the unaligned line, it stays accessible
+    *neighbour = 7.0f;
+    CHECK(*neighbour == 7.0f);
+
+    // The first touch of the fenced line faults and reads the line back
+    CHECK(host[count - 1] == (float) count);
+    bool updated = true;
+    for (size_t i = 0; i < count; ++i) updated &= (host[i] == (float) i + 1.0f);
+    CHECK(updated);
+    host[0] = -1.0f;
+    CHECK(host[0] == -1.0f);
+
+    // The unaligned line follows the usual write back rules
+    cache->writeBack(shared);
+    updated = true;
+    for (size_t i = 0; i < smallCount; ++i) updated &= (shared[i] == (float) i + 1.0f);
+    CHECK(updated);
+    CHECK(*neighbour == 7.0f);
+
+    cache->setLazyCoherence(false);
+    cache->releaseMemObject(buffer);
+    cache->releaseMemObject(smallBuffer);
+    delete cache;
+    clReleaseKernel(increment);
+    free(host);
+    free(shared);
+#endif
+}
@@ -0,0 +1,72 @@
+#include <tests.hpp>
+
+#include <vector>
+
+using namespace std;
+
+/*!
+    * \brief Scale the input into a new output buffer through the cache and read the result
+    */
+static cl_int scaleInto(Cache *cache, const TestDevice &device, cl_kernel scale, cl_mem input, vector<float> &in, vector<float> &out)
+{
+    const size_t count = in.size();
+    const size_t bytes = count * sizeof(float);
+    const float factor = 3.0f;
+
+    cl_int err;
+    cl_mem output = cache->createBuffer(device.ctx, CL_MEM_WRITE_ONLY, bytes, NULL, &err);
+    err |= cache->enqueueWriteBuffer(device.queue, input, CL_TRUE, 0, bytes, in.data(), 0, NULL, NULL);
+    err |= cache->setKernelArg(scale, 0, sizeof(cl_mem), &input);
+    err |= cache->setKernelArg(scale, 1, sizeof(cl_mem), &output);
+    err |= cache->setKernelArg(scale, 2, sizeof(float), &factor);
+    err |= cache->enqueueNDRangeKernel(device.queue, scale, 1, NULL, &count, NULL, 0, NULL, NULL);
+    err |= cache->enqueueReadBuffer(device.queue, output, CL_TRUE, 0, bytes, out.data(), 0, NULL, NULL);
+    cache->releaseMemObject(output);
+    return err;
+}
+
+/*!
+    * \brief Kernel memoisation: a launch on the same input data is skipped even with a new output buffer,
+    * which gets the results of the earlier launch. A launch on changed input data runs.
+    */
+void testMemoisation(const TestDevice &device)
+{
+    printf("Memoisation\n");
+
+    const size_t count = 1024;
+    vector<float> in(count), out(count), expected(count);
+    for (size_t i = 0; i < count; ++i) in[i] = (float) i;
+
+    // The buffers only pass through the cache, the new output buffers are proxies bound on first use
+    Cache *cache = new Cache(FULLY_ASSOCIATIVE, LRU, 8);
+    cache->setVirtualBuffers(true);
+    cl_kernel scale = createTestKernel(device, "scale");
+    cache->setMemoisation(scale);
+
+    cl_int err;
+    cl_mem input = cache->createBuffer(device.ctx, CL_MEM_READ_ONLY, count * sizeof(float), NULL, &err);
+    err = scaleInto(cache, device, scale, input, in, out);
+    CHECK(err == CL_SUCCESS);
+    CHECK(cache->getDurations().kernelsElided == 0);
+    for (size_t i = 0; i < count; ++i) expected[i] = in[i] * 3.0f;
+    CHECK(out == expected);
+
+    // The same input, the results are copied into the new output buffer
+    std::fill(out.begin(), out.end(), -1.0f);
+    err = scaleInto(cache, device, scale, input, in, out);
+    CHECK(err == CL_SUCCESS);
+    CHECK(cache->getDurations().kernelsElided == 1);
+    CHECK(out == expected);
+
+    // A changed input runs the kernel
+    in[count - 1] = -7.0f;
+    cache->setDirtyFlag(in.data(), CPU);
+    err = scaleInto(cache, device, scale, input, in, out);
+    CHECK(err == CL_SUCCESS);
+    CHECK(cache->getDurations().kernelsElided == 1);
+    CHECK(out[count - 1] == -21.0f && out[0] == 0.0f);
+
+    cache->releaseMemObject(input);
+    delete cache;
+    clReleaseKernel(scale);
+}
@@ -0,0 +1,59 @@
+#include <tests.hpp>
+
+#include <vector>
+
+using namespace std;
+
+/*!
+    * \brief Pipelined uploads: kernels after a pipelined write in overlap mode wait for the chunks 
+    * they read, and the chunk events stay valid until the cache is done with them.
+    */
+void testPipelinedWrite(const TestDevice &device)
+{
+    printf("Pipelined write\n");
+
+    const size_t chunkSize = 16 * 1024;
+    const size_t count = 4 * chunkSize / sizeof(float);
+    const size_t bytes = count * sizeof(float);
+    vector<float> in(count), out(count), twice(count);
+    for (size_t i = 0; i < count; ++i) in[i] = (float) i;
+
+    Cache *cache = new Cache(FULLY_ASSOCIATIVE, LRU, 4);
+    cache->setPipelining(chunkSize);
+    cl_kernel scale = createTestKernel(device, "scale");
+
+    cl_int err;
+    cl_mem inBuffer = cache->createBuffer(device.ctx, CL_MEM_READ_ONLY, bytes, NULL, &err);
+    cl_mem outBuffer = cache->createBuffer(device.ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    cl_event written = NULL;
+    err = cache->enqueueWriteBuffer(device.queue, inBuffer, CL_FALSE, 0, bytes, in.data(), 0, NULL, &written);
+    CHECK(err == CL_SUCCESS);
+    CHECK(cache->getChunkEvents(in.data()).size() == 4);
+
+    const float factor = 2.0f;
+    err = cache->setKernelArg(scale, 0, sizeof(cl_mem), &inBuffer);
+    err |= cache->setKernelArg(scale, 1, sizeof(cl_mem), &outBuffer);
+    err |= cache->setKernelArg(scale, 2, sizeof(float), &factor);
+    err |= cache->enqueueNDRangeKernelPipelined(device.queue, scale, 1, NULL, &count, NULL, in.data(), sizeof(float), 0, NULL, NULL);
+    CHECK(err == CL_SUCCESS);
+
+    // Collects the profiles of the completed chunks while the line still holds their events
+    cache->getDurations();
+    err = cache->enqueueNDRangeKernelPipelined(device.queue, scale, 1, NULL, &count, NULL, in.data(), sizeof(float), 0, NULL, NULL);
+    CHECK(err == CL_SUCCESS);
+
+    err = cache->enqueueReadBuffer(device.queue, outBuffer, CL_TRUE, 0, bytes, out.data(), 0, NULL, NULL);
+    CHECK(err == CL_SUCCESS);
+    for (size_t i = 0; i < count; ++i) twice[i] = in[i] * factor;
+    CHECK(out == twice);
+
+    if (written != NULL) 
+    {
+        CHECK(clWaitForEvents(1, &written) == CL_SUCCESS);
+        clReleaseEvent(written);
+    }
+    cache->releaseMemObject(inBuffer);
+    cache->releaseMemObject(outBuffer);
+    delete cache;
+    clReleaseKernel(scale);
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include <tests.hpp>
+
+using namespace std;
+
+// Small kernels with the argument qualifiers the cache looks at
+static const char *testKernelSource =
+    "__kernel void scale(__global const float* in, __global float* out, float factor)\n"
+    "{\n"
+    "    int i = get_global_id(0);\n"
+    "    out[i] = in[i] * factor;\n"
+    "}\n"
+    "__kernel void increment(__global float* data)\n"
+    "{\n"
+    "    int i = get_global_id(0);\n"
+    "    data[i] += 1.0f;\n"
+    "}\n"
+    "__kernel void add(__global const float* a, __global const float* b, __global float* c)\n"
+    "{\n"
+    "    int i = get_global_id(0);\n"
+    "    c[i] = a[i] + b[i];\n"
+    "}\n"
+    "__kernel void fill(__global float* out, float value)\n"
+    "{\n"
+    "    out[get_global_id(0)] = value;\n"
+    "}\n";
+
+static unsigned int checks = 0;
+static unsigned int failures = 0;
+
+bool checkCondition(bool condition, const char *expression, const char *file, int line)
+{
+    checks++;
+    if (!condition)
+    {
+        failures++;
+        printf("FAILED: %s (%s:%d)\n", expression, file, line);
+    }
+    return condition;
+}
+
+cl_kernel createTestKernel(const TestDevice &device, const char *name)
+{
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(device.program, name, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create kernel %s! %s\n", name, getErrorString(err).c_str());
+        exit(1);
+    }
+    return kernel;
+}
+
+/*
+ * Usage: ./softcache_test
+ * Exits with 1 when a check fails. Without an OpenCL device the tests are skipped.
+ */
+int main()
+{
+    TestDevice device;
+    cl_int err = clGetPlatformIDs(1, &device.platform, NULL);
+    if (err == CL_SUCCESS) err = clGetDeviceIDs(device.platform, CL_DEVICE_TYPE_ALL, 1, &device.device, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Skipped: no OpenCL device (%s)\n", getErrorString(err).c_str());
+        return 0;
+    }
+
+    cl_context_properties props[3] = { CL_CONTEXT_PLATFORM, (cl_context_properties) device.platform, 0 };
+    device.ctx = clCreateContext(props, 1, &device.device, NULL, NULL, &err);
+    device.queue = clCreateCommandQueue(device.ctx, device.device, CL_QUEUE_PROFILING_ENABLE, &err);
+    device.program = clCreateProgramWithSource(device.ctx, 1, &testKernelSource, NULL, &err);
+    err |= clBuildProgram(device.program, 1, &device.device, "-cl-kernel-arg-info", NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to build the test kernels! %s\n", getErrorString(err).c_str());
+        return 1;
+    }
+
+    testDeltaUpload(device);
+    testLazyCoherence(device);
+    testEviction(device);
+    testPipelinedWrite(device);
+    testMemoisation(device);
+
+    clReleaseProgram(device.program);
+    clReleaseCommandQueue(device.queue);
+    clReleaseContext(device.ctx);
+
+    printf("%u checks, %u failed\n", checks, failures);
+    return failures == 0 ? 0 : 1;
+}
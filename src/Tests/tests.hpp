@@ -0,0 +1,30 @@
+#ifndef TESTS_H
+#define TESTS_H
+
+#include <CL/cl.h>
+
+#include <utils.hpp>
+#include <softcache.hpp>
+
+// Counts a failed condition and reports where it is, the test goes on
+#define CHECK(condition) checkCondition((condition), #condition, __FILE__, __LINE__)
+
+struct TestDevice {
+    cl_platform_id platform;
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue queue;     // Created with profiling enabled, the cache profiles its commands
+    cl_program program;         // The kernels of the tests
+};
+
+bool checkCondition(bool condition, const char *expression, const char *file, int line);
+cl_kernel createTestKernel(const TestDevice &device, const char *name);
+
+// The test suites, one per feature of the cache
+void testDeltaUpload(const TestDevice &device);
+void testLazyCoherence(const TestDevice &device);
+void testEviction(const TestDevice &device);
+void testPipelinedWrite(const TestDevice &device);
+void testMemoisation(const TestDevice &device);
+
+#endif // TESTS_H
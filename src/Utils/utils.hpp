@@ -7,7 +7,20 @@
 
 #include <algorithm>
 #include <vector>
+#include <string>
+#include <sstream>
 #include <time.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include <thread>
+#include <functional>     // std::ref
 
 using namespace std;
 
@@ -120,32 +133,466 @@ switch(error){
     }
 }
 
-inline void matrixMul(float * A, float * B, float * C, int w, int h) 
+// Blocking of the reference GEMM, a KC x NC panel of B stays in the L2 cache while the rows of A stream past it
+#define GEMM_BLOCK_K    128
+#define GEMM_BLOCK_N    256
+
+/*!
+    * \brief Add the product of a block of A and a panel of B to a block of C. Four rows of C are computed
+    * at once, so every load of B is used four times and the sums stay in registers for the whole panel.
+    * \param A Row major M x K
+    * \param B Row major K x N
+    * \param C Row major M x N
+    * \param i0 i1 The rows of C
+    * \param k0 k1 The rows of the panel of B
+    * \param j0 j1 The columns of C
+    */
+inline void matrixMulBlock(const float * A, const float * B, float * C, unsigned int N, unsigned int K,
+                           unsigned int i0, unsigned int i1, unsigned int k0, unsigned int k1, unsigned int j0, unsigned int j1)
+{
+    unsigned int i = i0;
+    for (; i + 4 <= i1; i += 4)
+    {
+        const float *a0 = A + (size_t) i * K, *a1 = a0 + K, *a2 = a1 + K, *a3 = a2 + K;
+        float *c0 = C + (size_t) i * N, *c1 = c0 + N, *c2 = c1 + N, *c3 = c2 + N;
+        unsigned int j = j0;
+
+#if defined(__AVX512F__)
+        for (; j + 32 <= j1; j += 32)
+        {
+            __m512 s00 = _mm512_loadu_ps(c0 + j), s01 = _mm512_loadu_ps(c0 + j + 16);
+            __m512 s10 = _mm512_loadu_ps(c1 + j), s11 = _mm512_loadu_ps(c1 + j + 16);
+            __m512 s20 = _mm512_loadu_ps(c2 + j), s21 = _mm512_loadu_ps(c2 + j + 16);
+            __m512 s30 = _mm512_loadu_ps(c3 + j), s31 = _mm512_loadu_ps(c3 + j + 16);
+            for (unsigned int k = k0; k < k1; ++k)
+            {
+                const __m512 b0 = _mm512_loadu_ps(B + (size_t) k * N + j);
+                const __m512 b1 = _mm512_loadu_ps(B + (size_t) k * N + j + 16);
+                __m512 a = _mm512_set1_ps(a0[k]);
+                s00 = _mm512_fmadd_ps(a, b0, s00); s01 = _mm512_fmadd_ps(a, b1, s01);
+                a = _mm512_set1_ps(a1[k]);
+                s10 = _mm512_fmadd_ps(a, b0, s10); s11 = _mm512_fmadd_ps(a, b1, s11);
+                a = _mm512_set1_ps(a2[k]);
+                s20 = _mm512_fmadd_ps(a, b0, s20); s21 = _mm512_fmadd_ps(a, b1, s21);
+                a = _mm512_set1_ps(a3[k]);
+                s30 = _mm512_fmadd_ps(a, b0, s30); s31 = _mm512_fmadd_ps(a, b1, s31);
+            }
+            _mm512_storeu_ps(c0 + j, s00); _mm512_storeu_ps(c0 + j + 16, s01);
+            _mm512_storeu_ps(c1 + j, s10); _mm512_storeu_ps(c1 + j + 16, s11);
+            _mm512_storeu_ps(c2 + j, s20); _mm512_storeu_ps(c2 + j + 16, s21);
+            _mm512_storeu_ps(c3 + j, s30); _mm512_storeu_ps(c3 + j + 16, s31);
+        }
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+        for (; j + 16 <= j1; j += 16)
+        {
+            __m256 s00 = _mm256_loadu_ps(c0 + j), s01 = _mm256_loadu_ps(c0 + j + 8);
+            __m256 s10 = _mm256_loadu_ps(c1 + j), s11 = _mm256_loadu_ps(c1 + j + 8);
+            __m256 s20 = _mm256_loadu_ps(c2 + j), s21 = _mm256_loadu_ps(c2 + j + 8);
+            __m256 s30 = _mm256_loadu_ps(c3 + j), s31 = _mm256_loadu_ps(c3 + j + 8);
+            for (unsigned int k = k0; k < k1; ++k)
+            {
+                const __m256 b0 = _mm256_loadu_ps(B + (size_t) k * N + j);
+                const __m256 b1 = _mm256_loadu_ps(B + (size_t) k * N + j + 8);
+                __m256 a = _mm256_set1_ps(a0[k]);
+                s00 = _mm256_fmadd_ps(a, b0, s00); s01 = _mm256_fmadd_ps(a, b1, s01);
+                a = _mm256_set1_ps(a1[k]);
+                s10 = _mm256_fmadd_ps(a, b0, s10); s11 = _mm256_fmadd_ps(a, b1, s11);
+                a = _mm256_set1_ps(a2[k]);
+                s20 = _mm256_fmadd_ps(a, b0, s20); s21 = _mm256_fmadd_ps(a, b1, s21);
+                a = _mm256_set1_ps(a3[k]);
+                s30 = _mm256_fmadd_ps(a, b0, s30); s31 = _mm256_fmadd_ps(a, b1, s31);
+            }
+            _mm256_storeu_ps(c0 + j, s00); _mm256_storeu_ps(c0 + j + 8, s01);
+            _mm256_storeu_ps(c1 + j, s10); _mm256_storeu_ps(c1 + j + 8, s11);
+            _mm256_storeu_ps(c2 + j, s20); _mm256_storeu_ps(c2 + j + 8, s21);
+            _mm256_storeu_ps(c3 + j, s30); _mm256_storeu_ps(c3 + j + 8, s31);
+        }
+#endif
+
+        // The columns that are left, or all of them without AVX
+        for (; j < j1; ++j)
+        {
+            float s0 = c0[j], s1 = c1[j], s2 = c2[j], s3 = c3[j];
+            for (unsigned int k = k0; k < k1; ++k)
+            {
+                const float b = B[(size_t) k * N + j];
+                s0 += a0[k] * b;
+                s1 += a1[k] * b;
+                s2 += a2[k] * b;
+                s3 += a3[k] * b;
+            }
+            c0[j] = s0; c1[j] = s1; c2[j] = s2; c3[j] = s3;
+        }
+    }
+
+    // The rows that are left
+    for (; i < i1; ++i)
+    {
+        float *c = C + (size_t) i * N;
+        for (unsigned int k = k0; k < k1; ++k)
+        {
+            const float a = A[(size_t) i * K + k];
+            const float *b = B + (size_t) k * N;
+            for (unsigned int j = j0; j < j1; ++j) c[j] += a * b[j];
+        }
+    }
+}
+
+/*!
+    * \brief Reference GEMM on the CPU, C (M x N) = A (M x K) * B (K x N), all row major.
+    * The rows of C are split over threads, each thread walks its rows in panels of B.
+    * \param threads The number of threads, 0 uses every hardware thread
+    */
+inline void matrixMulBlocked(const float * A, const float * B, float * C, unsigned int M, unsigned int N, unsigned int K, unsigned int threads = 0)
 {
-    for(int i = 0; i < w; ++i) 
+    if (threads == 0) threads = max(1u, std::thread::hardware_concurrency());
+    // Whole groups of four rows per thread
+    const unsigned int rowsPerThread = ((M + threads - 1) / threads + 3) & ~3u;
+
+    auto multiplyRows = [=](unsigned int i0, unsigned int i1)
     {
-        for(int j = 0; j < h; j++) 
+        memset(C + (size_t) i0 * N, 0, (size_t) (i1 - i0) * N * sizeof(*C));
+        for (unsigned int j0 = 0; j0 < N; j0 += GEMM_BLOCK_N)
         {
-            C[i*h + j] = 0;
-            for(int k = 0; k < w; ++k) 
+            for (unsigned int k0 = 0; k0 < K; k0 += GEMM_BLOCK_K)
             {
-                C[i*h + j] += A[i*h + k] * B[k*h + j];
+                matrixMulBlock(A, B, C, N, K, i0, i1, k0, min(k0 + GEMM_BLOCK_K, K), j0, min(j0 + GEMM_BLOCK_N, N));
             }
         }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i0 = rowsPerThread; i0 < M; i0 += rowsPerThread)
+    {
+        workers.push_back(std::thread(multiplyRows, i0, min(i0 + rowsPerThread, M)));
+    }
+    multiplyRows(0, min(rowsPerThread, M));
+    for (auto& worker : workers) worker.join();
+}
+
+/*!
+    * \brief Reference for the matrixMul kernel launched on a w x h range with widthA = widthB = w,
+    * C (h x w) = A (h x w) * B (w x w)
+    */
+inline void matrixMul(float * A, float * B, float * C, int w, int h) 
+{
+    matrixMulBlocked(A, B, C, h, w, w);
+}
+
+// Histogram of the ULP distances, bucket 0 counts equal elements and bucket k distances in [2^(k-1), 2^k)
+#define ULP_BUCKETS     33
+
+/*!
+    * \brief The result of a comparison of a result with its reference, true when nothing mismatched
+    */
+struct CompareReport {
+    size_t count;                           // Elements compared
+    size_t mismatches;                      // Elements outside the tolerance, NaNs included
+    size_t nans;                            // Elements where either side is NaN
+    size_t firstMismatch;                   // Index of the first mismatch, count when there is none
+    double maxAbsError;
+    double maxRelError;                     // Relative to the reference, elements with a zero reference are skipped
+    uint32_t maxUlp;                        // NaNs count as the largest distance
+    size_t ulpHistogram[ULP_BUCKETS];
+
+    explicit operator bool() const { return this->mismatches == 0; }
+
+    void merge(const CompareReport &other)
+    {
+        if (other.mismatches > 0 && (this->mismatches == 0 || other.firstMismatch < this->firstMismatch))
+        {
+            this->firstMismatch = other.firstMismatch;
+        }
+        this->count += other.count;
+        this->mismatches += other.mismatches;
+        this->nans += other.nans;
+        this->maxAbsError = max(this->maxAbsError, other.maxAbsError);
+        this->maxRelError = max(this->maxRelError, other.maxRelError);
+        this->maxUlp = max(this->maxUlp, other.maxUlp);
+        for (int b = 0; b < ULP_BUCKETS; ++b) this->ulpHistogram[b] += other.ulpHistogram[b];
+    }
+
+    void print() const
+    {
+        printf("%-30s %zu / %zu (%zu NaN)\n", "Mismatches:", this->mismatches, this->count, this->nans);
+        printf("%-30s %g\n", "Max abs error:", this->maxAbsError);
+        printf("%-30s %g\n", "Max rel error:", this->maxRelError);
+        printf("%-30s %u\n", "Max ULP:", this->maxUlp);
+        for (int b = 0; b < ULP_BUCKETS; ++b)
+        {
+            if (this->ulpHistogram[b] == 0) continue;
+            char label[32] = "ULP 0:";
+            if (b > 0) snprintf(label, sizeof(label), "ULP [%u, %llu):", 1u << (b - 1), 1ULL << b);
+            printf("    %-26s %zu\n", label, this->ulpHistogram[b]);
+        }
+    }
+};
+
+/*!
+    * \brief Position of a float on the number line, neighbouring floats differ by 1 and -0 equals +0
+    */
+inline int32_t orderedFloat(float value)
+{
+    int32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits < 0 ? (int32_t) (0x80000000u - (uint32_t) bits) : bits;
+}
+
+/*!
+    * \brief Compare one element, the scalar step of compareRange
+    */
+inline void compareElement(float a, float b, size_t i, float absTolerance, float relTolerance, CompareReport &report)
+{
+    const float diff = fabsf(a - b);
+    uint32_t ulp = 0xFFFFFFFFu;
+    if (a != a || b != b)
+    {
+        report.nans += 1;
+    }
+    else
+    {
+        const int32_t oa = orderedFloat(a), ob = orderedFloat(b);
+        ulp = (uint32_t) max(oa, ob) - (uint32_t) min(oa, ob);
+        report.maxAbsError = max(report.maxAbsError, (double) diff);
+        if (b != 0) report.maxRelError = max(report.maxRelError, (double) (diff / fabsf(b)));
+    }
+
+    // Equal infinities have a NaN difference
+    if (a != b && !(diff <= absTolerance + relTolerance * fabsf(b)))
+    {
+        if (report.mismatches == 0) report.firstMismatch = i;
+        report.mismatches += 1;
+    }
+    report.maxUlp = max(report.maxUlp, ulp);
+    report.ulpHistogram[ulp == 0 ? 0 : 32 - __builtin_clz(ulp)] += 1;
+}
+
+/*!
+    * \brief Compare a range of a result with its reference in one pass, eight elements per step with AVX2
+    */
+inline void compareRange(const float * A, const float * B, size_t begin, size_t end, float absTolerance, float relTolerance, CompareReport &report)
+{
+    size_t i = begin;
+#if defined(__AVX2__)
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 absTol = _mm256_set1_ps(absTolerance);
+    const __m256 relTol = _mm256_set1_ps(relTolerance);
+    const __m256i signBit = _mm256_set1_epi32((int) 0x80000000u);
+    __m256 maxAbs = _mm256_setzero_ps();
+    __m256 maxRel = _mm256_setzero_ps();
+    alignas(32) uint32_t ulps[8];
+
+    for (; i + 8 <= end; i += 8)
+    {
+        const __m256 a = _mm256_loadu_ps(A + i);
+        const __m256 b = _mm256_loadu_ps(B + i);
+        const __m256 absB = _mm256_andnot_ps(signMask, b);
+        const __m256 diff = _mm256_andnot_ps(signMask, _mm256_sub_ps(a, b));
+        const __m256 nan = _mm256_cmp_ps(a, b, _CMP_UNORD_Q);
+
+        // max_ps returns its second operand when the first is NaN, so NaNs never reach the maxima
+        maxAbs = _mm256_max_ps(diff, maxAbs);
+        const __m256 rel = _mm256_and_ps(_mm256_div_ps(diff, absB), _mm256_cmp_ps(absB, zero, _CMP_NEQ_OQ));
+        maxRel = _mm256_max_ps(rel, maxRel);
+
+        const __m256 outside = _mm256_andnot_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ),
+                                                _mm256_cmp_ps(diff, _mm256_add_ps(absTol, _mm256_mul_ps(relTol, absB)), _CMP_NLE_UQ));
+        const int mismatchMask = _mm256_movemask_ps(outside);
+        if (mismatchMask != 0)
+        {
+            if (report.mismatches == 0) report.firstMismatch = i + __builtin_ctz(mismatchMask);
+            report.mismatches += __builtin_popcount(mismatchMask);
+        }
+        const int nanMask = _mm256_movemask_ps(nan);
+        report.nans += __builtin_popcount(nanMask);
+
+        // Same mapping as orderedFloat, (bits ^ sign) - sign negates the negatives
+        const __m256i ia = _mm256_castps_si256(a);
+        const __m256i ib = _mm256_castps_si256(b);
+        const __m256i sa = _mm256_srai_epi32(ia, 31);
+        const __m256i sb = _mm256_srai_epi32(ib, 31);
+        const __m256i oa = _mm256_xor_si256(_mm256_sub_epi32(_mm256_xor_si256(ia, sa), sa), _mm256_and_si256(sa, signBit));
+        const __m256i ob = _mm256_xor_si256(_mm256_sub_epi32(_mm256_xor_si256(ib, sb), sb), _mm256_and_si256(sb, signBit));
+        __m256i ulp = _mm256_sub_epi32(_mm256_max_epi32(oa, ob), _mm256_min_epi32(oa, ob));
+        ulp = _mm256_or_si256(ulp, _mm256_castps_si256(nan));
+        if (_mm256_testz_si256(ulp, ulp))
+        {
+            report.ulpHistogram[0] += 8;
+            continue;
+        }
+        _mm256_store_si256((__m256i *) ulps, ulp);
+        for (int l = 0; l < 8; ++l)
+        {
+            report.maxUlp = max(report.maxUlp, ulps[l]);
+            report.ulpHistogram[ulps[l] == 0 ? 0 : 32 - __builtin_clz(ulps[l])] += 1;
+        }
+    }
+
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, maxAbs);
+    for (int l = 0; l < 8; ++l) report.maxAbsError = max(report.maxAbsError, (double) lanes[l]);
+    _mm256_store_ps(lanes, maxRel);
+    for (int l = 0; l < 8; ++l) report.maxRelError = max(report.maxRelError, (double) lanes[l]);
+#endif
+
+    for (; i < end; ++i) compareElement(A[i], B[i], i, absTolerance, relTolerance, report);
+    report.count += end - begin;
+}
+
+/*!
+    * \brief Compare a result with its reference. An element mismatches when |A - B| > absTolerance + relTolerance * |B|,
+    * or when either side is NaN. Large arrays are split over threads.
+    * \param A The result
+    * \param B The reference
+    * \param size The number of elements
+    * \param absTolerance The absolute tolerance
+    * \param relTolerance The tolerance relative to the reference
+    * \param threads The number of threads, 0 uses every hardware thread
+    * \return The report, which converts to true when nothing mismatched
+    */
+inline CompareReport compareMatrices(const float * A, const float * B, size_t size, double absTolerance = 0.1, double relTolerance = 0.0, unsigned int threads = 0)
+{
+    CompareReport report;
+    memset(&report, 0, sizeof(report));
+
+    // Below a few pages per thread the threads cost more than they save
+    if (threads == 0) threads = max(1u, std::thread::hardware_concurrency());
+    threads = (unsigned int) max((size_t) 1, min((size_t) threads, size / (1 << 16)));
+    const size_t chunk = ((size + threads - 1) / threads + 7) & ~(size_t) 7;
+
+    std::vector<CompareReport> reports(threads, report);
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < threads; ++t)
+    {
+        const size_t begin = min(t * chunk, size);
+        const size_t end = min(begin + chunk, size);
+        workers.push_back(std::thread(compareRange, A, B, begin, end, (float) absTolerance, (float) relTolerance, std::ref(reports[t])));
+    }
+    compareRange(A, B, 0, min(chunk, size), (float) absTolerance, (float) relTolerance, reports[0]);
+    for (auto& worker : workers) worker.join();
+
+    for (auto& part : reports) report.merge(part);
+    if (report.mismatches == 0)
+    {
+        report.firstMismatch = size;
+    }
+    else
+    {
+        const size_t i = report.firstMismatch;
+        printf("Error at index %zu: %f != %f (%zu mismatches)\n", i, A[i], B[i], report.mismatches);
     }
+    return report;
 }
 
-inline bool compareMatrices(float * A, float * B, unsigned int size) 
+/*!
+    * \brief Fast non-cryptographic 64-bit hash of a memory region. 
+    * Uses an XXH3 style multiply-accumulate on four 64-bit lanes (32 bytes per stripe),
+    * which maps onto two SSE2 registers when available. Every stripe is mixed with its own key,
+    * and the accumulators are scrambled after every 16 stripes, so moving data around changes the hash.
+    * \param data Pointer to the data
+    * \param size The size of the data in bytes
+    * \return The hash
+    */
+inline uint64_t hashChunk(const void *data, size_t size)
 {
-    for(unsigned int i = 0; i < size; ++i) 
+    const uint64_t PRIME32_1 = 0x9E3779B1ULL;
+    const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+    const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+    const size_t STRIPES_PER_ROUND = 16;
+    // The key of stripe i is key + i * step
+    const uint64_t key[4] = {0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL};
+    const uint64_t step[4] = {0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL};
+    const uint64_t scramble[4] = {0xCB79E64EB85B9E3FULL, 0xD8E8E8B15A1D4C6BULL, 0x3F349CE33F76FAA8ULL, 0x6A0BE21A07B1E3A5ULL};
+    uint64_t acc[4] = {PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4};
+
+    const unsigned char *p = (const unsigned char *) data;
+    const size_t blocks = size / 32;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    __m128i acc0 = _mm_loadu_si128((const __m128i *) &acc[0]);
+    __m128i acc1 = _mm_loadu_si128((const __m128i *) &acc[2]);
+    __m128i key0 = _mm_loadu_si128((const __m128i *) &key[0]);
+    __m128i key1 = _mm_loadu_si128((const __m128i *) &key[2]);
+    const __m128i step0 = _mm_loadu_si128((const __m128i *) &step[0]);
+    const __m128i step1 = _mm_loadu_si128((const __m128i *) &step[2]);
+    const __m128i scramble0 = _mm_loadu_si128((const __m128i *) &scramble[0]);
+    const __m128i scramble1 = _mm_loadu_si128((const __m128i *) &scramble[2]);
+    const __m128i prime = _mm_set1_epi32((int) PRIME32_1);
+    for (; i < blocks; ++i)
     {
-        if (fabs(A[i] - B[i]) > 0.1)
+        const __m128i d0 = _mm_loadu_si128((const __m128i *) (p + i * 32));
+        const __m128i d1 = _mm_loadu_si128((const __m128i *) (p + i * 32 + 16));
+        const __m128i dk0 = _mm_xor_si128(d0, key0);
+        const __m128i dk1 = _mm_xor_si128(d1, key1);
+        // lo32 * hi32 of every 64-bit lane, plus the data of the neighbouring lane
+        acc0 = _mm_add_epi64(acc0, _mm_mul_epu32(dk0, _mm_shuffle_epi32(dk0, _MM_SHUFFLE(0, 3, 0, 1))));
+        acc1 = _mm_add_epi64(acc1, _mm_mul_epu32(dk1, _mm_shuffle_epi32(dk1, _MM_SHUFFLE(0, 3, 0, 1))));
+        acc0 = _mm_add_epi64(acc0, _mm_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc1 = _mm_add_epi64(acc1, _mm_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+        key0 = _mm_add_epi64(key0, step0);
+        key1 = _mm_add_epi64(key1, step1);
+
+        if ((i + 1) % STRIPES_PER_ROUND == 0)
+        {
+            // acc = (acc ^ (acc >> 47) ^ scramble) * PRIME32_1, the 64-bit product from two 32-bit ones
+            acc0 = _mm_xor_si128(_mm_xor_si128(acc0, _mm_srli_epi64(acc0, 47)), scramble0);
+            acc1 = _mm_xor_si128(_mm_xor_si128(acc1, _mm_srli_epi64(acc1, 47)), scramble1);
+            acc0 = _mm_add_epi64(_mm_mul_epu32(acc0, prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(acc0, 32), prime), 32));
+            acc1 = _mm_add_epi64(_mm_mul_epu32(acc1, prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(acc1, 32), prime), 32));
+        }
+    }
+    _mm_storeu_si128((__m128i *) &acc[0], acc0);
+    _mm_storeu_si128((__m128i *) &acc[2], acc1);
+#endif
+
+    // Scalar version of the same step, also used for the zero padded tail
+    unsigned char tail[32];
+    for (; i <= blocks; ++i)
+    {
+        const unsigned char *block = p + i * 32;
+        if (i == blocks)
+        {
+            if (size % 32 == 0) break;
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, size % 32);
+            block = tail;
+        }
+
+        uint64_t d[4];
+        memcpy(d, block, sizeof(d));
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            const uint64_t dk = d[lane] ^ (key[lane] + i * step[lane]);
+            acc[lane] += (dk & 0xFFFFFFFFULL) * (dk >> 32) + d[lane ^ 1];
+        }
+
+        if ((i + 1) % STRIPES_PER_ROUND == 0)
         {
-            printf("Error at index %d: %f != %f \n", i, A[i], B[i]);
-            return false;
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                acc[lane] = (acc[lane] ^ (acc[lane] >> 47) ^ scramble[lane]) * PRIME32_1;
+            }
         }
     }
-    return true;
+
+    uint64_t h = size * PRIME64_1;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        h ^= acc[lane] * PRIME64_2;
+        h = ((h << 27) | (h >> 37)) * PRIME64_1 + PRIME64_4;
+    }
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
 }
 
 inline long long probe_event_time(cl_event event, cl_command_queue command_queue) {
@@ -174,6 +621,20 @@ inline long long probe_event_time(cl_event event, cl_command_queue command_queue
 
 
 
+/*!
+    * \brief Get the execution time of a completed command, without waiting for anything
+    * \param event The event of the command
+    * \return The execution time in microseconds, 0 if profiling info is not available
+    */
+inline long long get_event_time(cl_event event) {
+    cl_ulong eventStart, eventEnd;
+    if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &eventStart, NULL) != CL_SUCCESS
+        || clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &eventEnd, NULL) != CL_SUCCESS) {
+        return 0;
+    }
+    return (long long)((eventEnd - eventStart) / 1000);
+}
+
 // Get current date/time, format is YYYY-MM-DD.HH:mm:ss
 inline const std::string currentDateTime() {
     time_t     now = time(0);
@@ -213,6 +674,21 @@ class InputParser{
         }    
 };
 
+/*!
+    * \brief Check whether a comma separated list contains a name, an empty list contains everything
+    */
+inline bool isSelected(const std::string &list, const std::string &name)
+{
+    if (list.empty()) return true;
+    std::istringstream names(list);
+    std::string selected;
+    while (std::getline(names, selected, ','))
+    {
+        if (selected == name) return true;
+    }
+    return false;
+}
+
 template<typename CharT>
 class DecimalSeparator : public std::numpunct<CharT>
 {
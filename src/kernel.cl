@@ -1,7 +1,8 @@
 // OpenCL Kernel
+// C (rows x widthB) = A (rows x widthA) * B (widthA x widthB), one work item per element of C
 __kernel void
-matrixMul(__global float* A, 
-          __global float* B, 
+matrixMul(__global const float* A, 
+          __global const float* B, 
           __global float* C, 
           int widthA, int widthB)
 {
@@ -21,5 +22,227 @@ matrixMul(__global float* A,
  
    // Write the matrix to device memory each 
    // thread writes one element
-   C[ty * widthA + tx] = value;
-}
\ No newline at end of file
+   C[ty * widthB + tx] = value;
+}
+// Product of two square tiles, added to the tile of C when accumulate is set
+__kernel void
+matrixMulTile(__global const float* A, 
+              __global const float* B, 
+              __global float* C, 
+              int tileSize, int accumulate)
+{
+   int tx = get_global_id(0); 
+   int ty = get_global_id(1);
+
+   float value = accumulate ? C[ty * tileSize + tx] : 0;
+   for (int k = 0; k < tileSize; ++k)
+   {
+      value += A[ty * tileSize + k] * B[k * tileSize + tx];
+   }
+
+   C[ty * tileSize + tx] = value;
+}
+// Transpose of a rows x cols matrix, used as a transform of the derived buffer cache
+__kernel void
+transpose(__global const float* src, 
+          __global float* dst, 
+          int rows, int cols)
+{
+   int col = get_global_id(0); 
+   int row = get_global_id(1);
+
+   dst[col * rows + row] = src[row * cols + col];
+}
+// Product with the transpose of B, so both A and BT are read along their rows
+__kernel void
+matrixMulBT(__global const float* A, 
+            __global const float* BT, 
+            __global float* C, 
+            int widthA, int widthB)
+{
+   int tx = get_global_id(0); 
+   int ty = get_global_id(1);
+
+   float value = 0;
+   for (int k = 0; k < widthA; ++k)
+   {
+      value += A[ty * widthA + k] * BT[tx * widthA + k];
+   }
+
+   C[ty * widthB + tx] = value;
+}
+// Tiled product with __local memory, register blocking and float4 loads.
+// TS and WPT are chosen by the autotuner with -D, the defaults are used when the file is built as is.
+// A work-group computes a TS x TS tile of C, a work-item computes a float4 of it in WPT rows that are TS/WPT apart.
+// The work-group size is (TS/4, TS/WPT), M, N and K have to be multiples of TS.
+#ifndef TS
+#define TS 32
+#endif
+#ifndef WPT
+#define WPT 4
+#endif
+#define RTS (TS / WPT)
+__kernel void
+matrixMulTiled(__global const float4* A, 
+               __global const float4* B, 
+               __global float4* C, 
+               int M, int N, int K)
+{
+   const int col4 = get_local_id(0);
+   const int row = get_local_id(1);
+   const int globalCol4 = get_group_id(0) * (TS / 4) + col4;
+   const int globalRow = get_group_id(1) * TS + row;
+
+   __local float4 Asub[TS][TS / 4];
+   __local float4 Bsub[TS][TS / 4];
+
+   float4 acc[WPT];
+   for (int w = 0; w < WPT; ++w) acc[w] = (float4) (0.0f);
+
+   for (int t = 0; t < K / TS; ++t)
+   {
+      // Every work-item loads WPT float4s of both tiles
+      for (int w = 0; w < WPT; ++w)
+      {
+         const int r = row + w * RTS;
+         Asub[r][col4] = A[(globalRow + w * RTS) * (K / 4) + t * (TS / 4) + col4];
+         Bsub[r][col4] = B[(t * TS + r) * (N / 4) + globalCol4];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+
+      for (int k4 = 0; k4 < TS / 4; ++k4)
+      {
+         const float4 b0 = Bsub[4 * k4 + 0][col4];
+         const float4 b1 = Bsub[4 * k4 + 1][col4];
+         const float4 b2 = Bsub[4 * k4 + 2][col4];
+         const float4 b3 = Bsub[4 * k4 + 3][col4];
+         for (int w = 0; w < WPT; ++w)
+         {
+            const float4 a = Asub[row + w * RTS][k4];
+            acc[w] += a.x * b0 + a.y * b1 + a.z * b2 + a.w * b3;
+         }
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   for (int w = 0; w < WPT; ++w)
+   {
+      C[(globalRow + w * RTS) * (N / 4) + globalCol4] = acc[w];
+   }
+}
+#if defined(WIDTH) && defined(TILE)
+// Tiled product of square matrices with the width known at compile time, built per shape by the program cache.
+// The work-group size is TILE x TILE, WIDTH has to be a multiple of TILE.
+__kernel __attribute__((reqd_work_group_size(TILE, TILE, 1)))
+void
+matrixMulSpecialised(__global const float* A, 
+                     __global const float* B, 
+                     __global float* C)
+{
+   const int tx = get_local_id(0);
+   const int ty = get_local_id(1);
+   const int col = get_global_id(0);
+   const int row = get_global_id(1);
+
+   __local float Asub[TILE][TILE];
+   __local float Bsub[TILE][TILE];
+
+   float value = 0;
+   for (int t = 0; t < WIDTH / TILE; ++t)
+   {
+      Asub[ty][tx] = A[row * WIDTH + t * TILE + tx];
+      Bsub[ty][tx] = B[(t * TILE + ty) * WIDTH + col];
+      barrier(CLK_LOCAL_MEM_FENCE);
+
+      #pragma unroll
+      for (int k = 0; k < TILE; ++k)
+      {
+         value += Asub[ty][k] * Bsub[k][tx];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   C[row * WIDTH + col] = value;
+}
+#endif
+// One Jacobi sweep of the 2D Laplace equation, the boundary is kept fixed
+__kernel void
+jacobi(__global const float* src, 
+       __global float* dst, 
+       int width, int height)
+{
+   int x = get_global_id(0); 
+   int y = get_global_id(1);
+
+   float value = src[y * width + x];
+   if (x > 0 && y > 0 && x < width - 1 && y < height - 1)
+   {
+      value = 0.25f * (src[y * width + x - 1] + src[y * width + x + 1] +
+                       src[(y - 1) * width + x] + src[(y + 1) * width + x]);
+   }
+   dst[y * width + x] = value;
+}
+// 3x3 box blur, the edges are clamped
+__kernel void
+blur(__global const float* src, 
+     __global float* dst, 
+     int width, int height)
+{
+   int x = get_global_id(0); 
+   int y = get_global_id(1);
+
+   float value = 0;
+   for (int dy = -1; dy <= 1; ++dy)
+   {
+      for (int dx = -1; dx <= 1; ++dx)
+      {
+         int sx = clamp(x + dx, 0, width - 1);
+         int sy = clamp(y + dy, 0, height - 1);
+         value += src[sy * width + sx];
+      }
+   }
+   dst[y * width + x] = value / 9.0f;
+}
+// Gradient magnitude with the Sobel operator, the edges are clamped
+__kernel void
+sobel(__global const float* src, 
+      __global float* dst, 
+      int width, int height)
+{
+   int x = get_global_id(0); 
+   int y = get_global_id(1);
+   int x0 = max(x - 1, 0), x1 = min(x + 1, width - 1);
+   int y0 = max(y - 1, 0), y1 = min(y + 1, height - 1);
+
+   float gx = src[y0 * width + x1] + 2.0f * src[y * width + x1] + src[y1 * width + x1]
+            - src[y0 * width + x0] - 2.0f * src[y * width + x0] - src[y1 * width + x0];
+   float gy = src[y1 * width + x0] + 2.0f * src[y1 * width + x] + src[y1 * width + x1]
+            - src[y0 * width + x0] - 2.0f * src[y0 * width + x] - src[y0 * width + x1];
+   dst[y * width + x] = sqrt(gx * gx + gy * gy);
+}
+__kernel void
+threshold(__global const float* src, 
+          __global float* dst, 
+          float level)
+{
+   int i = get_global_id(0); 
+   dst[i] = src[i] > level ? 1.0f : 0.0f;
+}
+// Fully connected layer with a ReLU, Y (batch x outputs) = max(X (batch x inputs) * W (inputs x outputs) + b, 0)
+__kernel void
+denseRelu(__global const float* X, 
+          __global const float* W, 
+          __global const float* bias, 
+          __global float* Y, 
+          int inputs, int outputs)
+{
+   int o = get_global_id(0); 
+   int n = get_global_id(1);
+
+   float value = bias[o];
+   for (int i = 0; i < inputs; ++i)
+   {
+      value += X[n * inputs + i] * W[i * outputs + o];
+   }
+   Y[n * outputs + o] = max(value, 0.0f);
+}
@@ -5,6 +5,10 @@
 
 #include <utils.hpp>
 #include <softcache.hpp>
+#include <gemm.hpp>
+#include <derivedcache.hpp>
+#include <autotune.hpp>
+#include <programcache.hpp>
 
 #include <fstream>
 #include <sstream>
@@ -14,6 +18,7 @@
 
 #include <algorithm>
 #include <random>
+#include <future>
 
 #define MEASURE_TIME 1
 
@@ -21,18 +26,15 @@
  * Remap native opencl functions to SoftCache functions
  */ 
 #define clCreateBuffer                                  cache->createBuffer
-#define clEnqueueWriteBuffer(a,b,c,d,e,f,g, h, i)       cache->enqueueWriteBuffer(a, &b, c, d, e, f, g, h, i)
+#define clEnqueueWriteBuffer                            cache->enqueueWriteBuffer
 #define clEnqueueReadBuffer                             cache->enqueueReadBuffer
 #define clSetKernelArg                                  cache->setKernelArg
 #define clEnqueueNDRangeKernel                          cache->enqueueNDRangeKernel
+#define clReleaseMemObject                              cache->releaseMemObject
 // Enable profiling of commands
 #if TIMING
 #define clCreateCommandQueue(a, b, c, d)                clCreateCommandQueue(a, b, CL_QUEUE_PROFILING_ENABLE, d)
 #endif
-// Disable freeing of memory because the destructor of SoftCache will do this
-#if CACHE_ENABLED
-#define clReleaseMemObject                              0 && clReleaseMemObject 
-#endif
 Cache *cache = nullptr;
 /* ===================================================== */ 
 using namespace std;
@@ -44,35 +46,19 @@ cl_device_id device;
 cl_context_properties props[3] = { CL_CONTEXT_PLATFORM, 0, 0 };
 cl_context ctx;
 cl_program program;
+ProgramCache *programCache;    // Built programs, with -pcache their binaries are kept on disk between runs
+std::string kernelSource;
 cl_command_queue queue;
 cl_event event = NULL;
 cl_kernel matrix_mul_kernel;
+cl_kernel matrix_mul_tiled_kernel = NULL;  // The tuned variant of matrixMulTiled, only with -tune
+TuningConfig tuning;
+cl_kernel matrix_mul_specialised_kernel = NULL;    // matrixMul built for the shape of the test, only with -specialise
+#define SPECIALISED_TILE    16
 
 
 
-char * loadKernelFile( const char * tempchar ) 
-{
-    int sourcesize = 1024*1024;
-	char * source = (char *)calloc(sourcesize, sizeof(char));
-
-	if(!source) 
-    { 
-        printf("ERROR: calloc(%d) failed\n", sourcesize); 
-    }
-
-    FILE * fp = fopen(tempchar, "rb");
-	if(!fp) 
-    { 
-        printf("ERROR: unable to open '%s'\n", tempchar); 
-    }
-
-	fread(source + strlen(source), sourcesize, 1, fp);
-	fclose(fp);
-
-    return source;
-}
-
-void initialiseOpenCL()
+void initialiseOpenCL(bool keepBinaries)
 {
         /* Setup OpenCL environment. */
     err = clGetPlatformIDs( 1, &platform, NULL );
@@ -82,11 +68,10 @@ void initialiseOpenCL()
     ctx = clCreateContext( props, 1, &device, NULL, NULL, &err );
     queue = clCreateCommandQueue( ctx, device, 0, &err );
 
-    char *source = NULL;
-    source = loadKernelFile("./kernel.cl");
-    program = clCreateProgramWithSource(ctx, 1, (const char **) &source, NULL, &err);
-    // program = cl_compileProgram( (char *) "src/kernel.cl", NULL);
-    err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+    kernelSource = ProgramCache::loadSource("./kernel.cl");
+    programCache = new ProgramCache(ctx, "", keepBinaries);
+    // Keep the argument qualifiers, so the cache knows which buffers a kernel can write
+    program = programCache->getProgram(kernelSource, "-cl-kernel-arg-info", device);
     matrix_mul_kernel = clCreateKernel(program, "matrixMul", &err);
 
 #if 0 // Kernel compile output    
@@ -135,11 +120,41 @@ void matrixMulGPU(float * A, float * B, float * C, unsigned int w, unsigned int
         exit(1);
     }
 
-    err  = clSetKernelArg(matrix_mul_kernel, 0, sizeof(cl_mem), (void *)&A_buffer);
-    err |= clSetKernelArg(matrix_mul_kernel, 1, sizeof(cl_mem), (void *)&B_buffer);
-    err |= clSetKernelArg(matrix_mul_kernel, 2, sizeof(cl_mem), (void *)&C_buffer);
-    err |= clSetKernelArg(matrix_mul_kernel, 3, sizeof(int), &w);
-    err |= clSetKernelArg(matrix_mul_kernel, 4, sizeof(int), &h);
+    size_t global_work_size[2] = {w, h};
+    size_t local_work_size[2] = {4, 4};
+    cl_kernel kernel = matrix_mul_kernel;
+
+    if (matrix_mul_specialised_kernel != NULL && w == h && w % SPECIALISED_TILE == 0 && matrix_mul_tiled_kernel == NULL)
+    {
+        // The widths are compiled into the kernel
+        kernel = matrix_mul_specialised_kernel;
+        local_work_size[0] = SPECIALISED_TILE;
+        local_work_size[1] = SPECIALISED_TILE;
+        err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&A_buffer);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&B_buffer);
+        err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&C_buffer);
+    }
+    else if (matrix_mul_tiled_kernel != NULL && Autotuner::fits(tuning, h, w, w))
+    {
+        // The tuned tiled kernel, C (h x w) = A (h x w) * B (w x w)
+        const int M = h, N = w, K = w;
+        kernel = matrix_mul_tiled_kernel;
+        Autotuner::getWorkSizes(tuning, M, N, global_work_size, local_work_size);
+        err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&A_buffer);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&B_buffer);
+        err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&C_buffer);
+        err |= clSetKernelArg(kernel, 3, sizeof(int), &M);
+        err |= clSetKernelArg(kernel, 4, sizeof(int), &N);
+        err |= clSetKernelArg(kernel, 5, sizeof(int), &K);
+    }
+    else
+    {
+        err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&A_buffer);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&B_buffer);
+        err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&C_buffer);
+        err |= clSetKernelArg(kernel, 3, sizeof(int), &w);    // A is h x w
+        err |= clSetKernelArg(kernel, 4, sizeof(int), &w);    // B is w x w
+    }
 
     if (err != CL_SUCCESS)
     {
@@ -147,10 +162,7 @@ void matrixMulGPU(float * A, float * B, float * C, unsigned int w, unsigned int
         exit(1);
     }
 
-    size_t global_work_size[2] = {w, h};
-    size_t local_work_size[2] = {4, 4};
-
-    err = clEnqueueNDRangeKernel(queue, matrix_mul_kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
+    err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
 
     if (err != CL_SUCCESS)
     {
@@ -171,14 +183,91 @@ void matrixMulGPU(float * A, float * B, float * C, unsigned int w, unsigned int
     clReleaseMemObject(C_buffer);
 }
 
+// C (h x w) = A (h x w) * B (w x w) with the transpose of B, the transpose is taken from the derived buffer cache
+void matrixMulTransposedGPU(DerivedCache &derived, int transpose, cl_kernel matrix_mul_bt_kernel, float * A, float * B, float * C, unsigned int w, unsigned int h)
+{
+    const unsigned int N = w * h; // Matrix vector size
+    cl_mem A_buffer = clCreateBuffer(ctx, CL_MEM_READ_ONLY, N * sizeof(*A), NULL, &err);
+    cl_mem C_buffer = clCreateBuffer(ctx, CL_MEM_READ_WRITE, N * sizeof(*C), NULL, &err);
+
+    err |= clEnqueueWriteBuffer(queue, A_buffer, CL_FALSE, 0, N * sizeof(*A), A, 0, NULL, NULL);
+    cl_mem BT_buffer = derived.get(queue, transpose, B, w, w);
+
+    err |= clSetKernelArg(matrix_mul_bt_kernel, 0, sizeof(cl_mem), (void *)&A_buffer);
+    err |= clSetKernelArg(matrix_mul_bt_kernel, 1, sizeof(cl_mem), (void *)&BT_buffer);
+    err |= clSetKernelArg(matrix_mul_bt_kernel, 2, sizeof(cl_mem), (void *)&C_buffer);
+    err |= clSetKernelArg(matrix_mul_bt_kernel, 3, sizeof(int), &w);    // A is h x w
+    err |= clSetKernelArg(matrix_mul_bt_kernel, 4, sizeof(int), &w);    // B is w x w
+
+    size_t global_work_size[2] = {w, h};
+    size_t local_work_size[2] = {4, 4};
+    err |= clEnqueueNDRangeKernel(queue, matrix_mul_bt_kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(queue, C_buffer, CL_TRUE, 0, N * sizeof(*C), C, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to multiply with the transpose! %s\n", getErrorString(err).c_str());
+        exit(1);
+    }
+
+    clReleaseMemObject(A_buffer);
+    clReleaseMemObject(BT_buffer);
+    clReleaseMemObject(C_buffer);
+}
+
+// Tolerances of the comparison with the CPU reference, -atol and -rtol
+double absTolerance = 0.1;
+double relTolerance = 0.0;
+bool printReports = false;     // -report prints the errors and the ULP histogram of every comparison
+
+void checkResult(const char *name, float *result, float *reference, unsigned int size)
+{
+    const CompareReport report = compareMatrices(result, reference, size, absTolerance, relTolerance);
+    cout << name << " " << (report ? "correct" : "NOT correct") << endl;
+    if (printReports) report.print();
+}
+
 int runTest(int argc, char** argv) 
 {
-    initialiseOpenCL();    
+    InputParser input(argc, argv);
+    const bool keepBinaries = input.cmdOptionExists("-pcache");
+    initialiseOpenCL(keepBinaries);
     
     const unsigned int w = 1024;
     const unsigned int h = 1024;
     const unsigned int N = w * h; // Matrix vector size
+
+    const std::string &absToleranceString = input.getCmdOption("-atol");
+    const std::string &relToleranceString = input.getCmdOption("-rtol");
+    if (!absToleranceString.empty()) absTolerance = atof(absToleranceString.c_str());
+    if (!relToleranceString.empty()) relTolerance = atof(relToleranceString.c_str());
+    printReports = input.cmdOptionExists("-report");
     
+    // Sweep the variants of the tiled kernel, or load the best one from the tuning file
+    if (input.cmdOptionExists("-tune"))
+    {
+        Autotuner tuner(ctx, device, kernelSource);
+        tuning = tuner.tune(h, w, w);
+        if (tuning.tileSize > 0) matrix_mul_tiled_kernel = tuner.createKernel(tuning);
+    }
+
+    // Build matrixMul for this shape, or load the binary of an earlier run
+    if (input.cmdOptionExists("-specialise"))
+    {
+        std::ostringstream options;
+        options << "-cl-kernel-arg-info -D WIDTH=" << w << " -D TILE=" << SPECIALISED_TILE;
+        matrix_mul_specialised_kernel = programCache->createKernel(kernelSource, "matrixMulSpecialised", options.str(), device);
+    }
+    if (keepBinaries) programCache->printStats();
+
+    // Memoise the matrix kernels, the repeated A * B below is served from the results of the first one
+    const bool memoise = input.cmdOptionExists("-memo");
+    if (memoise)
+    {
+        cache->setMemoisation(matrix_mul_kernel);
+        if (matrix_mul_tiled_kernel != NULL) cache->setMemoisation(matrix_mul_tiled_kernel);
+        if (matrix_mul_specialised_kernel != NULL) cache->setMemoisation(matrix_mul_specialised_kernel);
+    }
+
     float *A, *B, *C, *D, *E;        
     A = (float*) malloc(N * sizeof(*A));
     B = (float*) malloc(N * sizeof(*B));
@@ -203,27 +292,75 @@ int runTest(int argc, char** argv)
     CPU_D = (float *) malloc(N * sizeof(*CPU_D));
     CPU_E = (float *) malloc(N * sizeof(*CPU_E));
 
-    matrixMulGPU(A, B, C, w, h);
-    matrixMul(CPU_A, CPU_B, CPU_C, w, h);    
+    // The reference runs on the other cores while the GPU computes the same products,
+    // it only reads A and B, which the GPU path does not write
+    const unsigned int referenceThreads = max(2u, std::thread::hardware_concurrency()) - 1;
+    std::future<void> reference = std::async(std::launch::async, [=]()
+    {
+        matrixMulBlocked(CPU_A, CPU_B, CPU_C, h, w, w, referenceThreads);
+        matrixMulBlocked(CPU_B, CPU_C, CPU_D, h, w, w, referenceThreads);
+        matrixMulBlocked(CPU_C, CPU_D, CPU_E, h, w, w, referenceThreads);
+    });
 
+    matrixMulGPU(A, B, C, w, h);
     matrixMulGPU(B, C, D, w, h);
-    matrixMul(CPU_B, CPU_C, CPU_D, w, h);
-
     matrixMulGPU(C, D, E, w, h);
-    matrixMul(CPU_C, CPU_D, CPU_E, w, h);
+    reference.get();
     
-    if (cache->write_back)
+    if (cache->getWriteBack())
     {
         // Needed to retrieve the final results when write back is enabled. 
         // Does nothing if write back is disabled.
         cache->writeBack(E);
-        cout << "C * D " << (compareMatrices(E, CPU_E, N) ? "correct" : "NOT correct") << endl;
+        checkResult("C * D", E, CPU_E, N);
     }
     else
     {
-        cout << "A * B " << (compareMatrices(C, CPU_C, N) ? "correct" : "NOT correct") << endl;
-        cout << "B * C " << (compareMatrices(D, CPU_D, N) ? "correct" : "NOT correct") << endl;
-        cout << "C * D " << (compareMatrices(E, CPU_E, N) ? "correct" : "NOT correct") << endl;
+        checkResult("A * B", C, CPU_C, N);
+        checkResult("B * C", D, CPU_D, N);
+        checkResult("C * D", E, CPU_E, N);
+    }
+
+    if (memoise)
+    {
+        float *G = (float*) malloc(N * sizeof(*G));
+        matrixMulGPU(A, B, G, w, h);
+        if (cache->getWriteBack()) cache->writeBack(G);
+        checkResult("A * B memoised", G, CPU_C, N);
+        printf("%-30s %u\n", "Kernels elided:", cache->getDurations().kernelsElided);
+        free(G);
+    }
+
+    // Out-of-core test, the device budget in MiB forces A * B into tiles
+    const std::string &gemmString = input.getCmdOption("-gemm");
+    if (!gemmString.empty())
+    {
+        float *F = (float*) malloc(N * sizeof(*F));
+        TiledGemm gemm(cache, ctx, queue, program, (size_t) atoi(gemmString.c_str()) * 1024 * 1024);
+        gemm.multiply(A, B, F, h, w, w);
+        checkResult("Tiled A * B", F, CPU_C, N);
+        free(F);
+    }
+
+    // Derived buffer test, B is transposed once and the transpose is reused while B does not change
+    if (input.cmdOptionExists("-derived"))
+    {
+        float *F = (float*) malloc(N * sizeof(*F));
+        cl_kernel transpose_kernel = clCreateKernel(program, "transpose", &err);
+        cl_kernel matrix_mul_bt_kernel = clCreateKernel(program, "matrixMulBT", &err);
+        DerivedCache derived(cache, ctx);
+        const int transpose = derived.registerTransform(transpose_kernel);
+
+        for (int run = 0; run < 2; ++run)
+        {
+            matrixMulTransposedGPU(derived, transpose, matrix_mul_bt_kernel, A, B, F, w, h);
+            if (cache->getWriteBack()) cache->writeBack(F);
+            checkResult("A * B^T^T", F, CPU_C, N);
+        }
+        derived.printStats();
+        clReleaseKernel(matrix_mul_bt_kernel);
+        clReleaseKernel(transpose_kernel);
+        free(F);
     }
 
     free(CPU_C);
@@ -236,6 +373,10 @@ int runTest(int argc, char** argv)
     free(C);
     free(D);
     free(E);
+    if (matrix_mul_tiled_kernel != NULL) clReleaseKernel(matrix_mul_tiled_kernel);
+    if (matrix_mul_specialised_kernel != NULL) clReleaseKernel(matrix_mul_specialised_kernel);
+    clReleaseKernel(matrix_mul_kernel);
+    delete programCache;    // Releases program
     clReleaseCommandQueue( queue );
     clReleaseContext( ctx );
 